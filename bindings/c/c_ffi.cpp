@@ -13,24 +13,14 @@ void pine_initialize_batch(PINE::Shared *v) { return v->InitializeBatch(); }
 void pine_free_datastream(char *data) { delete[] data; }
 
 int pine_finalize_batch(PINE::Shared *v) {
-    auto p_batch = new PINE::Shared::BatchCommand;
-    auto batch = v->FinalizeBatch();
-    p_batch->ipc_message = batch.ipc_message;
-    p_batch->ipc_return = batch.ipc_return;
-    p_batch->return_locations = batch.return_locations;
+    auto p_batch = new PINE::Shared::BatchCommand(v->FinalizeBatch());
     batch_commands.push_back(p_batch);
     return batch_commands.size() - 1;
 }
 
 uint64_t pine_get_reply_int(PINE::Shared *v, int cmd, int place,
                             PINE::Shared::IPCCommand msg) {
-    auto lcmd = PINE::Shared::BatchCommand{
-        PINE::Shared::IPCBuffer{ batch_commands[cmd]->ipc_message.size,
-                                 batch_commands[cmd]->ipc_message.buffer },
-        PINE::Shared::IPCBuffer{ batch_commands[cmd]->ipc_return.size,
-                                 batch_commands[cmd]->ipc_return.buffer },
-        batch_commands[cmd]->return_locations
-    };
+    auto &lcmd = *batch_commands[cmd];
     switch (msg) {
         case PINE::Shared::MsgRead8:
             return (uint64_t)v->GetReply<PINE::Shared::MsgRead8>(lcmd, place);
@@ -46,13 +36,7 @@ uint64_t pine_get_reply_int(PINE::Shared *v, int cmd, int place,
 }
 
 void pine_send_command(PINE::Shared *v, int cmd) {
-    auto lcmd = PINE::Shared::BatchCommand{
-        PINE::Shared::IPCBuffer{ batch_commands[cmd]->ipc_message.size,
-                                 batch_commands[cmd]->ipc_message.buffer },
-        PINE::Shared::IPCBuffer{ batch_commands[cmd]->ipc_return.size,
-                                 batch_commands[cmd]->ipc_return.buffer },
-        batch_commands[cmd]->return_locations
-    };
+    auto &lcmd = *batch_commands[cmd];
     return v->SendCommand(lcmd);
 }
 
@@ -206,9 +190,6 @@ PINE::Shared::IPCStatus pine_get_error(PINE::Shared *v) {
 
 void pine_free_batch_command(int cmd) {
     if (batch_commands[cmd] != NULL) {
-        delete[] batch_commands[cmd]->ipc_message.buffer;
-        delete[] batch_commands[cmd]->ipc_return.buffer;
-        delete[] batch_commands[cmd]->return_locations;
         delete batch_commands[cmd];
         batch_commands[cmd] = NULL;
     }
@@ -0,0 +1,512 @@
+#include "server.h"
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#define u8 uint8_t
+#define u16 uint16_t
+#define u32 uint32_t
+#define u64 uint64_t
+
+/* Benchmark of the PINE API
+ * Runs against the stand-in server on its own slot, so it can be used on any
+ * box without an emulator. Every measure reports the latency percentiles of a
+ * round trip and the throughput in IPC commands per second.
+ *
+ * Every transport is benchmarked in turn, pass a transport name to only run
+ * that one.
+ *
+ * usage: bench [iterations] [unix|seqpacket|shm|uring|tcp|loopback]
+ */
+
+// slot used by the benchmark, far enough from the default ones to not collide
+// with a running emulator.
+#define BENCH_SLOT 28100
+
+using bench_clock = std::chrono::steady_clock;
+
+// heap allocations made by the current thread, counted by the replacement
+// operator new below. The stand-in server runs on threads of its own, so its
+// allocations do not count, except with the loopback transport.
+static thread_local uint64_t allocations = 0;
+
+auto operator new(size_t size) -> void * {
+    allocations++;
+    if (void *p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+// not inlined, or gcc mistakes the free for a mismatched deallocation
+[[gnu::noinline]] auto operator delete(void *p) noexcept -> void { free(p); }
+
+[[gnu::noinline]] auto operator delete(void *p, size_t) noexcept -> void {
+    free(p);
+}
+
+// runs f iterations times and prints latency percentiles along with the
+// throughput, ops being the number of IPC commands executed by a call to f.
+template <typename F>
+auto Measure(const char *name, int iterations, int ops, F f) -> void {
+    std::vector<uint64_t> samples(iterations);
+
+    // warmup, mostly to get the socket and caches hot
+    for (int i = 0; i < iterations / 10 + 1; i++)
+        f();
+
+    auto begin = bench_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        auto start = bench_clock::now();
+        f();
+        samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         bench_clock::now() - start)
+                         .count();
+    }
+    double total = std::chrono::duration<double>(bench_clock::now() - begin)
+                       .count();
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p) -> double {
+        return samples[std::min<size_t>(samples.size() - 1,
+                                        samples.size() * p)] /
+               1000.0;
+    };
+    printf("%-28s p50 %10.2fus  p99 %10.2fus  p999 %10.2fus  %12.0f ops/s\n",
+           name, percentile(0.5), percentile(0.99), percentile(0.999),
+           (double)iterations * ops / total);
+}
+
+template <typename T>
+auto BenchSingle(PINE::PCSX2 *ipc, int iterations) -> void {
+    char name[64];
+    snprintf(name, sizeof(name), "Read<u%zu>", sizeof(T) * 8);
+    Measure(name, iterations, 1, [&]() { ipc->Read<T>(0x00347D34); });
+    snprintf(name, sizeof(name), "Write<u%zu>", sizeof(T) * 8);
+    Measure(name, iterations, 1, [&]() { ipc->Write<T>(0x00347D34, 5); });
+}
+
+auto BenchBatch(PINE::PCSX2 *ipc, int iterations, int size) -> void {
+    char name[64];
+    // we scale down the number of iterations for bigger batches to keep the
+    // benchmark time bounded
+    int batch_iterations =
+        std::min(iterations, std::max(20, iterations * 10 / size));
+    // batches bigger than the protocol allows get split
+    bool split = size >= MAX_BATCH_REPLY_COUNT;
+
+    ipc->InitializeBatch(split);
+    for (int i = 0; i < size; i++)
+        ipc->Read<u64, true>(0x00100000 + i * 8);
+    auto reads = ipc->FinalizeBatch();
+    snprintf(name, sizeof(name), "batch Read<u64> x%d", size);
+    Measure(name, batch_iterations, size, [&]() { ipc->SendCommand(reads); });
+
+    ipc->InitializeBatch(split);
+    for (int i = 0; i < size; i++)
+        ipc->Write<u64, true>(0x00100000 + i * 8, i);
+    auto writes = ipc->FinalizeBatch();
+    snprintf(name, sizeof(name), "batch Write<u64> x%d", size);
+    Measure(name, batch_iterations, size, [&]() { ipc->SendCommand(writes); });
+}
+
+// pipelined single reads, sent back to back and collected at the end
+auto BenchPipeline(PINE::PCSX2 *ipc, int iterations, int depth) -> void {
+    char name[64];
+    const int count = 256;
+
+    ipc->InitializeBatch();
+    ipc->Read<u32, true>(0x00347D34);
+    auto read = ipc->FinalizeBatch();
+
+    ipc->SetPipelineDepth(depth);
+    snprintf(name, sizeof(name), "pipelined Read<u32> depth %d", depth);
+    Measure(name, std::max(20, iterations / count), count, [&]() {
+        for (int i = 0; i < count; i++)
+            ipc->Submit(read);
+        ipc->Flush();
+    });
+    ipc->SetPipelineDepth(PIPELINE_DEPTH);
+}
+
+// asynchronous single reads, sent back to back and waited for at the end
+auto BenchAsync(PINE::PCSX2 *ipc, int iterations) -> void {
+    const int count = 256;
+    std::vector<std::future<u32>> reads(count);
+
+    Measure("async Read<u32>", std::max(20, iterations / count), count, [&]() {
+        for (int i = 0; i < count; i++)
+            reads[i] = ipc->ReadAsync<u32>(0x00347D34);
+        for (int i = 0; i < count; i++)
+            reads[i].get();
+    });
+}
+
+// single reads sent from several threads at once, each one getting its own
+// connection out of the pool, or merged into batches if coalescing
+auto BenchThreads(PINE::PCSX2 *ipc, int iterations, int threads,
+                  bool coalesce) -> void {
+    char name[64];
+    const int count = 256;
+
+    ipc->SetPoolSize(coalesce ? 1 : threads);
+    ipc->SetCoalescing(std::chrono::microseconds(coalesce ? 100 : 0),
+                       threads);
+    snprintf(name, sizeof(name), "%sRead<u32> x%d threads",
+             coalesce ? "coalesced " : "", threads);
+    Measure(name, std::max(20, iterations / count), count * threads, [&]() {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++)
+            workers.emplace_back([&]() {
+                for (int i = 0; i < count; i++)
+                    ipc->Read<u32>(0x00347D34);
+            });
+        for (auto &w : workers)
+            w.join();
+    });
+    ipc->SetCoalescing(std::chrono::microseconds(0));
+}
+
+// rebuilds, sends and decodes a batch every iteration, like a script reading
+// different addresses every frame, then counts the heap allocations of doing
+// so once warm.
+auto BenchLifecycle(PINE::PCSX2 *ipc, int iterations) -> void {
+    PINE::Shared::BatchCommand batch;
+    u64 sum = 0;
+    auto frame = [&]() {
+        ipc->InitializeBatch();
+        for (u32 i = 0; i < 100; i++)
+            ipc->Read<u32, true>(0x00100000 + i * 4);
+        ipc->Version<true>();
+        ipc->FinalizeBatch(batch);
+        ipc->SendCommand(batch);
+        for (int i = 0; i < 100; i++)
+            sum += ipc->GetReply<PINE::PCSX2::MsgRead32>(batch, i);
+    };
+    Measure("rebuilt batch Read<u32> x100", iterations, 101, frame);
+
+    uint64_t before = allocations;
+    for (int i = 0; i < iterations; i++)
+        frame();
+    printf("%-28s %10.2f per iteration\n", "heap allocations",
+           (double)(allocations - before) / iterations);
+}
+
+// a watch list overlapping itself, like the ones generated from structure
+// definitions, sent as is then optimized
+auto BenchOptimizer(PINE::PCSX2 *ipc, int iterations) -> void {
+    for (bool optimize : { false, true }) {
+        ipc->InitializeBatch();
+        for (u32 i = 0; i < 256; i++) {
+            ipc->Read<u8, true>(0x00100000 + i);
+            ipc->Read<u16, true>(0x00100000 + (i & ~1));
+            ipc->Read<u32, true>(0x00100000 + (i & ~3));
+        }
+        auto watch = ipc->FinalizeBatch(optimize);
+        char name[64];
+        snprintf(name, sizeof(name), "%s watch list x768",
+                 optimize ? "optimized" : "plain");
+        Measure(name, iterations, 768, [&]() { ipc->SendCommand(watch); });
+        printf("%-28s %10d bytes\n", "message", watch.ipc_message.size);
+    }
+}
+
+// dumps a 64 KiB structure, with range commands when the server knows about
+// them and with 64 bit reads otherwise
+auto BenchRanges(PINE::PCSX2 *ipc, const char *name, int iterations)
+    -> void {
+    std::vector<char> dump(65536);
+    Measure(name, std::max(20, iterations / 10), 1,
+            [&]() { ipc->ReadRange(0x00100000, dump.size(), dump.data()); });
+}
+
+// one field of 256 structures of 0x140 bytes, gathered or read in a batch
+auto BenchGathers(PINE::PCSX2 *ipc, const char *name, int iterations)
+    -> void {
+    std::vector<u32> hp(256);
+    Measure(name, iterations, 256, [&]() {
+        ipc->ReadStrided(0x00100000, 0x140, hp.size(), hp.data());
+    });
+}
+
+// a structure of the game mirrored field by field
+struct Actor {
+    u32 health;
+    float speed;
+    u16 flags;
+    u64 score;
+};
+PINE_STRUCT(Actor, 0x140, PINE::Field<&Actor::health, 0x10>,
+            PINE::Field<&Actor::speed, 0x24>, PINE::Field<&Actor::flags, 0x02>,
+            PINE::Field<&Actor::score, 0x30>);
+
+// 256 structures of 4 fields, described once or read field by field
+auto BenchStructs(PINE::PCSX2 *ipc, int iterations) -> void {
+    std::vector<Actor> actors(256);
+    Measure("ReadStructs x256", iterations, 256 * 4, [&]() {
+        ipc->ReadStructs(0x00100000, actors.size(), actors.data());
+    });
+    Measure("WriteStructs x256", iterations, 256 * 4, [&]() {
+        ipc->WriteStructs(0x00100000, actors.data(), actors.size());
+    });
+
+    ipc->InitializeBatch();
+    for (u32 i = 0; i < 256; i++) {
+        u32 address = 0x00100000 + i * 0x140;
+        ipc->Read<u32, true>(address + 0x10);
+        ipc->Read<float, true>(address + 0x24);
+        ipc->Read<u16, true>(address + 0x02);
+        ipc->Read<u64, true>(address + 0x30);
+    }
+    auto batch = ipc->FinalizeBatch();
+    Measure("batch of field reads x256", iterations, 256 * 4, [&]() {
+        ipc->SendCommand(batch);
+        for (u32 i = 0; i < 256; i++) {
+            actors[i].health =
+                ipc->GetReply<PINE::PCSX2::MsgRead32>(batch, i * 4);
+            u32 speed =
+                ipc->GetReply<PINE::PCSX2::MsgRead32>(batch, i * 4 + 1);
+            memcpy(&actors[i].speed, &speed, sizeof(speed));
+            actors[i].flags =
+                ipc->GetReply<PINE::PCSX2::MsgRead16>(batch, i * 4 + 2);
+            actors[i].score =
+                ipc->GetReply<PINE::PCSX2::MsgRead64>(batch, i * 4 + 3);
+        }
+    });
+}
+
+// [[[base]+0x10]+0x24]+0x8, followed by the server or one read at a time
+auto BenchPointers(PINE::PCSX2 *ipc, const char *name, int iterations)
+    -> void {
+    ipc->Write<u32>(0x00100000, 0x00110000);
+    ipc->Write<u32>(0x00110010, 0x00120000);
+    ipc->Write<u32>(0x00120024, 0x00130000);
+    Measure(name, iterations, 1, [&]() {
+        ipc->ReadPointerPath<u32>(0x00100000, 0x10, 0x24, 0x8);
+    });
+}
+
+// a frame of 4 subsystems reading the same 4 values
+auto BenchCache(PINE::PCSX2 *ipc, const char *name, int iterations) -> void {
+    Measure(name, iterations, 16, [&]() {
+        ipc->Tick();
+        for (int subsystem = 0; subsystem < 4; subsystem++)
+            for (u32 i = 0; i < 4; i++)
+                ipc->Read<u32>(0x00100000 + i * 0x40);
+    });
+}
+
+// 64 fields of an array of structures, none of them changing
+auto BenchWatcher(PINE::PCSX2 *ipc, int iterations) -> void {
+    PINE::Watcher watcher(*ipc);
+    for (u32 i = 0; i < 64; i++)
+        watcher.Watch<u32>(0x00100000 + i * 0x40, [](u32) {});
+    Measure("Watcher poll x64", iterations, 64, [&]() { watcher.Poll(); });
+}
+
+// the whole EE RAM, then the few candidates left
+auto BenchScanner(PINE::PCSX2 *ipc, int iterations) -> void {
+    for (u32 i = 0; i < 1000; i++)
+        ipc->Write<u32>(0x00100000 + i * 0x40, 0xDEADBEEF);
+    Measure("Scanner<u32> 32MiB", std::max(5, iterations / 100), 1, [&]() {
+        PINE::Scanner<u32> scanner(*ipc, 0, EE_RAM_SIZE);
+        scanner.Scan(PINE::Scanner<u32>::Exact, 0xDEADBEEF);
+    });
+    PINE::Scanner<u32> scanner(*ipc, 0, EE_RAM_SIZE);
+    scanner.Scan(PINE::Scanner<u32>::Exact, 0xDEADBEEF);
+    Measure("Scanner<u32> rescan x1000", iterations, 1000,
+            [&]() { scanner.Scan(PINE::Scanner<u32>::Unchanged); });
+}
+
+// signatures over the whole EE RAM, ops/s being MiB/s
+auto BenchPatterns(PINE::PCSX2 *ipc, int iterations) -> void {
+    const char code[] = "\x8F\xA2\x12\x34\x24\x03";
+    for (u32 i = 0; i < 16; i++)
+        ipc->WriteRange(0x00100000 + i * 0x10000, code, 6);
+    int mib = EE_RAM_SIZE >> 20;
+    Measure("FindPattern 32MiB", std::max(5, iterations / 100), mib,
+            [&]() { ipc->FindPattern(0, EE_RAM_SIZE, "8F A2 ?? ?? 24 03"); });
+    std::vector<std::string> patterns = { "8F A2 ?? ?? 24 03", "27 BD FF ??",
+                                          "DE AD ?? EF", "0C ?? ?? 00" };
+    Measure("FindPatterns 32MiB x4", std::max(5, iterations / 100), mib,
+            [&]() { ipc->FindPatterns(0, EE_RAM_SIZE, patterns); });
+}
+
+#ifdef __linux__
+// 1MiB refreshed whole, read back from the mirror instead of over IPC
+auto BenchMirror(PINE::PCSX2 *ipc, int iterations) -> void {
+    std::string path = "/tmp/pine-bench-mirror-" + std::to_string(getpid());
+    PINE::MemoryMirror mirror(*ipc, path, { { 0x00100000, 0x100000 } });
+    PINE::MemoryMirror::Reader reader(path);
+    Measure("MemoryMirror refresh 1MiB", iterations, 1,
+            [&]() { mirror.Refresh(); });
+    u32 value;
+    Measure("Mirror Read<u32> x1000", iterations, 1000, [&]() {
+        for (u32 i = 0; i < 1000; i++)
+            reader.Read(0x00100000 + i * 0x40, value);
+    });
+    Measure("Read<u32> x1000", std::max(5, iterations / 100), 1000, [&]() {
+        for (u32 i = 0; i < 1000; i++)
+            ipc->Read<u32>(0x00100000 + i * 0x40);
+    });
+    unlink(path.c_str());
+}
+#endif
+
+auto BenchStrings(PINE::PCSX2 *ipc, int iterations) -> void {
+    Measure("Version", iterations, 1, [&]() { delete[] ipc->Version(); });
+    Measure("GetGameTitle", iterations, 1,
+            [&]() { delete[] ipc->GetGameTitle(); });
+
+    ipc->InitializeBatch();
+    ipc->Version<true>();
+    ipc->GetGameTitle<true>();
+    ipc->GetGameID<true>();
+    ipc->GetGameUUID<true>();
+    ipc->GetGameVersion<true>();
+    auto strings = ipc->FinalizeBatch();
+    Measure("batch strings x5", iterations, 5,
+            [&]() { ipc->SendCommand(strings); });
+}
+
+// runs the whole benchmark suite over one transport
+auto BenchTransport(const char *name, PINE::Shared::TransportType type,
+                    bool loopback, int iterations) -> bool {
+    printf("==== %s transport\n", name);
+    PINE::PCSX2Server server(BENCH_SLOT, type);
+    if (!loopback && !server.Start()) {
+        printf("Could not start the stand-in server!\n");
+        return false;
+    }
+    PINE::PCSX2 *ipc = new PINE::PCSX2(BENCH_SLOT, type);
+    if (loopback)
+        ipc->SetTransport(server.MakeLoopback());
+
+    try {
+        printf("== single commands\n");
+        BenchSingle<u8>(ipc, iterations);
+        BenchSingle<u16>(ipc, iterations);
+        BenchSingle<u32>(ipc, iterations);
+        BenchSingle<u64>(ipc, iterations);
+
+        printf("== batch commands\n");
+        // MAX_BATCH_REPLY_COUNT - 1 is the biggest batch the protocol allows,
+        // the ones past it get split
+        for (int size : { 1, 10, 100, 1000, 10000, MAX_BATCH_REPLY_COUNT - 1,
+                          200000 })
+            BenchBatch(ipc, iterations, size);
+
+        printf("== batch optimizer\n");
+        BenchOptimizer(ipc, iterations);
+
+        printf("== memory ranges\n");
+        BenchRanges(ipc, "ReadRange 64KiB", iterations);
+        server.ranges = false;
+        PINE::PCSX2 fallback(BENCH_SLOT, type);
+        if (loopback)
+            fallback.SetTransport(server.MakeLoopback());
+        BenchRanges(&fallback, "ReadRange 64KiB fallback", iterations);
+        server.ranges = true;
+
+        printf("== gather reads\n");
+        BenchGathers(ipc, "ReadStrided x256", iterations);
+        server.gathers = false;
+        PINE::PCSX2 batched(BENCH_SLOT, type);
+        if (loopback)
+            batched.SetTransport(server.MakeLoopback());
+        BenchGathers(&batched, "ReadStrided x256 fallback", iterations);
+        server.gathers = true;
+
+        printf("== structures\n");
+        BenchStructs(ipc, iterations);
+
+        printf("== pointer paths\n");
+        BenchPointers(ipc, "ReadPointerPath x3", iterations);
+        server.pointers = false;
+        PINE::PCSX2 chased(BENCH_SLOT, type);
+        if (loopback)
+            chased.SetTransport(server.MakeLoopback());
+        BenchPointers(&chased, "ReadPointerPath x3 fallback", iterations);
+        server.pointers = true;
+
+        printf("== read cache\n");
+        BenchCache(ipc, "Read<u32> x16 uncached", iterations);
+        ipc->SetReadCache(true);
+        BenchCache(ipc, "Read<u32> x16 cached", iterations);
+        ipc->SetReadCache(false);
+
+        printf("== pipelined commands\n");
+        for (int depth : { 1, 4, 16, 64 })
+            BenchPipeline(ipc, iterations, depth);
+
+        printf("== asynchronous commands\n");
+        BenchAsync(ipc, iterations);
+
+        printf("== concurrent threads\n");
+        for (bool coalesce : { false, true })
+            for (int threads : { 1, 2, 4, 8 })
+                BenchThreads(ipc, iterations, threads, coalesce);
+
+        printf("== scanner\n");
+        BenchScanner(ipc, iterations);
+
+        printf("== byte patterns\n");
+        BenchPatterns(ipc, iterations);
+
+#ifdef __linux__
+        printf("== memory mirror\n");
+        BenchMirror(ipc, iterations);
+#endif
+
+        printf("== watcher\n");
+        BenchWatcher(ipc, iterations);
+
+        printf("== batch lifecycle\n");
+        BenchLifecycle(ipc, iterations);
+
+        printf("== string commands\n");
+        BenchStrings(ipc, iterations);
+    } catch (...) {
+        printf("ERROR!!!!!\n");
+        delete ipc;
+        return false;
+    }
+
+    delete ipc;
+    server.Stop();
+    return true;
+}
+
+auto main(int argc, char *argv[]) -> int {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 10000;
+    // only benchmark the transport whose name starts with this, if set
+    const char *filter = (argc > 2) ? argv[2] : "";
+
+    struct {
+        const char *name;
+        PINE::Shared::TransportType type;
+        bool loopback;
+    } transports[] = {
+#ifndef _WIN32
+        { "unix", PINE::Shared::UnixTransport, false },
+        { "seqpacket", PINE::Shared::SeqPacketTransport, false },
+#endif
+#ifdef __linux__
+        { "shm", PINE::Shared::SharedMemoryTransport, false },
+        { "uring", PINE::Shared::UringTransport, false },
+#endif
+        { "tcp", PINE::Shared::TCPTransport, false },
+        { "loopback", PINE::Shared::DefaultTransport, true },
+    };
+
+    for (auto &t : transports) {
+        if (strncmp(t.name, filter, strlen(filter)) != 0)
+            continue;
+        if (!BenchTransport(t.name, t.type, t.loopback, iterations))
+            return 1;
+    }
+    return 0;
+}
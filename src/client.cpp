@@ -51,6 +51,15 @@ auto main(int argc, char *argv[]) -> int {
     // we create a new thread
     std::thread first(read_background, ipc);
 
+    // if all you need is to know when values change, a watcher polls them
+    // all in one batch on a thread of its own, and only calls you back for
+    // the ones which changed.
+    PINE::Watcher watcher(*ipc, std::chrono::milliseconds(100));
+    watcher.Watch<u8>(0x00347D34, [](u8 value) {
+        printf("PINE::Watcher 0x00347D34 :  %u\n", value);
+    });
+    watcher.Start();
+
     // in this case we wait 5 seconds before writing to our address
     msleep(5000);
     try {
@@ -99,6 +108,15 @@ auto main(int argc, char *argv[]) -> int {
                ipc->GetReply<PINE::PCSX2::MsgVersion>(resr, 2));
         printf("PINE::PCSX2::Read<uint8_t>(0x00347D32) :  %u\n",
                ipc->GetReply<PINE::PCSX2::MsgRead8>(resr, 3));
+
+        // if the commands of your batch are always the same you can also let
+        // the compiler lay it out: the replies then come back as a tuple, no
+        // index nor function type to remember.
+        PINE::Batch<PINE::Command::Read<u8>, PINE::Command::Version> typed(
+            { 0x00347D34 }, {});
+        auto [value, version] = ipc->Send(typed);
+        printf("PINE::PCSX2::Read<uint8_t>(0x00347D34) :  %u, %s\n", value,
+               version.c_str());
     } catch (...) {
         // if the operation failed
         printf("ERROR!!!!!\n");
@@ -108,6 +126,10 @@ auto main(int argc, char *argv[]) -> int {
     // (while true) so it will never do so.
     first.join();
 
+    // the watcher polls through our IPC object, so it has to be stopped
+    // before that object goes away.
+    watcher.Stop();
+
     // we do not forget to free our IPC object to avoid any memory leak,
     // although they will technically get automatically freed by the OS at
     // process shutdown
@@ -0,0 +1,123 @@
+#include "pine_coro.h"
+#include "server.h"
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+
+#define u8 uint8_t
+#define u16 uint16_t
+#define u32 uint32_t
+#define u64 uint64_t
+
+/* Test case suite for the coroutine flavor of the PINE API
+ * Needs C++20, hence its own executable. Runs against the stand-in server.
+ */
+
+// slot of the stand-in server used by the test suite, far enough from the
+// default ones and from the one of the main test suite.
+#define TEST_SLOT 28102
+
+// chases a chain of pointers, each one pointing to the next, then returns
+// the value at its end.
+auto chase(PINE::Awaitable &ipc, u32 address, int depth) -> PINE::Task<u32> {
+    for (int i = 0; i < depth; i++)
+        address = co_await ipc.Read<u32>(address);
+    co_return co_await ipc.Read<u32>(address);
+}
+
+SCENARIO("Coroutines can await IPC commands", "[pine][server][coro]") {
+
+    GIVEN("A stand-in server and a scheduler") {
+        auto type = GENERATE(PINE::Shared::DefaultTransport,
+#ifdef __linux__
+                             PINE::Shared::SharedMemoryTransport,
+#endif
+                             PINE::Shared::TCPTransport);
+        PINE::PCSX2Server server(TEST_SLOT, type);
+        REQUIRE(server.Start());
+        PINE::PCSX2 pcsx2(TEST_SLOT, type);
+        PINE::Scheduler scheduler;
+        PINE::Awaitable ipc(pcsx2, scheduler);
+
+        THEN("Hundreds of scripts run concurrently on one thread") {
+            // script i has its own chain of 8 pointers
+            for (u32 i = 0; i < 200; i++) {
+                u32 base = 0x00100000 + i * 0x100;
+                for (u32 j = 0; j < 8; j++)
+                    pcsx2.Write<u32>(base + j * 4, base + (j + 1) * 4);
+                pcsx2.Write<u32>(base + 8 * 4, i);
+            }
+
+            std::vector<u32> results(200, 0xFFFFFFFF);
+            for (u32 i = 0; i < 200; i++)
+                scheduler.Spawn([](PINE::Awaitable &ipc, u32 i,
+                                   u32 &result) -> PINE::Task<> {
+                    result = co_await chase(ipc, 0x00100000 + i * 0x100, 8);
+                }(ipc, i, results[i]));
+            scheduler.Run();
+            for (u32 i = 0; i < 200; i++)
+                REQUIRE(results[i] == i);
+        }
+
+        THEN("Scripts can wait for a value") {
+            int polls = 0;
+            pcsx2.Write<u32>(0x00200000, 0);
+            scheduler.Spawn([](PINE::Awaitable &ipc,
+                               int &polls) -> PINE::Task<> {
+                while (co_await ipc.Read<u32>(0x00200000) != 3) {
+                    polls++;
+                    co_await ipc.Sleep(std::chrono::milliseconds(1));
+                }
+            }(ipc, polls));
+            scheduler.Spawn([](PINE::Awaitable &ipc) -> PINE::Task<> {
+                for (u32 i = 1; i <= 3; i++) {
+                    co_await ipc.Sleep(std::chrono::milliseconds(5));
+                    co_await ipc.Write<u32>(0x00200000, i);
+                }
+            }(ipc));
+            scheduler.Run();
+            REQUIRE(polls > 0);
+            REQUIRE(pcsx2.Read<u32>(0x00200000) == 3);
+        }
+
+        THEN("Batches and statuses can be awaited") {
+            pcsx2.InitializeBatch();
+            pcsx2.Version<true>();
+            auto batch = pcsx2.FinalizeBatch();
+            PINE::Shared::EmuStatus status = PINE::Shared::Shutdown;
+            scheduler.Spawn([](PINE::Awaitable &ipc,
+                               PINE::Shared::BatchCommand &batch,
+                               PINE::Shared::EmuStatus &status)
+                                -> PINE::Task<> {
+                co_await ipc.Send(batch);
+                status = co_await ipc.Status();
+            }(ipc, batch, status));
+            scheduler.Run();
+            REQUIRE(status == PINE::Shared::Running);
+            char *version = pcsx2.GetReply<PINE::PCSX2::MsgVersion>(batch, 0);
+            REQUIRE(strcmp(version, server.version.c_str()) == 0);
+            delete[] version;
+        }
+
+        THEN("Failures are thrown in the awaiting coroutine") {
+            bool caught = false;
+            scheduler.Spawn([](PINE::Awaitable &ipc,
+                               bool &caught) -> PINE::Task<> {
+                try {
+                    co_await ipc.Read<u32>(EE_RAM_SIZE);
+                } catch (PINE::Shared::IPCStatus) {
+                    caught = true;
+                }
+                // and do not break the following commands
+                co_await ipc.Write<u32>(0x00200000, 6);
+            }(ipc, caught));
+            scheduler.Spawn([](PINE::Awaitable &ipc) -> PINE::Task<> {
+                co_await ipc.Read<u32>(EE_RAM_SIZE);
+            }(ipc));
+            REQUIRE_THROWS_AS(scheduler.Run(), PINE::Shared::IPCStatus);
+            REQUIRE(caught);
+            REQUIRE(pcsx2.Read<u32>(0x00200000) == 6);
+        }
+
+        server.Stop();
+    }
+}
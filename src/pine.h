@@ -1,11 +1,30 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <ctype.h>
+#include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
 #include <sys/types.h>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #ifdef _WIN32
 #define read_portable(a, b, c) (recv(a, b, c, 0))
@@ -16,12 +35,27 @@
 #define read_portable(a, b, c) (read(a, b, c))
 #define write_portable(a, b, c) (write(a, b, c))
 #define close_portable(a) (close(a))
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 #endif
+#ifdef __linux__
+#include <climits>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 
 /**
  * The PINE API. @n
@@ -75,1053 +109,7593 @@ void hexdump(void *ptr, int buflen) {
 
 #endif
 
-class Shared {
-    // allow test suite to poke internals
-  protected:
-    /**
-     * IPC Slot identifier. @n
-     * Used by the IPC to identify concurrent sessions.
-     */
-    uint16_t slot;
+/**
+ * Maximum memory used by an IPC message request.
+ * Equivalent to 50,000 Write64 requests.
+ * @see MAX_IPC_RETURN_SIZE
+ * @see MAX_BATCH_REPLY_COUNT
+ */
+#define MAX_IPC_SIZE 650000
 
-#if defined(_WIN32) || defined(DOXYGEN)
-    /**
-     * Socket handler. @n
-     * On windows it uses the type SOCKET, on linux int.
-     */
-    SOCKET sock;
-#else
-    int sock;
-#endif
+/**
+ * Maximum memory used by an IPC message reply.
+ * Equivalent to 50,000 Read64 replies.
+ * @see MAX_IPC_SIZE
+ * @see MAX_BATCH_REPLY_COUNT
+ */
+#define MAX_IPC_RETURN_SIZE 450000
 
-    /**
-     * Socket initialization state. @n
-     * True if initialized, false if not or if impossible to connect to.
-     */
-    bool sock_state = false;
+/**
+ * Maximum number of commands sent in a batch message.
+ * @see MAX_IPC_RETURN_SIZE
+ * @see MAX_IPC_SIZE
+ */
+#define MAX_BATCH_REPLY_COUNT 50000
 
-#if !defined(_WIN32) || defined(DOXYGEN)
+/**
+ * Maximum size of the memory range moved by a single range command, and of
+ * the values gathered by a single gather command. Bigger ones get split into
+ * several commands.
+ * @see Shared::ReadRange
+ * @see Shared::WriteRange
+ * @see Shared::ReadStrided
+ */
+#define MAX_RANGE_SIZE 262144
+
+/**
+ * Size of the chunks of memory byte patterns get searched in, one being
+ * matched while the next one is read.
+ * @see Shared::FindPatterns
+ */
+#define PATTERN_CHUNK_SIZE (16 * MAX_RANGE_SIZE)
+
+/**
+ * Default number of commands a pipeline keeps in flight.
+ * @see Shared::Submit
+ */
+#define PIPELINE_DEPTH 32
+
+/**
+ * Default size of the messages and replies a pipeline keeps in flight. @n
+ * Comfortably below the default socket buffer sizes.
+ * @see Shared::Submit
+ */
+#define PIPELINE_WINDOW 65536
+
+/**
+ * Default number of single reads merged into one batch by coalescing.
+ * @see Shared::SetCoalescing
+ */
+#define COALESCE_MAX 64
+
+/**
+ * Size of each ring buffer of the shared memory transport. @n
+ * Big enough to always fit the biggest message along with a wrap around.
+ * @see SharedMemory
+ */
+#define SHM_RING_SIZE (1 << 21)
+
+/**
+ * Size of the control block at the beginning of the shared memory.
+ * @see SharedMemoryRing::Header
+ */
+#define SHM_HEADER_SIZE 4096
+
+/**
+ * Size of the shared memory of the shared memory transport.
+ * @see SharedMemory
+ */
+#define SHM_SIZE (SHM_HEADER_SIZE + 2 * SHM_RING_SIZE)
+
+/**
+ * Number of times a shared memory ring is polled before going to sleep. @n
+ * Replies to small messages usually come back before we run out of spins,
+ * saving us two futex syscalls. Uniprocessor machines never spin.
+ */
+#define SHM_SPIN_COUNT 4000
+
+/**
+ * Time, in nanoseconds, a shared memory ring sleeps before checking its peer
+ * is still alive.
+ */
+#define SHM_WAIT_TIMEOUT 50000000
+
+/**
+ * Size of the pages of a memory mirror, the unit it gets refreshed by.
+ * @see MemoryMirror
+ */
+#define MIRROR_PAGE_SIZE 4096
+
+/**
+ * Number of entries of the submission queue of the io_uring transport.
+ */
+#define URING_ENTRIES 8
+
+/**
+ * IPC transport. @n
+ * A transport moves IPC messages to the server and brings back its replies,
+ * Shared takes care of everything else. This allows the exact same API to run
+ * on top of different IPC mechanisms, so you can pick the fastest one for your
+ * setup or bring your own through Shared::SetTransport.
+ * @see Shared::TransportType
+ */
+class Transport {
+  public:
     /**
-     * Unix socket name. @n
-     * The name of the unix socket used on platforms with unix socket support.
-     * @n Currently everything except Windows.
+     * Connects to the server.
+     * @return false if the server cannot be reached.
      */
-    std::string SOCKET_NAME;
-#endif
+    virtual auto Connect() -> bool = 0;
 
     /**
-     * Maximum memory used by an IPC message request.
-     * Equivalent to 50,000 Write64 requests.
-     * @see MAX_IPC_RETURN_SIZE
-     * @see MAX_BATCH_REPLY_COUNT
+     * Closes the connection to the server.
      */
-#define MAX_IPC_SIZE 650000
+    virtual auto Close() -> void = 0;
 
     /**
-     * Maximum memory used by an IPC message reply.
-     * Equivalent to 50,000 Read64 replies.
-     * @see MAX_IPC_SIZE
-     * @see MAX_BATCH_REPLY_COUNT
+     * Connection state.
+     * @return true if connected, false if not or if impossible to connect to.
      */
-#define MAX_IPC_RETURN_SIZE 450000
+    virtual auto Connected() -> bool = 0;
 
     /**
-     * Maximum number of commands sent in a batch message.
-     * @see MAX_IPC_RETURN_SIZE
-     * @see MAX_IPC_SIZE
+     * Sends an entire IPC message.
+     * @param buf The message, size header included.
+     * @param size The size of the message.
+     * @return false on error.
      */
-#define MAX_BATCH_REPLY_COUNT 50000
+    virtual auto Send(const char *buf, int size) -> bool = 0;
 
     /**
-     * IPC return buffer. @n
-     * A preallocated buffer used to store all IPC replies.
-     * @see ipc_buffer
-     * @see MAX_IPC_RETURN_SIZE
+     * Receives an entire IPC reply. @n
+     * Replies are received in the same order their messages were sent.
+     * @param buf Buffer to store the reply into.
+     * @param max The size of buf.
+     * @return The size of the reply, or 0 on error.
      */
-    char *ret_buffer;
+    virtual auto Receive(char *buf, int max) -> int = 0;
 
     /**
-     * IPC messages buffer. @n
-     * A preallocated buffer used to store all IPC messages.
-     * @see ret_buffer
-     * @see MAX_IPC_SIZE
+     * Receives an entire IPC reply, without copying it if possible. @n
+     * Transports keeping replies in memory of their own hand over a pointer
+     * to it, valid until the next message is sent or reply received. Others
+     * receive it in buf.
+     * @param buf Buffer to store the reply into, if need be.
+     * @param max The size of buf.
+     * @param size Set to the size of the reply, or 0 on error.
+     * @return The reply.
+     * @see Receive
      */
-    char *ipc_buffer;
+    virtual auto ReceiveInPlace(char *buf, int max, int &size) -> char * {
+        size = Receive(buf, max);
+        return buf;
+    }
 
     /**
-     * Length of the batch IPC request. @n
-     * This is used when chaining multiple IPC commands in one go to store the
-     * current size of the packet chain.
-     * @see IPCCommand
-     * @see MAX_IPC_SIZE
+     * Sends an entire IPC message and receives its reply. @n
+     * Transports able to do both at once override this, the others send then
+     * receive.
+     * @param buf The message, size header included.
+     * @param size The size of the message.
+     * @param ret Buffer to store the reply into, if need be.
+     * @param max The size of ret.
+     * @param reply_size Set to the size of the reply, 0 if it could not be
+     * received or -1 if the message could not be sent.
+     * @return The reply.
+     * @see ReceiveInPlace
      */
-    unsigned int batch_len = 0;
+    virtual auto SendReceive(const char *buf, int size, char *ret, int max,
+                             int &reply_size) -> char * {
+        if (!Send(buf, size)) {
+            reply_size = -1;
+            return ret;
+        }
+        return ReceiveInPlace(ret, max, reply_size);
+    }
 
     /**
-     * Length of the reply of the batch IPC request. @n
-     * This is used when chaining multiple IPC commands in one go
-     * to store the length of the reply of the IPC message.
-     * @see IPCCommand
-     * @see MAX_IPC_RETURN_SIZE
+     * Whether an entire reply has been received already, and is waiting in
+     * the buffers of the transport. @n
+     * Its descriptor does not become readable for it, so whoever waits on
+     * it has to check this first.
+     * @see Descriptor
      */
-    unsigned int reply_len = 0;
+    virtual auto Buffered() -> bool { return false; }
 
     /**
-     * Whether a batch command reply needs relocation. @n
-     * This automatically sets up the reply size to be the
-     * maximum possible since we cannot anticipate how much
-     * resources this will take.
-     * @see IPCCommand
-     * @see MAX_IPC_RETURN_SIZE
+     * Receives an entire IPC reply if it has arrived, without waiting. @n
+     * Transports that cannot tell whether a reply has arrived wait for it.
+     * @param buf Buffer to store the reply into.
+     * @param max The size of buf.
+     * @return The size of the reply, 0 if it has not arrived yet, or -1 on
+     * error.
+     * @see Descriptor
      */
-    bool needs_reloc = false;
+    virtual auto TryReceive(char *buf, int max) -> int {
+        int size = Receive(buf, max);
+        return size ? size : -1;
+    }
 
     /**
-     * Number of IPC messages of the batch IPC request. @n
-     * This is used when chaining multiple IPC commands in one go
-     * to store the number of IPC messages chained together.
-     * @see IPCCommand
-     * @see MAX_BATCH_REPLY_COUNT
+     * File descriptor becoming readable when replies arrive. @n
+     * Used by a Reactor to wait on many transports at once.
+     * @return The descriptor, or -1 if there is none.
+     * @see Reactor
      */
-    unsigned int arg_cnt = 0;
+    virtual auto Descriptor() -> int { return -1; }
 
     /**
-     * Position of the batch arguments. @n
-     * This is used when chaining multiple IPC commands in one go.
-     * Stores the location of each message reply in the buffer
-     * sent by FinalizeBatch.
-     * @see FinalizeBatch
-     * @see IPCCommand
-     * @see MAX_BATCH_REPLY_COUNT
+     * Transport Destructor.
      */
-    unsigned int *batch_arg_place;
+    virtual ~Transport() {}
+};
 
+/**
+ * Base of all socket based transports. @n
+ * Implements sending and receiving over a stream of bytes, subclasses only
+ * have to open the socket.
+ */
+class SocketTransport : public Transport {
+  protected:
+#if defined(_WIN32) || defined(DOXYGEN)
     /**
-     * Sets the state of the batch command building. @n
-     * This is used when chaining multiple IPC commands in one go. @n
-     * As we cannot build multiple batch IPC commands at the same time because
-     * of state keeping issues we block the initialization of another batch
-     * request until the other ends.
+     * Socket handler. @n
+     * On windows it uses the type SOCKET, on linux int.
      */
-    std::mutex batch_blocking;
+    SOCKET sock;
+#else
+    int sock;
+#endif
 
     /**
-     * Sets the state of the IPC message building. @n
-     * As we cannot build multiple batch IPC commands at the same time because
-     * of state keeping issues we block the initialization of another message
-     * request until the other ends.
+     * Socket initialization state. @n
+     * True if initialized, false if not or if impossible to connect to.
      */
-    std::mutex ipc_blocking;
+    bool sock_state = false;
 
     /**
-     * IPC result codes. @n
-     * A list of possible result codes the IPC can send back. @n
-     * Each one of them is what we call an "opcode" or "tag" and is the
-     * first byte sent by the IPC to differentiate between results.
+     * Bytes received past the end of the last reply. @n
+     * With multiple messages in flight a single read can bring back the
+     * beginning of the next replies, which we keep for the next Receive.
      */
-    enum IPCResult : unsigned char {
-        IPC_OK = 0,     /**< IPC command successfully completed. */
-        IPC_FAIL = 0xFF /**< IPC command failed to complete. */
-    };
+    std::vector<char> leftover;
 
     /**
-     * Converts an uint to an char* in little endian.
-     * @param res_array The array to modify.
-     * @param res The value to convert.
-     * @param i When to insert it into the array
-     * @return res_array
+     * Connects the socket to a server address.
+     * @param address The address of the server.
+     * @param size The size of address.
+     * @return false if the server cannot be reached.
      */
-    template <typename T>
-    static auto ToArray(char *res_array, T res, int i) -> char * {
-        memcpy((res_array + i), (char *)&res, sizeof(T));
-        return res_array;
+    auto ConnectTo(struct sockaddr *address, int size) -> bool {
+        if (connect(sock, address, size) < 0) {
+            close_portable(sock);
+            sock_state = false;
+            return false;
+        }
+        sock_state = true;
+        return true;
+    }
+
+  public:
+    auto Close() -> void override {
+        if (sock_state)
+            close_portable(sock);
+        sock_state = false;
+        leftover.clear();
+    }
+
+    auto Connected() -> bool override { return sock_state; }
+
+    auto Send(const char *buf, int size) -> bool override {
+        int sent = 0;
+        while (sent < size) {
+            auto len = write_portable(sock, &buf[sent], size - sent);
+            if (len <= 0)
+                return false;
+            sent += len;
+        }
+        return true;
+    }
+
+    auto Receive(char *buf, int max) -> int override {
+        // either int or ssize_t depending on the platform, so we have to
+        // use a bunch of auto
+        auto receive_length = 0;
+        auto end_length = 4;
+
+        // what we read too much last time comes first
+        if (!leftover.empty()) {
+            receive_length = std::min<int>(leftover.size(), max);
+            memcpy(buf, leftover.data(), receive_length);
+            leftover.erase(leftover.begin(),
+                           leftover.begin() + receive_length);
+        }
+
+        // while we haven't received the entire packet, maybe due to
+        // socket datagram splittage, we continue to read
+        while (true) {
+            // if we got at least the final size then update
+            if (end_length == 4 && receive_length >= 4) {
+                memcpy(&end_length, buf, 4);
+                if (end_length > MAX_IPC_SIZE || end_length > max ||
+                    end_length < 5)
+                    return 0;
+            }
+            if (receive_length >= end_length)
+                break;
+
+            auto tmp_length = read_portable(sock, &buf[receive_length],
+                                            max - receive_length);
+            // we close the connection if an error happens
+            if (tmp_length <= 0)
+                return 0;
+
+            receive_length += tmp_length;
+        }
+
+        // the beginning of the next replies, if any
+        if (receive_length > end_length) {
+            leftover.insert(leftover.begin(), &buf[end_length],
+                            &buf[receive_length]);
+            receive_length = end_length;
+        }
+        return receive_length;
     }
 
+#if !defined(_WIN32) || defined(DOXYGEN)
     /**
-     * Converts a char* to an uint in little endian.
-     * @param arr The array to convert.
-     * @param i When to load it from the array.
-     * @return The converted value.
+     * Receives an entire IPC reply if it has arrived, without waiting. @n
+     * Partial replies are kept along with the leftover bytes, so Receive
+     * picks up where we stopped. We never read past the reply, as the next
+     * one might be a blocking command's.
+     * @see Transport::TryReceive
      */
-    template <typename T>
-    static auto FromArray(char *arr, int i) -> T {
-        return *(T *)(arr + i);
+    auto TryReceive(char *buf, int max) -> int override {
+        auto end_length = 4;
+        while (true) {
+            if (leftover.size() >= 4) {
+                memcpy(&end_length, leftover.data(), 4);
+                if (end_length > MAX_IPC_SIZE || end_length > max ||
+                    end_length < 5)
+                    return -1;
+            }
+            int have = leftover.size();
+            if (have >= end_length)
+                break;
+            leftover.resize(end_length);
+            auto len = recv(sock, &leftover[have], end_length - have,
+                            MSG_DONTWAIT);
+            leftover.resize(have + std::max<int>(len, 0));
+            if (len == 0)
+                return -1;
+            if (len < 0)
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        memcpy(buf, leftover.data(), end_length);
+        leftover.erase(leftover.begin(), leftover.begin() + end_length);
+        return end_length;
+    }
+
+    auto Descriptor() -> int override { return sock_state ? sock : -1; }
+#endif
+
+    auto Buffered() -> bool override {
+        if (leftover.size() < 4)
+            return false;
+        uint32_t end_length;
+        memcpy(&end_length, leftover.data(), 4);
+        return leftover.size() >= end_length;
     }
 
     /**
-     * Ensures a batch IPC message isn't too big.
-     * @param command_size Additional size required for the message.
-     * @param reply_size Additional size required for the reply.
+     * SocketTransport Destructor.
      */
-    auto BatchSafetyChecks(int command_size, int reply_size = 0) -> bool {
-        // we do not really care about wasting cycles when building batch
-        // packets, so let's just do sanity checks for the sake of it.
-        // TODO: go back when clang has implemented C++20 [[unlikely]]
-        return ((batch_len + command_size) >= MAX_IPC_SIZE ||
-                (reply_len + reply_size) >= MAX_IPC_RETURN_SIZE ||
-                arg_cnt + 1 >= MAX_BATCH_REPLY_COUNT);
-    }
+    virtual ~SocketTransport() { Close(); }
+};
 
+/**
+ * TCP transport. @n
+ * Connects to localhost, using the slot as the TCP port. Nagle's algorithm is
+ * disabled as we always send full messages and wait for their reply. @n
+ * Default transport on Windows.
+ */
+class TCPSocket : public SocketTransport {
+  protected:
     /**
-     * Initializes the socket IPC connection with the server. @n
-     * @see sock
-     * @see sock_state
+     * TCP port of the server.
      */
-    auto InitSocket() -> void {
-#ifdef _WIN32
+    uint16_t port;
+
+  public:
+    auto Connect() -> bool override {
         struct sockaddr_in server;
 
         sock = socket(AF_INET, SOCK_STREAM, 0);
+        int nodelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&nodelay,
+                   sizeof(nodelay));
 
         // Prepare the sockaddr_in structure
         server.sin_family = AF_INET;
         // localhost only
         server.sin_addr.s_addr = inet_addr("127.0.0.1");
-        server.sin_port = htons(slot);
+        server.sin_port = htons(port);
 
-        if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
-            close_portable(sock);
-            sock_state = false;
-            return;
-        }
+        return ConnectTo((struct sockaddr *)&server, sizeof(server));
+    }
 
-#else
+    /**
+     * TCPSocket Initializer.
+     * @param port TCP port of the server.
+     */
+    TCPSocket(uint16_t port) : port(port) {}
+};
+
+#if !defined(_WIN32) || defined(DOXYGEN)
+/**
+ * Unix socket transport. @n
+ * Uses a unix socket of type SOCK_STREAM. @n
+ * Default transport on everything except Windows.
+ */
+class UnixSocket : public SocketTransport {
+  protected:
+    /**
+     * Path of the unix socket.
+     */
+    std::string path;
+
+    /**
+     * Type of the unix socket.
+     */
+    int type = SOCK_STREAM;
+
+  public:
+    auto Connect() -> bool override {
         struct sockaddr_un server;
 
-        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        sock = socket(AF_UNIX, type, 0);
         server.sun_family = AF_UNIX;
-        strcpy(server.sun_path, SOCKET_NAME.c_str());
+        strcpy(server.sun_path, path.c_str());
 
-        if (connect(sock, (struct sockaddr *)&server,
-                    sizeof(struct sockaddr_un)) < 0) {
-            close_portable(sock);
-            sock_state = false;
-            return;
-        }
-#endif
-        sock_state = true;
+        return ConnectTo((struct sockaddr *)&server,
+                         sizeof(struct sockaddr_un));
     }
 
-  public:
     /**
-     * IPC Command messages opcodes. @n
-     * A list of possible operations possible by the IPC. @n
-     * Each one of them is what we call an "opcode" and is the first
-     * byte sent by the IPC to differentiate between commands.
+     * UnixSocket Initializer.
+     * @param path Path of the unix socket.
      */
-    enum IPCCommand : unsigned char {
-        MsgRead8 = 0,           /**< Read 8 bit value to memory. */
-        MsgRead16 = 1,          /**< Read 16 bit value to memory. */
-        MsgRead32 = 2,          /**< Read 32 bit value to memory. */
-        MsgRead64 = 3,          /**< Read 64 bit value to memory. */
-        MsgWrite8 = 4,          /**< Write 8 bit value to memory. */
-        MsgWrite16 = 5,         /**< Write 16 bit value to memory. */
-        MsgWrite32 = 6,         /**< Write 32 bit value to memory. */
-        MsgWrite64 = 7,         /**< Write 64 bit value to memory. */
-        MsgVersion = 8,         /**< Returns the emulator version. */
-        MsgSaveState = 9,       /**< Saves a savestate. */
-        MsgLoadState = 0xA,     /**< Loads a savestate. */
-        MsgTitle = 0xB,         /**< Returns the game title. */
-        MsgID = 0xC,            /**< Returns the game ID. */
-        MsgUUID = 0xD,          /**< Returns the game UUID. */
-        MsgGameVersion = 0xE,   /**< Returns the game verion. */
-        MsgStatus = 0xF,        /**< Returns the emulator status. */
-        MsgUnimplemented = 0xFF /**< Unimplemented IPC message. */
-    };
+    UnixSocket(const std::string path) : path(path) {}
+};
+
+/**
+ * Unix sequenced packet transport. @n
+ * Uses a unix socket of type SOCK_SEQPACKET, which preserves message
+ * boundaries: a message is sent in one call and its reply read in one call,
+ * without any framing loop. The socket buffers are enlarged to fit the
+ * biggest messages of the protocol, which might need a raised
+ * net.core.wmem_max on some systems.
+ */
+class SeqPacketSocket : public UnixSocket {
+  public:
+    auto Connect() -> bool override {
+        if (!UnixSocket::Connect())
+            return false;
+        int size = MAX_IPC_SIZE * 2;
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        return true;
+    }
+
+    auto Send(const char *buf, int size) -> bool override {
+        return write_portable(sock, buf, size) == size;
+    }
+
+    auto Receive(char *buf, int max) -> int override {
+        auto receive_length = read_portable(sock, buf, max);
+        if (receive_length < 5)
+            return 0;
+        return receive_length;
+    }
+
+    auto TryReceive(char *buf, int max) -> int override {
+        auto receive_length = recv(sock, buf, max, MSG_DONTWAIT);
+        if (receive_length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (receive_length < 5)
+            return -1;
+        return receive_length;
+    }
 
     /**
-     * Emulator status enum. @n
-     * A list of possible emulator statuses. @n
+     * SeqPacketSocket Initializer.
+     * @param path Path of the unix socket.
      */
-    enum EmuStatus : uint32_t {
-        Running = 0,  /**< Game is running */
-        Paused = 1,   /**< Game is paused */
-        Shutdown = 2, /**< Game is shutdown */
+    SeqPacketSocket(const std::string path) : UnixSocket(path) {
+        type = SOCK_SEQPACKET;
+    }
+};
+#endif
+
+#if defined(__linux__) || defined(DOXYGEN)
+/**
+ * Ring buffer living in shared memory. @n
+ * A single producer, single consumer queue of IPC messages, used by both the
+ * client and the server side of the shared memory transport. Messages are
+ * always stored contiguously, so they can be read and written in place. @n
+ * Waiting for the other side first spins, then sleeps on a futex, checking
+ * every SHM_WAIT_TIMEOUT that the peer socket is still alive.
+ * @see SharedMemory
+ */
+class SharedMemoryRing {
+  public:
+    /**
+     * Control block of a ring. @n
+     * Positions only ever grow, wrapping around at 2^32, and are masked with
+     * SHM_RING_SIZE to get an offset in the ring.
+     */
+    struct Control {
+        alignas(64) std::atomic<uint32_t> head; /**< Write position. */
+        std::atomic<uint32_t> head_waiters; /**< Threads waiting on head. */
+        alignas(64) std::atomic<uint32_t> tail; /**< Read position. */
+        std::atomic<uint32_t> tail_waiters; /**< Threads waiting on tail. */
+    };
+
+    /**
+     * Control block at the beginning of the shared memory.
+     */
+    struct Header {
+        Control rings[2]; /**< Requests, then replies. */
+        alignas(64) std::atomic<uint32_t> closed; /**< Set by the side
+                                                     closing the connection. */
     };
 
   protected:
     /**
-     * Internal function for savestate IPC messages. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX YY @n
-     * Legend: XX = IPC Tag, YY = Slot.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param slot The savestate slot to use.
-     * @param T Flag to enable batch processing or not.
-     * @param Y IPCCommand to use.
-     * @return If in batch mode the IPC message otherwise void.
+     * Shared memory control block.
      */
-    template <IPCCommand Y, bool T = false>
-    auto EmuState(uint8_t slot) {
-        // easiest way to get tag into a constexpr is a lambda, necessary for
-        // GetReply
-        // batch mode
-        if constexpr (T) {
-            if (BatchSafetyChecks(2)) {
-                SetError(OutOfMemory);
-                return (char *)0;
-            }
-            char *cmd = &ipc_buffer[batch_len];
-            cmd[0] = Y;
-            cmd[1] = slot;
-            batch_len += 2;
-            arg_cnt += 1;
-            return cmd;
-        } else {
-            // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            ToArray(ipc_buffer, 4 + 2, 0);
-            ipc_buffer[4] = Y;
-            ipc_buffer[5] = slot;
-            SendCommand(IPCBuffer{ 4 + 1 + 1, ipc_buffer },
-                        IPCBuffer{ 4 + 1, ret_buffer });
-            return;
-        }
-    }
+    Header *header = nullptr;
 
     /**
-     * Internal function for IPC messages returning strings. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX @n
-     * Legend: XX = IPC Tag.
-     * Return: ZZ * 256
-     * Legend: ZZ = text.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param T Flag to enable batch processing or not.
-     * @param Y IPCCommand to use.
-     * @return If in batch mode the IPC message otherwise void.
+     * Control block of this ring.
      */
-    template <IPCCommand Y, bool T = false>
-    auto StringCommands() {
-        // batch mode
-        if constexpr (T) {
-            // reply is automatically set to max because of reloc, so let's not
-            // check that
-            if (BatchSafetyChecks(1, 4)) {
-                SetError(OutOfMemory);
-                return (char *)0;
-            }
-            char *cmd = &ipc_buffer[batch_len];
-            cmd[0] = Y;
-            batch_len += 1;
-            // MSB is used as a flag to warn pine that the reply is a VLE!
-            batch_arg_place[arg_cnt] = (reply_len | 0x80000000);
-            reply_len += 4;
-            needs_reloc = true;
-            arg_cnt += 1;
-            return cmd;
-        } else {
-            // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            ToArray(ipc_buffer, 4 + 1, 0);
-            ipc_buffer[4] = Y;
-            SendCommand(IPCBuffer{ 4 + 1, ipc_buffer },
-                        IPCBuffer{ MAX_IPC_RETURN_SIZE, ret_buffer });
-            return GetReply<Y>(ret_buffer, 5);
-        }
-    }
+    Control *ctl = nullptr;
 
-  public:
     /**
-     * IPC message buffer. @n
-     * A list of all needed fields to store an IPC message.
+     * Data of this ring.
      */
-    struct IPCBuffer {
-        int size;     /**< Size of the buffer. */
-        char *buffer; /**< Buffer. */
-        // do NOT specify a destructor to free buffer as we reuse the same
-        // buffer to avoid the cost of mallocs; We specify destructors upon need
-        // on structures that makes a copy of this, eg BatchCommand.
-    };
+    char *data = nullptr;
 
     /**
-     * IPC batch message fields. @n
-     * A list of all needed fields to send a batch IPC message command and
-     * retrieve their result.
+     * Socket the shared memory was negotiated on, hung up when the peer
+     * dies.
      */
-    struct BatchCommand {
-        IPCBuffer ipc_message;          /**< IPC message fields. */
-        IPCBuffer ipc_return;           /**< IPC return fields. */
-        unsigned int *return_locations; /**< Location of arguments in IPC return
-                                           fields. */
-        unsigned int msg_size;          /**< Number of IPC messages. */
-        bool reloc; /**< Whether the message needs relocation. */
+    int peer = -1;
 
-        // C bindings handle manually the freeing of such resources.
-#ifndef C_FFI
-        /**
-         * BatchCommand Destructor.
-         */
-        ~BatchCommand() {
-            delete[] ipc_message.buffer;
-            delete[] ipc_return.buffer;
-            delete[] return_locations;
-        }
-#endif
-    };
+    /**
+     * Bytes reserved or peeked but not yet committed or released.
+     */
+    uint32_t pending = 0;
 
     /**
-     * Result code of the IPC operation. @n
-     * A list of result codes that should be returned, or thrown, depending
-     * on the state of the result of an IPC command.
+     * Messages are aligned to 8 bytes, so a wrap marker always fits at the
+     * end of the ring.
      */
-    enum IPCStatus : unsigned int {
-        Success = 0,       /**< IPC command successfully completed. */
-        Fail = 1,          /**< IPC command failed to execute. */
-        OutOfMemory = 2,   /**< IPC command too big to send. */
-        NoConnection = 3,  /**< Cannot connect to the IPC socket. */
-        Unimplemented = 4, /**< Unimplemented IPC command. */
-        Unknown = 5        /**< Unknown status. */
-    };
+    static auto Align(uint32_t size) -> uint32_t { return (size + 7) & ~7u; }
 
-  protected:
     /**
-     * Formats an IPC buffer. @n
-     * Creates a new buffer with IPC opcode set and first address argument
-     * currently used for memory IPC commands.
-     * @param size The size of the array to allocate.
-     * @param address The address to put as an argument of the IPC command.
-     * @param command The IPC message tag(opcode).
-     * @param T false to make a full packet or true for a part of one, used for
-     * batch commands.
-     * @see IPCCommand
-     * @return The IPC buffer.
+     * Checks the peer did not close the connection.
      */
-    template <bool T = false>
-    auto FormatBeginning(char *cmd, uint32_t address, IPCCommand command,
-                         uint32_t size = 0) -> char * {
-        if constexpr (T) {
-            cmd[0] = (unsigned char)command;
-            return ToArray(cmd, address, 1);
-        } else {
-            ToArray(cmd, size, 0);
-            cmd[4] = (unsigned char)command;
-            return ToArray(cmd, address, 5);
-        }
+    auto Alive() -> bool {
+        if (header->closed.load())
+            return false;
+        struct pollfd pfd = { peer, POLLRDHUP, 0 };
+        return poll(&pfd, 1, 0) == 0;
     }
 
-#if defined(C_FFI) || defined(DOXYGEN)
     /**
-     * Error number. @n
-     * Result code of the last executed function. @n
-     * Used instead of exceptions on the C library bindings.
+     * Waits for a position to move.
+     * @param word The position.
+     * @param old The value it had.
+     * @param waiters Waiters count of the position.
+     * @return false if the peer went away in the meantime.
      */
-    IPCStatus ipc_errno = Success;
+    auto Wait(std::atomic<uint32_t> &word, uint32_t old,
+              std::atomic<uint32_t> &waiters) -> bool {
+        // spinning on a single core only delays the peer we are waiting for
+        static const int spins =
+            (std::thread::hardware_concurrency() > 1) ? SHM_SPIN_COUNT : 0;
+        for (int i = 0; i < spins; i++) {
+            if (word.load(std::memory_order_acquire) != old)
+                return true;
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
 #endif
+        }
+        waiters.fetch_add(1);
+        while (word.load() == old && Alive()) {
+            struct timespec timeout = { 0, SHM_WAIT_TIMEOUT };
+            syscall(SYS_futex, &word, FUTEX_WAIT, old, &timeout, nullptr, 0);
+        }
+        waiters.fetch_sub(1);
+        return word.load(std::memory_order_acquire) != old;
+    }
 
     /**
-     * Sets the error code for the last operation. @n
-     * On C++, throws an exception, on C, sets the error code. @n
-     * @param err The error to set.
+     * Wakes up the threads waiting on a position, if any.
      */
-    auto SetError(IPCStatus err) -> void {
-#ifdef C_FFI
-        ipc_errno = err;
-#else
-        throw err;
-#endif
+    static auto Wake(std::atomic<uint32_t> &word,
+                     std::atomic<uint32_t> &waiters) -> void {
+        if (waiters.load() != 0)
+            syscall(SYS_futex, &word, FUTEX_WAKE, INT_MAX, nullptr, nullptr,
+                    0);
     }
 
   public:
-#if defined(C_FFI) || defined(DOXYGEN)
     /**
-     * Gets the last error code set. @n
-     * Only for C bindings.
+     * Reserves contiguous space for a message, waiting for room if need be.
+     * @param size Size of the message.
+     * @return Where to write the message, nullptr if the peer went away.
      */
-    auto GetError() -> IPCStatus {
-        IPCStatus copy = ipc_errno;
-        ipc_errno = Success;
-        return copy;
+    auto Reserve(uint32_t size) -> char * {
+        uint32_t head = ctl->head.load(std::memory_order_relaxed);
+        uint32_t pos = head & (SHM_RING_SIZE - 1);
+        uint32_t to_end = SHM_RING_SIZE - pos;
+        uint32_t skip = (to_end < Align(size)) ? to_end : 0;
+        while (true) {
+            uint32_t tail = ctl->tail.load(std::memory_order_acquire);
+            if (SHM_RING_SIZE - (head - tail) >= skip + Align(size))
+                break;
+            if (!Wait(ctl->tail, tail, ctl->tail_waiters))
+                return nullptr;
+        }
+        // a null size tells the consumer to continue at the beginning
+        if (skip) {
+            memset(&data[pos], 0, 4);
+            pos = 0;
+        }
+        pending = skip;
+        return &data[pos];
     }
-#endif
 
     /**
-     * Returns the reply of an IPC command. @n
-     * Throws an IPCStatus if there is no reply to read.
-     * @param cmd A char array containing the IPC return buffer OR a
-     * BatchCommand.
-     * @param place An integer specifying where the argument is
-     * in the buffer OR which function to read the reply of in
-     * the case of a BatchCommand.
-     * @return The reply, variable type. Refer to the documentation of the
-     * standard function. Ownership of datastreams is also passed down to you,
-     * so don't forget to read carefully the documentation and see if you need
-     * to free anything!
-     * @see IPCResult
-     * @see IPCBuffer
+     * Publishes the message written in the space last reserved.
+     * @param size Actual size of the message.
      */
-    template <IPCCommand T, typename Y>
-    auto GetReply(const Y &cmd, int place) {
-        [[maybe_unused]] char *buf;
-        [[maybe_unused]] int loc;
-        if constexpr (std::is_same<Y, BatchCommand>::value) {
-            buf = cmd.ipc_return.buffer;
-            loc = cmd.return_locations[place];
-        } else {
-            buf = cmd;
-            loc = place;
+    auto Commit(uint32_t size) -> void {
+        ctl->head.fetch_add(pending + Align(size));
+        pending = 0;
+        Wake(ctl->head, ctl->head_waiters);
+    }
+
+    /**
+     * Waits for the next message. @n
+     * The message stays in the ring until released.
+     * @return The message, nullptr if the peer went away or sent garbage.
+     */
+    auto Peek() -> char * {
+        uint32_t tail = ctl->tail.load(std::memory_order_relaxed);
+        while (ctl->head.load(std::memory_order_acquire) == tail) {
+            if (!Wait(ctl->head, tail, ctl->head_waiters))
+                return nullptr;
         }
-        if constexpr (T == MsgRead8)
-            return FromArray<uint8_t>(buf, loc);
-        else if constexpr (T == MsgRead16)
-            return FromArray<uint16_t>(buf, loc);
-        else if constexpr (T == MsgRead32)
-            return FromArray<uint32_t>(buf, loc);
-        else if constexpr (T == MsgRead64)
-            return FromArray<uint64_t>(buf, loc);
-        else if constexpr (T == MsgStatus)
-            return FromArray<EmuStatus>(buf, loc);
-        else if constexpr (T == MsgVersion || T == MsgID || T == MsgTitle ||
-                           T == MsgUUID || T == MsgGameVersion) {
-            uint32_t size = FromArray<uint32_t>(buf, loc);
-            char *datastream = new char[size];
-            memcpy(datastream, &buf[loc + 4], size);
-            return datastream;
-        } else {
-            SetError(Unimplemented);
-            return;
+        uint32_t pos = tail & (SHM_RING_SIZE - 1);
+        uint32_t size;
+        memcpy(&size, &data[pos], 4);
+        pending = 0;
+        if (size == 0) {
+            pending = SHM_RING_SIZE - pos;
+            pos = 0;
+            memcpy(&size, data, 4);
         }
+        if (size < 5 || size > MAX_IPC_SIZE)
+            return nullptr;
+        pending += Align(size);
+        return &data[pos];
     }
 
     /**
-     * Sends an IPC command to the emulator. @n
-     * Fails if the IPC cannot be sent or if the emulator returns IPC_FAIL.
-     * Throws an IPCStatus on failure.
-     * @param cmd An IPCBuffer containing the IPC command size and buffer OR a
-     * BatchCommand.
-     * @param rt An IPCBuffer containing the IPC return size and buffer.
-     * @see IPCResult
-     * @see IPCBuffer
+     * Frees the message last peeked.
      */
-    template <typename T>
-    auto SendCommand(const T &cmd, const T &rt = T()) -> void {
-        IPCBuffer command;
-        IPCBuffer ret;
+    auto Release() -> void {
+        ctl->tail.fetch_add(pending);
+        pending = 0;
+        Wake(ctl->tail, ctl->tail_waiters);
+    }
 
-        if constexpr (std::is_same<T, BatchCommand>::value) {
-            command = cmd.ipc_message;
-            ret = cmd.ipc_return;
-        } else {
-            command = cmd;
-            ret = rt;
+    /**
+     * Marks the shared memory as closed and wakes up the peer.
+     */
+    auto Close() -> void {
+        header->closed.store(1);
+        for (auto &ring : header->rings) {
+            syscall(SYS_futex, &ring.head, FUTEX_WAKE, INT_MAX, nullptr,
+                    nullptr, 0);
+            syscall(SYS_futex, &ring.tail, FUTEX_WAKE, INT_MAX, nullptr,
+                    nullptr, 0);
         }
+    }
 
-        if (!sock_state) {
-            InitSocket();
-        }
+    /**
+     * SharedMemoryRing Initializer.
+     * @param shm The shared memory, SHM_SIZE bytes.
+     * @param ring 0 for the requests ring, 1 for the replies one.
+     * @param peer Socket the shared memory was negotiated on.
+     */
+    SharedMemoryRing(char *shm, int ring, int peer)
+        : header((Header *)shm), ctl(&header->rings[ring]),
+          data(shm + SHM_HEADER_SIZE + ring * SHM_RING_SIZE), peer(peer) {}
 
-        if (write_portable(sock, command.buffer, command.size) < 0) {
-            // if our write failed, assume the socket connection cannot be
-            // established
-            close_portable(sock);
-            sock_state = false;
-            SetError(NoConnection);
-            return;
-        }
+    SharedMemoryRing() {}
+};
 
-#ifdef DEBUG
-        printf("packet sent:\n");
-        hexdump(command.buffer, command.size);
-#endif
+/**
+ * Shared memory transport. @n
+ * Connects to the unix socket, then hands over to the server a memfd holding
+ * a request and a reply ring buffer through the MsgSharedMemory opcode. From
+ * then on messages and replies go through the rings without any syscall
+ * while both sides are busy, and replies are decoded in place. @n
+ * Falls back to the unix socket if the server does not support it.
+ * @see SharedMemoryRing
+ */
+class SharedMemory : public UnixSocket {
+  protected:
+    /**
+     * Opcode negotiating the shared memory. @n
+     * @see Shared::MsgSharedMemory
+     */
+    static constexpr unsigned char opcode = 0xF0;
 
-        // either int or ssize_t depending on the platform, so we have to
-        // use a bunch of auto
-        auto receive_length = 0;
-        auto end_length = 4;
+    /**
+     * Mapping of the shared memory, nullptr if not negotiated.
+     */
+    char *shm = nullptr;
 
-        // while we haven't received the entire packet, maybe due to
-        // socket datagram splittage, we continue to read
-        while (receive_length < end_length) {
-            auto tmp_length =
-                read_portable(sock, &ret.buffer[receive_length],
-                              MAX_IPC_RETURN_SIZE - receive_length);
-            // we close the connection if an error happens
-            if (tmp_length <= 0) {
-                receive_length = 0;
+    /**
+     * Ring buffer of the messages.
+     */
+    SharedMemoryRing requests;
+
+    /**
+     * Ring buffer of the replies.
+     */
+    SharedMemoryRing replies;
+
+    /**
+     * Whether a reply handed over in place still has to be released.
+     */
+    bool reply_held = false;
+
+    /**
+     * Releases the last reply handed over in place.
+     */
+    auto ReleaseReply() -> void {
+        if (reply_held)
+            replies.Release();
+        reply_held = false;
+    }
+
+    /**
+     * Creates the shared memory and hands it over to the server.
+     * @return false if the server refused it.
+     */
+    auto Negotiate() -> bool {
+        int fd = memfd_create("pine", MFD_CLOEXEC);
+        if (fd < 0)
+            return false;
+        void *mem = MAP_FAILED;
+        if (ftruncate(fd, SHM_SIZE) == 0)
+            mem = mmap(nullptr, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+        if (mem == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        shm = (char *)mem;
+        new (shm) SharedMemoryRing::Header();
+
+        char msg[5] = { 5, 0, 0, 0, (char)opcode };
+        struct iovec iov = { msg, sizeof(msg) };
+        char control[CMSG_SPACE(sizeof(int))] = {};
+        struct msghdr hdr = {};
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+        char reply[16];
+        int len = 0;
+        if (sendmsg(sock, &hdr, MSG_NOSIGNAL) == sizeof(msg))
+            len = SocketTransport::Receive(reply, sizeof(reply));
+        // the server has its own reference to it by now
+        close(fd);
+        if (len != 5 || reply[4] != 0) {
+            munmap(shm, SHM_SIZE);
+            shm = nullptr;
+            // a server answering IPC_FAIL can still be talked to over the
+            // socket, anything else leaves it in an unknown state
+            if (len != 5)
+                SocketTransport::Close();
+            return false;
+        }
+        requests = SharedMemoryRing(shm, 0, sock);
+        replies = SharedMemoryRing(shm, 1, sock);
+        return true;
+    }
+
+  public:
+    auto Connect() -> bool override {
+        if (!UnixSocket::Connect())
+            return false;
+        Negotiate();
+        return sock_state;
+    }
+
+    auto Close() -> void override {
+        if (shm) {
+            requests.Close();
+            munmap(shm, SHM_SIZE);
+            shm = nullptr;
+        }
+        reply_held = false;
+        UnixSocket::Close();
+    }
+
+    auto Send(const char *buf, int size) -> bool override {
+        if (!shm)
+            return UnixSocket::Send(buf, size);
+        ReleaseReply();
+        char *msg = requests.Reserve(size);
+        if (!msg)
+            return false;
+        memcpy(msg, buf, size);
+        requests.Commit(size);
+        return true;
+    }
+
+    auto ReceiveInPlace(char *buf, int max, int &size) -> char * override {
+        if (!shm)
+            return UnixSocket::ReceiveInPlace(buf, max, size);
+        ReleaseReply();
+        char *reply = replies.Peek();
+        if (!reply) {
+            size = 0;
+            return buf;
+        }
+        memcpy(&size, reply, 4);
+        reply_held = true;
+        return reply;
+    }
+
+    auto Receive(char *buf, int max) -> int override {
+        int size;
+        char *reply = ReceiveInPlace(buf, max, size);
+        if (reply != buf) {
+            if (size > max)
+                size = 0;
+            else
+                memcpy(buf, reply, size);
+            ReleaseReply();
+        }
+        return size;
+    }
+
+    auto TryReceive(char *buf, int max) -> int override {
+        if (!shm)
+            return UnixSocket::TryReceive(buf, max);
+        return Transport::TryReceive(buf, max);
+    }
+
+    /**
+     * The rings do not wake up any descriptor, so only the socket fallback
+     * can be waited on.
+     * @see Transport::Descriptor
+     */
+    auto Descriptor() -> int override {
+        return shm ? -1 : UnixSocket::Descriptor();
+    }
+
+    /**
+     * SharedMemory Initializer.
+     * @param path Path of the unix socket.
+     */
+    SharedMemory(const std::string path) : UnixSocket(path) {}
+
+    /**
+     * SharedMemory Destructor.
+     */
+    virtual ~SharedMemory() { Close(); }
+};
+
+/**
+ * Minimal io_uring instance. @n
+ * Just enough of it to submit a few reads and writes and wait for their
+ * completion in a single io_uring_enter, without depending on liburing.
+ * @see UringSocket
+ */
+class IoUring {
+  protected:
+    /**
+     * The io_uring file descriptor, -1 if not set up.
+     */
+    int fd = -1;
+
+    /**
+     * Parameters of the io_uring, filled in by the kernel.
+     */
+    struct io_uring_params params = {};
+
+    /**
+     * Mapping of the submission and completion rings.
+     */
+    char *rings = (char *)MAP_FAILED;
+
+    /**
+     * Size of the mapping of the rings.
+     */
+    size_t rings_size = 0;
+
+    /**
+     * Mapping of the submission queue entries.
+     */
+    struct io_uring_sqe *sqes = (struct io_uring_sqe *)MAP_FAILED;
+
+    /**
+     * Number of entries prepared since the last submission.
+     */
+    unsigned int queued = 0;
+
+    /**
+     * Gets a field of the rings.
+     * @param offset Offset of the field, as given by the kernel.
+     */
+    auto Field(uint32_t offset) -> unsigned int * {
+        return (unsigned int *)(rings + offset);
+    }
+
+  public:
+    /**
+     * Sets up the io_uring. @n
+     * Only supports kernels mapping both rings at once, 5.4 onwards.
+     * @param entries Number of submission queue entries.
+     * @return false if io_uring is not available.
+     */
+    auto Setup(unsigned int entries) -> bool {
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0)
+            return false;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+            Close();
+            return false;
+        }
+        rings_size = std::max(
+            params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+            params.cq_off.cqes +
+                params.cq_entries * sizeof(struct io_uring_cqe));
+        rings = (char *)mmap(nullptr, rings_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        sqes = (struct io_uring_sqe *)mmap(
+            nullptr, params.sq_entries * sizeof(struct io_uring_sqe),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+            IORING_OFF_SQES);
+        if (rings == MAP_FAILED || sqes == MAP_FAILED) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Registers buffers, used by fixed reads and writes.
+     * @param iov The buffers.
+     * @param count Number of buffers.
+     * @return false on error.
+     */
+    auto Register(struct iovec *iov, unsigned int count) -> bool {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                       iov, count) == 0;
+    }
+
+    /**
+     * Prepares a submission queue entry.
+     * @return The entry, zeroed, or nullptr if the queue is full.
+     */
+    auto Prepare() -> struct io_uring_sqe * {
+        unsigned int head =
+            __atomic_load_n(Field(params.sq_off.head), __ATOMIC_ACQUIRE);
+        unsigned int tail = *Field(params.sq_off.tail) + queued;
+        if (tail - head >= params.sq_entries)
+            return nullptr;
+        unsigned int index = tail & *Field(params.sq_off.ring_mask);
+        struct io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        Field(params.sq_off.array)[index] = index;
+        queued += 1;
+        return sqe;
+    }
+
+    /**
+     * Submits the prepared entries and waits for completions.
+     * @param wait Number of completions to wait for.
+     * @return false on error.
+     */
+    auto Submit(unsigned int wait) -> bool {
+        unsigned int *tail = Field(params.sq_off.tail);
+        __atomic_store_n(tail, *tail + queued, __ATOMIC_RELEASE);
+        unsigned int count = queued;
+        queued = 0;
+        while (true) {
+            int ret = syscall(__NR_io_uring_enter, fd, count, wait,
+                              wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (ret >= 0)
+                return true;
+            if (errno != EINTR)
+                return false;
+            // the entries got submitted before being interrupted
+            count = 0;
+        }
+    }
+
+    /**
+     * Pops a completion.
+     * @param cqe Set to the completion.
+     * @return false if there is none.
+     */
+    auto Complete(struct io_uring_cqe &cqe) -> bool {
+        unsigned int *head = Field(params.cq_off.head);
+        unsigned int tail =
+            __atomic_load_n(Field(params.cq_off.tail), __ATOMIC_ACQUIRE);
+        if (*head == tail)
+            return false;
+        struct io_uring_cqe *cqes =
+            (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+        cqe = cqes[*head & *Field(params.cq_off.ring_mask)];
+        __atomic_store_n(head, *head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    /**
+     * Tears down the io_uring.
+     */
+    auto Close() -> void {
+        if (sqes != MAP_FAILED)
+            munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+        if (rings != MAP_FAILED)
+            munmap(rings, rings_size);
+        if (fd >= 0)
+            close(fd);
+        sqes = (struct io_uring_sqe *)MAP_FAILED;
+        rings = (char *)MAP_FAILED;
+        fd = -1;
+    }
+
+    IoUring() {}
+    IoUring(const IoUring &) = delete;
+
+    /**
+     * IoUring Destructor.
+     */
+    ~IoUring() { Close(); }
+};
+
+/**
+ * Unix socket transport driven by io_uring. @n
+ * A round trip submits the write of the message and the read of its reply
+ * as linked entries in a single io_uring_enter, instead of a write followed
+ * by a loop of reads. Both go through buffers registered once, and replies
+ * are decoded in place in the read buffer, which also keeps the replies
+ * read ahead when pipelining. @n
+ * Talks to any unix socket server, falling back to regular syscalls if
+ * io_uring is not available. @n
+ * Each connection has a ring of its own: submitting the requests of several
+ * connections in one io_uring_enter is left out. The pool hands a
+ * connection to one thread at a time, so a shared ring would need a lock
+ * across all of them and to route completions back to their connection,
+ * serializing the very threads it meant to save syscalls for. Many
+ * requests per io_uring_enter come from pipelining on one connection
+ * instead.
+ * @see IoUring
+ */
+class UringSocket : public UnixSocket {
+  protected:
+    /**
+     * The io_uring of the connection.
+     */
+    IoUring ring;
+
+    /**
+     * Whether io_uring is set up, false to use regular syscalls.
+     */
+    bool uring = false;
+
+    /**
+     * Whether the buffers are registered, for fixed reads and writes.
+     */
+    bool fixed = false;
+
+    /**
+     * Buffer of the messages, registered buffer 0.
+     */
+    char *send_buf;
+
+    /**
+     * Buffer of the replies, registered buffer 1. @n
+     * Twice the size of the biggest reply, so there is always room for an
+     * entire one after moving the partial one at its beginning.
+     */
+    char *recv_buf;
+
+    /**
+     * Position of the first reply not consumed in recv_buf.
+     */
+    int recv_start = 0;
+
+    /**
+     * End of the bytes received in recv_buf.
+     */
+    int recv_end = 0;
+
+    /**
+     * Size of the reply handed over in place, consumed on the next call.
+     */
+    int held = 0;
+
+    /**
+     * Consumes the reply handed over in place.
+     */
+    auto ReleaseReply() -> void {
+        recv_start += held;
+        held = 0;
+        if (recv_start == recv_end)
+            recv_start = recv_end = 0;
+    }
+
+    /**
+     * Size of the first reply of recv_buf.
+     * @return The size, 0 if not entirely received or -1 if invalid.
+     */
+    auto Available() -> int {
+        if (recv_end - recv_start < 4)
+            return 0;
+        uint32_t size;
+        memcpy(&size, &recv_buf[recv_start], 4);
+        if (size < 5 || size > MAX_IPC_RETURN_SIZE)
+            return -1;
+        return (recv_end - recv_start >= (int)size) ? size : 0;
+    }
+
+    /**
+     * Prepares a read of whatever fits at the end of recv_buf.
+     * @return false if the submission queue is full.
+     */
+    auto PrepareRead() -> bool {
+        if (recv_end > MAX_IPC_RETURN_SIZE) {
+            memmove(recv_buf, &recv_buf[recv_start], recv_end - recv_start);
+            recv_end -= recv_start;
+            recv_start = 0;
+        }
+        struct io_uring_sqe *sqe = ring.Prepare();
+        if (!sqe)
+            return false;
+        sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = sock;
+        sqe->addr = (uint64_t)&recv_buf[recv_end];
+        sqe->len = 2 * MAX_IPC_RETURN_SIZE - recv_end;
+        sqe->buf_index = 1;
+        sqe->user_data = 1;
+        return true;
+    }
+
+    /**
+     * Prepares the write of a message, copied into send_buf.
+     * @param buf The message.
+     * @param size The size of the message.
+     * @return The entry, nullptr if the submission queue is full.
+     */
+    auto PrepareWrite(const char *buf, int size) -> struct io_uring_sqe * {
+        struct io_uring_sqe *sqe;
+        if (size > MAX_IPC_SIZE || !(sqe = ring.Prepare()))
+            return nullptr;
+        memcpy(send_buf, buf, size);
+        sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = sock;
+        sqe->addr = (uint64_t)send_buf;
+        sqe->len = size;
+        sqe->buf_index = 0;
+        sqe->user_data = 0;
+        return sqe;
+    }
+
+    /**
+     * Submits what is prepared and waits for it.
+     * @param count Number of entries prepared.
+     * @param written Set to the result of the write, if any.
+     * @param read Set to the result of the read, if any.
+     * @return false on error.
+     */
+    auto Wait(unsigned int count, int &written, int &read) -> bool {
+        if (!ring.Submit(count))
+            return false;
+        struct io_uring_cqe cqe;
+        for (unsigned int i = 0; i < count; i++) {
+            if (!ring.Complete(cqe))
+                return false;
+            if (cqe.user_data == 0)
+                written = cqe.res;
+            else
+                read = cqe.res;
+        }
+        return true;
+    }
+
+    /**
+     * Writes what a short write left out, as the kernel does not go on with
+     * it.
+     * @param buf The message.
+     * @param size The size of the message.
+     * @param written The size already written.
+     * @return false on error.
+     */
+    auto WriteRest(const char *buf, int size, int written) -> bool {
+        if (written < 0)
+            return false;
+        return UnixSocket::Send(&buf[written], size - written);
+    }
+
+    /**
+     * Reads until an entire reply is in recv_buf.
+     * @return The size of the reply, or 0 on error.
+     */
+    auto ReadReply() -> int {
+        int size;
+        while ((size = Available()) == 0) {
+            int written = 0, read = 0;
+            if (!PrepareRead() || !Wait(1, written, read) || read <= 0)
+                return 0;
+            recv_end += read;
+        }
+        return std::max(size, 0);
+    }
+
+  public:
+    auto Connect() -> bool override {
+        if (!UnixSocket::Connect())
+            return false;
+        if (!uring && ring.Setup(URING_ENTRIES)) {
+            uring = true;
+            struct iovec iov[2] = { { send_buf, MAX_IPC_SIZE },
+                                    { recv_buf, 2 * MAX_IPC_RETURN_SIZE } };
+            // pinning memory might be restricted by RLIMIT_MEMLOCK
+            fixed = ring.Register(iov, 2);
+        }
+        return true;
+    }
+
+    auto Close() -> void override {
+        recv_start = recv_end = held = 0;
+        UnixSocket::Close();
+    }
+
+    auto Send(const char *buf, int size) -> bool override {
+        if (!uring)
+            return UnixSocket::Send(buf, size);
+        ReleaseReply();
+        int written = -1, read = 0;
+        if (!PrepareWrite(buf, size) || !Wait(1, written, read))
+            return false;
+        return written == size || WriteRest(buf, size, written);
+    }
+
+    auto SendReceive(const char *buf, int size, char *ret, int max,
+                     int &reply_size) -> char * override {
+        if (!uring)
+            return UnixSocket::SendReceive(buf, size, ret, max, reply_size);
+        ReleaseReply();
+        reply_size = -1;
+        // a reply left from pipelining does not need the linked read
+        if (Available() != 0)
+            return Send(buf, size) ? ReceiveInPlace(ret, max, reply_size)
+                                   : ret;
+        struct io_uring_sqe *write = PrepareWrite(buf, size);
+        if (!write || !PrepareRead())
+            return ret;
+        // the read is only started once the write has entirely gone through
+        write->flags |= IOSQE_IO_LINK;
+        int written = -1, read = 0;
+        if (!Wait(2, written, read))
+            return ret;
+        if (written != size) {
+            // a short write cancels the read, which is done on its own
+            if (!WriteRest(buf, size, written))
+                return ret;
+            read = 0;
+        }
+        reply_size = 0;
+        if (read < 0)
+            return ret;
+        recv_end += read;
+        return ReceiveInPlace(ret, max, reply_size);
+    }
+
+    auto ReceiveInPlace(char *buf, int max, int &size) -> char * override {
+        if (!uring)
+            return UnixSocket::ReceiveInPlace(buf, max, size);
+        ReleaseReply();
+        size = ReadReply();
+        if (size > max)
+            size = 0;
+        if (size == 0)
+            return buf;
+        held = size;
+        return &recv_buf[recv_start];
+    }
+
+    auto Receive(char *buf, int max) -> int override {
+        int size;
+        char *reply = ReceiveInPlace(buf, max, size);
+        if (reply != buf) {
+            memcpy(buf, reply, size);
+            ReleaseReply();
+        }
+        return size;
+    }
+
+    auto TryReceive(char *buf, int max) -> int override {
+        if (!uring)
+            return UnixSocket::TryReceive(buf, max);
+        ReleaseReply();
+        if (Available() == 0) {
+            if (recv_end > MAX_IPC_RETURN_SIZE) {
+                memmove(recv_buf, &recv_buf[recv_start],
+                        recv_end - recv_start);
+                recv_end -= recv_start;
+                recv_start = 0;
+            }
+            auto len = recv(sock, &recv_buf[recv_end],
+                            2 * MAX_IPC_RETURN_SIZE - recv_end, MSG_DONTWAIT);
+            if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            if (len <= 0)
+                return -1;
+            recv_end += len;
+        }
+        int size = Available();
+        if (size <= 0 || size > max)
+            return size < 0 || size > max ? -1 : 0;
+        memcpy(buf, &recv_buf[recv_start], size);
+        recv_start += size;
+        ReleaseReply();
+        return size;
+    }
+
+    auto Buffered() -> bool override {
+        if (!uring)
+            return UnixSocket::Buffered();
+        ReleaseReply();
+        return Available() != 0;
+    }
+
+    /**
+     * UringSocket Initializer.
+     * @param path Path of the unix socket.
+     */
+    UringSocket(const std::string path)
+        : UnixSocket(path), send_buf(new char[MAX_IPC_SIZE]),
+          recv_buf(new char[2 * MAX_IPC_RETURN_SIZE]) {}
+
+    UringSocket(const UringSocket &) = delete;
+
+    /**
+     * UringSocket Destructor.
+     */
+    virtual ~UringSocket() {
+        Close();
+        // the kernel unpins the buffers along with the io_uring
+        ring.Close();
+        delete[] send_buf;
+        delete[] recv_buf;
+    }
+};
+#endif
+
+/**
+ * In-process loopback transport. @n
+ * Hands over messages to a function living in the same process instead of
+ * going through the kernel, eg the stand-in server of src/server.h. Mostly
+ * useful for tests and to measure the cost of the API without any IPC.
+ */
+class Loopback : public Transport {
+  public:
+    /**
+     * Message handler. @n
+     * Executes a full IPC message and writes its reply, returning the size of
+     * the reply.
+     */
+    using Handler = std::function<uint32_t(const char *, char *)>;
+
+  protected:
+    /**
+     * Function executing the messages.
+     */
+    Handler handler;
+
+    /**
+     * Messages sent but whose reply has not been received yet.
+     */
+    std::vector<char> pending;
+
+    /**
+     * Position of the next message to execute in pending.
+     */
+    size_t pending_pos = 0;
+
+    /**
+     * Where the handler writes replies, MAX_IPC_RETURN_SIZE bytes once
+     * something got received.
+     */
+    std::vector<char> reply;
+
+  public:
+    auto Connect() -> bool override { return true; }
+
+    auto Close() -> void override {
+        pending.clear();
+        pending_pos = 0;
+    }
+
+    auto Connected() -> bool override { return true; }
+
+    auto Send(const char *buf, int size) -> bool override {
+        pending.insert(pending.end(), buf, buf + size);
+        return true;
+    }
+
+    /**
+     * Receives an entire IPC reply. @n
+     * Replies bigger than buf fail the receive, closing the loopback like
+     * the other transports lose their connection.
+     * @see Transport::Receive
+     */
+    auto Receive(char *buf, int max) -> int override {
+        if (pending_pos >= pending.size())
+            return 0;
+        reply.resize(MAX_IPC_RETURN_SIZE);
+        uint32_t size;
+        memcpy(&size, &pending[pending_pos], 4);
+        int len = handler(&pending[pending_pos], reply.data());
+        pending_pos += size;
+        if (len > max) {
+            Close();
+            return 0;
+        }
+        memcpy(buf, reply.data(), len);
+        if (pending_pos >= pending.size())
+            Close();
+        return len;
+    }
+
+    /**
+     * Loopback Initializer.
+     * @param handler Function executing the messages.
+     */
+    Loopback(Handler handler) : handler(handler) {}
+};
+
+#if defined(__linux__) || defined(DOXYGEN)
+/**
+ * Event loop driving asynchronous IPC commands. @n
+ * A single thread waits on the transports of any number of IPC sessions
+ * through epoll and collects their replies as they arrive, so you do not
+ * need a blocked thread per emulator. Descriptors are armed one shot: the
+ * reactor only gets told about them when they have replies it has to
+ * collect. @n
+ * Linux only.
+ * @see Shared::ReadAsync
+ */
+class Reactor {
+  public:
+    /**
+     * Gets notified when its descriptor is readable.
+     */
+    class Handler {
+      public:
+        /**
+         * Called on the reactor thread when the descriptor is readable. The
+         * descriptor has to be armed again to get notified once more.
+         */
+        virtual auto OnReadable() -> void = 0;
+
+        /**
+         * Handler Destructor.
+         */
+        virtual ~Handler() {}
+    };
+
+  protected:
+    /**
+     * The epoll instance.
+     */
+    int epoll_fd;
+
+    /**
+     * Eventfd waking up the reactor thread when it has to stop.
+     */
+    int wake_fd;
+
+    /**
+     * Whether the reactor thread has to keep running.
+     */
+    std::atomic<bool> running;
+
+    /**
+     * Held by the reactor thread while it notifies handlers.
+     */
+    std::mutex dispatching;
+
+    /**
+     * Handlers forgotten since the reactor thread last waited, which might
+     * still have events pending.
+     */
+    std::vector<Handler *> removed;
+
+    /**
+     * Protects removed.
+     */
+    std::mutex removed_blocking;
+
+    /**
+     * The reactor thread.
+     */
+    std::thread thread;
+
+    /**
+     * Body of the reactor thread.
+     */
+    auto Run() -> void {
+        struct epoll_event events[64];
+        while (running) {
+            int n = epoll_wait(epoll_fd, events, 64, -1);
+            std::lock_guard<std::mutex> lock(dispatching);
+            for (int i = 0; i < n; i++) {
+                Handler *h = (Handler *)events[i].data.ptr;
+                if (!h)
+                    continue;
+                {
+                    std::lock_guard<std::mutex> rlock(removed_blocking);
+                    if (std::find(removed.begin(), removed.end(), h) !=
+                        removed.end())
+                        continue;
+                }
+                h->OnReadable();
+            }
+            std::lock_guard<std::mutex> rlock(removed_blocking);
+            removed.clear();
+        }
+    }
+
+  public:
+    /**
+     * Arms a descriptor, adding it to the reactor if need be. @n
+     * Its handler gets notified once, the next time it is readable.
+     * @param fd The descriptor.
+     * @param h Its handler.
+     * @return false on error.
+     */
+    auto Arm(int fd, Handler *h) -> bool {
+        {
+            std::lock_guard<std::mutex> lock(removed_blocking);
+            removed.erase(std::remove(removed.begin(), removed.end(), h),
+                          removed.end());
+        }
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = h;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == 0)
+            return true;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+
+    /**
+     * Removes a descriptor from the reactor. @n
+     * Once this returns, its handler does not get notified anymore and can
+     * be destroyed. Closed descriptors are removed by the kernel, their
+     * handler still has to be forgotten.
+     * @param fd The descriptor, -1 if already closed.
+     * @param h Its handler.
+     */
+    auto Forget(int fd, Handler *h) -> void {
+        // we are already dispatching if called from a handler
+        std::unique_lock<std::mutex> lock(dispatching, std::defer_lock);
+        if (std::this_thread::get_id() != thread.get_id())
+            lock.lock();
+        if (fd >= 0)
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        std::lock_guard<std::mutex> rlock(removed_blocking);
+        removed.push_back(h);
+    }
+
+    /**
+     * Reactor shared by every IPC session that does not pick its own.
+     * @return The default reactor, started on first use.
+     */
+    static auto Default() -> Reactor & {
+        static Reactor reactor;
+        return reactor;
+    }
+
+    /**
+     * Reactor Initializer. @n
+     * Starts the reactor thread.
+     */
+    Reactor() : running(true) {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+        thread = std::thread(&Reactor::Run, this);
+    }
+
+    Reactor(const Reactor &) = delete;
+
+    /**
+     * Reactor Destructor. @n
+     * Stops the reactor thread, the handlers still added do not get notified
+     * anymore.
+     */
+    ~Reactor() {
+        running = false;
+        uint64_t one = 1;
+        [[maybe_unused]] auto len = write(wake_fd, &one, sizeof(one));
+        thread.join();
+        close(wake_fd);
+        close(epoll_fd);
+    }
+};
+#endif
+
+template <typename... C> class Batch;
+
+/**
+ * Layout of a structure mirrored from the emulator's memory, to specialize
+ * for every structure, usually through PINE_STRUCT.
+ * @see Layout
+ * @param T The C++ structure.
+ */
+template <typename T> struct StructLayout;
+
+class Shared {
+    // allow test suite to poke internals
+  protected:
+    /**
+     * IPC Slot identifier. @n
+     * Used by the IPC to identify concurrent sessions.
+     */
+    uint16_t slot;
+
+#if !defined(_WIN32) || defined(DOXYGEN)
+    /**
+     * Unix socket name. @n
+     * The name of the unix socket used on platforms with unix socket support.
+     * @n Currently everything except Windows.
+     */
+    std::string SOCKET_NAME;
+#endif
+
+    /**
+     * Sets the state of the batch command building. @n
+     * This is used when chaining multiple IPC commands in one go. @n
+     * As we cannot build multiple batch IPC commands at the same time because
+     * of state keeping issues we block the initialization of another batch
+     * request until the other ends.
+     */
+    std::mutex batch_blocking;
+
+    /**
+     * IPC result codes. @n
+     * A list of possible result codes the IPC can send back. @n
+     * Each one of them is what we call an "opcode" or "tag" and is the
+     * first byte sent by the IPC to differentiate between results.
+     */
+    enum IPCResult : unsigned char {
+        IPC_OK = 0,     /**< IPC command successfully completed. */
+        IPC_FAIL = 0xFF /**< IPC command failed to complete. */
+    };
+
+    /**
+     * Converts an uint to an char* in little endian.
+     * @param res_array The array to modify.
+     * @param res The value to convert.
+     * @param i When to insert it into the array
+     * @return res_array
+     */
+    template <typename T>
+    static auto ToArray(char *res_array, T res, int i) -> char * {
+        memcpy((res_array + i), (char *)&res, sizeof(T));
+        return res_array;
+    }
+
+    /**
+     * Converts a char* to an uint in little endian.
+     * @param arr The array to convert.
+     * @param i When to load it from the array.
+     * @return The converted value.
+     */
+    template <typename T>
+    static auto FromArray(char *arr, int i) -> T {
+        return *(T *)(arr + i);
+    }
+
+  public:
+    /**
+     * IPC Command messages opcodes. @n
+     * A list of possible operations possible by the IPC. @n
+     * Each one of them is what we call an "opcode" and is the first
+     * byte sent by the IPC to differentiate between commands.
+     */
+    enum IPCCommand : unsigned char {
+        MsgRead8 = 0,           /**< Read 8 bit value to memory. */
+        MsgRead16 = 1,          /**< Read 16 bit value to memory. */
+        MsgRead32 = 2,          /**< Read 32 bit value to memory. */
+        MsgRead64 = 3,          /**< Read 64 bit value to memory. */
+        MsgWrite8 = 4,          /**< Write 8 bit value to memory. */
+        MsgWrite16 = 5,         /**< Write 16 bit value to memory. */
+        MsgWrite32 = 6,         /**< Write 32 bit value to memory. */
+        MsgWrite64 = 7,         /**< Write 64 bit value to memory. */
+        MsgVersion = 8,         /**< Returns the emulator version. */
+        MsgSaveState = 9,       /**< Saves a savestate. */
+        MsgLoadState = 0xA,     /**< Loads a savestate. */
+        MsgTitle = 0xB,         /**< Returns the game title. */
+        MsgID = 0xC,            /**< Returns the game ID. */
+        MsgUUID = 0xD,          /**< Returns the game UUID. */
+        MsgGameVersion = 0xE,   /**< Returns the game verion. */
+        MsgStatus = 0xF,        /**< Returns the emulator status. */
+        MsgReadRange = 0xD0,    /**< Reads a range of memory, optional.
+                                     @see ReadRange */
+        MsgWriteRange = 0xD1,   /**< Writes a range of memory, optional.
+                                     @see WriteRange */
+        MsgReadStrided = 0xD2,  /**< Gathers values evenly spaced in memory,
+                                     optional. @see ReadStrided */
+        MsgReadGather = 0xD3,   /**< Gathers values at a list of addresses,
+                                     optional. @see ReadGather */
+        MsgReadPointer = 0xD4,  /**< Reads at the end of a pointer path,
+                                     optional. @see ReadPointerPath */
+        MsgSharedMemory = 0xF0, /**< Maps shared memory ring buffers.
+                                     @see SharedMemory */
+        MsgUnimplemented = 0xFF /**< Unimplemented IPC message. */
+    };
+
+    /**
+     * Emulator status enum. @n
+     * A list of possible emulator statuses. @n
+     */
+    enum EmuStatus : uint32_t {
+        Running = 0,  /**< Game is running */
+        Paused = 1,   /**< Game is paused */
+        Shutdown = 2, /**< Game is shutdown */
+    };
+
+    /**
+     * IPC transports. @n
+     * A list of the built-in transports an IPC session can use. @n
+     * Only the default transport is standardized, the server has to
+     * explicitly support any other one.
+     * @see Transport
+     */
+    enum TransportType : unsigned char {
+        DefaultTransport = 0,  /**< Unix socket, TCP socket on Windows. */
+        UnixTransport = 1,     /**< Unix socket. @see UnixSocket */
+        TCPTransport = 2,      /**< TCP socket. @see TCPSocket */
+        SeqPacketTransport = 3,   /**< Unix SOCK_SEQPACKET socket.
+                                       @see SeqPacketSocket */
+        SharedMemoryTransport = 4, /**< Shared memory ring buffers, Linux
+                                       only. @see SharedMemory */
+        UringTransport = 5 /**< Unix socket driven by io_uring, Linux only.
+                                @see UringSocket */
+    };
+
+  protected:
+    /**
+     * Creates a built-in transport for this IPC session.
+     * @param type The transport to create.
+     * @return The transport.
+     * @see TransportType
+     */
+    auto MakeTransport(TransportType type) -> Transport * {
+        switch (type) {
+#ifndef _WIN32
+            case DefaultTransport:
+            case UnixTransport:
+                return new UnixSocket(SOCKET_NAME);
+            case SeqPacketTransport:
+                return new SeqPacketSocket(SOCKET_NAME);
+#ifdef __linux__
+            case SharedMemoryTransport:
+                return new SharedMemory(SOCKET_NAME);
+            case UringTransport:
+                return new UringSocket(SOCKET_NAME);
+#endif
+#else
+            case DefaultTransport:
+#endif
+            case TCPTransport:
+                return new TCPSocket(slot);
+            default:
+                // unix sockets on windows, no dice
+                SetError(Unimplemented);
+                return new TCPSocket(slot);
+        }
+    }
+
+    /**
+     * Internal function for savestate IPC messages. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY @n
+     * Legend: XX = IPC Tag, YY = Slot.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param slot The savestate slot to use.
+     * @param T Flag to enable batch processing or not.
+     * @param Y IPCCommand to use.
+     * @return If in batch mode the IPC message otherwise void.
+     */
+    template <IPCCommand Y, bool T = false>
+    auto EmuState(uint8_t slot) {
+        // easiest way to get tag into a constexpr is a lambda, necessary for
+        // GetReply
+        // batch mode
+        if constexpr (T) {
+            char *cmd = batch_builder.EmuState<Y>(slot);
+            if (cmd == nullptr)
+                SetError(OutOfMemory);
+            return cmd;
+        } else {
+            // any idle connection will do
+            auto conn = Acquire();
+            ToArray(conn->ipc_buffer, 4 + 2, 0);
+            conn->ipc_buffer[4] = Y;
+            conn->ipc_buffer[5] = slot;
+            int size;
+            Exchange(*conn, IPCBuffer{ 4 + 1 + 1, conn->ipc_buffer },
+                     conn->ret_buffer, size);
+            // a savestate loaded replaces the whole memory
+            if (Y == MsgLoadState && cache_enabled)
+                Tick();
+            return;
+        }
+    }
+
+    /**
+     * Internal function for IPC messages returning strings. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag.
+     * Return: ZZ * 256
+     * Legend: ZZ = text.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param T Flag to enable batch processing or not.
+     * @param Y IPCCommand to use.
+     * @return If in batch mode the IPC message otherwise void.
+     */
+    template <IPCCommand Y, bool T = false>
+    auto StringCommands() {
+        // batch mode
+        if constexpr (T) {
+            char *cmd = batch_builder.StringCommands<Y>();
+            if (cmd == nullptr)
+                SetError(OutOfMemory);
+            return cmd;
+        } else {
+            // any idle connection will do
+            auto conn = Acquire();
+            ToArray(conn->ipc_buffer, 4 + 1, 0);
+            conn->ipc_buffer[4] = Y;
+            int size;
+            return GetReply<Y>(Exchange(*conn,
+                                        IPCBuffer{ 4 + 1, conn->ipc_buffer },
+                                        conn->ret_buffer, size),
+                               5);
+        }
+    }
+
+  public:
+    /**
+     * IPC message buffer. @n
+     * A list of all needed fields to store an IPC message.
+     */
+    struct IPCBuffer {
+        int size;     /**< Size of the buffer. */
+        char *buffer; /**< Buffer. */
+        // do NOT specify a destructor to free buffer as we reuse the same
+        // buffer to avoid the cost of mallocs; We specify destructors upon need
+        // on structures that makes a copy of this, eg BatchCommand.
+    };
+
+    /**
+     * IPC batch message fields. @n
+     * A list of all needed fields to send a batch IPC message command and
+     * retrieve their result. @n
+     * Owns its buffers, hence can be moved but not copied. Finalizing a
+     * batch into an existing one reuses its buffers, so building batches over
+     * and over does not allocate once they are big enough. @n
+     * A batch split into several IPC messages holds them back to back, their
+     * replies being stored back to back too.
+     * @see FinalizeBatch
+     * @see InitializeBatch
+     */
+    struct BatchCommand {
+        /**
+         * IPC message of a batch split into several ones.
+         */
+        struct Part {
+            int message_offset;   /**< Location of the message. */
+            int message_size;     /**< Size of the message. */
+            int reply_offset;     /**< Location of the reply, if the batch
+                                       does not need relocation. */
+            int reply_size;       /**< Size of the reply, if the batch does
+                                       not need relocation. */
+            unsigned int first;   /**< First argument of the message. */
+            unsigned int count;   /**< Number of arguments of the message. */
+        };
+
+        IPCBuffer ipc_message;          /**< IPC message fields. */
+        mutable IPCBuffer ipc_return;   /**< IPC return fields, sized to the
+                                           last reply received if the message
+                                           needs relocation. */
+        unsigned int *return_locations; /**< Location of arguments in IPC return
+                                           fields. */
+        unsigned int msg_size;          /**< Number of IPC messages. */
+        bool reloc; /**< Whether the message needs relocation. */
+        unsigned int *reply_locations; /**< Location of arguments in the last
+                                          reply received, once relocated. Only
+                                          used if the message needs
+                                          relocation. */
+        int message_capacity;          /**< Size allocated for the IPC
+                                            message. */
+        mutable int return_capacity;   /**< Size allocated for the IPC
+                                            return. */
+        unsigned int locations_capacity; /**< Number of argument locations
+                                              allocated. */
+        std::vector<Part> parts; /**< IPC messages the batch is split into,
+                                      empty if it is not. */
+
+        /**
+         * IPC message of a part of the batch.
+         * @param part The part.
+         */
+        auto Message(const Part &part) const -> IPCBuffer {
+            return IPCBuffer{ part.message_size,
+                              &ipc_message.buffer[part.message_offset] };
+        }
+
+        /**
+         * Placeholder of a prepared batch: a field of one of its commands
+         * that can be bound to a new value once finalized.
+         * @param T Type of the field.
+         * @see Bind
+         * @see AddressSlot
+         * @see ValueSlot
+         */
+        template <typename T>
+        struct Slot {
+            using Type = T;
+            int offset; /**< Location of the field in the IPC message. */
+        };
+
+        /**
+         * Binds a placeholder to a new value, patching the IPC message in
+         * place, so the batch can be sent again without being rebuilt. @n
+         * No lock is taken: the batch must be neither in flight nor being
+         * sent.
+         * @param slot The placeholder.
+         * @param value Its new value.
+         */
+        template <typename T>
+        auto Bind(Slot<T> slot, typename Slot<T>::Type value) -> void {
+            memcpy(&ipc_message.buffer[slot.offset], &value, sizeof(T));
+        }
+
+        /**
+         * Makes room for a batch command, keeping the buffers already
+         * allocated if they are big enough.
+         * @param message Size of the IPC message.
+         * @param ret Size of the IPC return.
+         * @param locations Number of arguments.
+         */
+        auto Reserve(int message, int ret, unsigned int locations) -> void {
+            if (message > message_capacity) {
+                delete[] ipc_message.buffer;
+                ipc_message.buffer = new char[message];
+                message_capacity = message;
+            }
+            ReserveReturn(ret);
+            if (locations > locations_capacity) {
+                delete[] return_locations;
+                delete[] reply_locations;
+                return_locations = new unsigned int[locations];
+                reply_locations = new unsigned int[locations]();
+                locations_capacity = locations;
+            }
+        }
+
+        /**
+         * Makes room for a reply, keeping the IPC return buffer if it is big
+         * enough, along with what it holds.
+         * @param size Size of the reply.
+         */
+        auto ReserveReturn(int size) const -> void {
+            if (size > return_capacity) {
+                char *buffer = new char[size];
+                if (ipc_return.size > 0)
+                    memcpy(buffer, ipc_return.buffer,
+                           std::min(ipc_return.size, size));
+                delete[] ipc_return.buffer;
+                ipc_return.buffer = buffer;
+                return_capacity = size;
+            }
+            ipc_return.size = size;
+        }
+
+        /**
+         * BatchCommand Constructor, empty until finalized.
+         * @see FinalizeBatch
+         */
+        BatchCommand()
+            : ipc_message{ 0, nullptr }, ipc_return{ 0, nullptr },
+              return_locations(nullptr), msg_size(0), reloc(false),
+              reply_locations(nullptr), message_capacity(0),
+              return_capacity(0), locations_capacity(0) {}
+
+        /**
+         * BatchCommand Move Constructor.
+         */
+        BatchCommand(BatchCommand &&other) noexcept : BatchCommand() {
+            *this = std::move(other);
+        }
+
+        /**
+         * BatchCommand Move Assignment, swapping the buffers of both.
+         */
+        auto operator=(BatchCommand &&other) noexcept -> BatchCommand & {
+            std::swap(ipc_message, other.ipc_message);
+            std::swap(ipc_return, other.ipc_return);
+            std::swap(return_locations, other.return_locations);
+            std::swap(msg_size, other.msg_size);
+            std::swap(reloc, other.reloc);
+            std::swap(reply_locations, other.reply_locations);
+            std::swap(message_capacity, other.message_capacity);
+            std::swap(return_capacity, other.return_capacity);
+            std::swap(locations_capacity, other.locations_capacity);
+            std::swap(parts, other.parts);
+            return *this;
+        }
+
+        BatchCommand(const BatchCommand &) = delete;
+        auto operator=(const BatchCommand &) -> BatchCommand & = delete;
+
+        /**
+         * BatchCommand Destructor.
+         */
+        ~BatchCommand() {
+            delete[] ipc_message.buffer;
+            delete[] ipc_return.buffer;
+            delete[] return_locations;
+            delete[] reply_locations;
+        }
+    };
+
+    /**
+     * Result code of the IPC operation. @n
+     * A list of result codes that should be returned, or thrown, depending
+     * on the state of the result of an IPC command.
+     */
+    enum IPCStatus : unsigned int {
+        Success = 0,       /**< IPC command successfully completed. */
+        Fail = 1,          /**< IPC command failed to execute. */
+        OutOfMemory = 2,   /**< IPC command too big to send. */
+        NoConnection = 3,  /**< Cannot connect to the IPC socket. */
+        Unimplemented = 4, /**< Unimplemented IPC command. */
+        Unknown = 5        /**< Unknown status. */
+    };
+
+    /**
+     * Builder of batch commands. @n
+     * It holds its own buffers, so any thread can fill one without locking
+     * anything nor touching the IPC class, only needed to send the
+     * BatchCommand it finalizes: a thread slowly building a batch does not
+     * hold up the others. A builder is used by one thread at a time, eg by
+     * being thread_local, and is meant to be reused, its buffers being
+     * allocated once. @n
+     * InitializeBatch and FinalizeBatch go through a builder of the IPC
+     * class, shared by every thread, one at a time.
+     * @see InitializeBatch
+     * @see BatchCommand
+     */
+    class BatchBuilder {
+      protected:
+        /**
+         * IPC batch messages buffer. @n
+         * A preallocated buffer used to build batch IPC messages. Single IPC
+         * messages are built in the buffers of the connection sending them.
+         * @see Connection
+         * @see MAX_IPC_SIZE
+         */
+        char *ipc_buffer;
+
+        /**
+         * Length of the batch IPC request. @n
+         * This is used when chaining multiple IPC commands in one go to store
+         * the current size of the packet chain.
+         * @see IPCCommand
+         * @see MAX_IPC_SIZE
+         */
+        unsigned int batch_len = 0;
+
+        /**
+         * Length of the reply of the batch IPC request. @n
+         * This is used when chaining multiple IPC commands in one go
+         * to store the length of the reply of the IPC message.
+         * @see IPCCommand
+         * @see MAX_IPC_RETURN_SIZE
+         */
+        unsigned int reply_len = 0;
+
+        /**
+         * Whether a batch command reply needs relocation. @n
+         * This automatically sets up the reply size to be the
+         * maximum possible since we cannot anticipate how much
+         * resources this will take.
+         * @see IPCCommand
+         * @see MAX_IPC_RETURN_SIZE
+         */
+        bool needs_reloc = false;
+
+        /**
+         * Number of IPC messages of the batch IPC request. @n
+         * This is used when chaining multiple IPC commands in one go
+         * to store the number of IPC messages chained together.
+         * @see IPCCommand
+         * @see MAX_BATCH_REPLY_COUNT
+         */
+        unsigned int arg_cnt = 0;
+
+        /**
+         * Position of the batch arguments. @n
+         * This is used when chaining multiple IPC commands in one go.
+         * Stores the location of each message reply in the buffer
+         * sent by FinalizeBatch.
+         * @see FinalizeBatch
+         * @see IPCCommand
+         * @see MAX_BATCH_REPLY_COUNT
+         */
+        unsigned int *batch_arg_place;
+
+        /**
+         * Ensures a batch IPC message isn't too big.
+         * @param command_size Additional size required for the message.
+         * @param reply_size Additional size required for the reply.
+         */
+        auto BatchSafetyChecks(int command_size, int reply_size = 0) -> bool {
+            // we do not really care about wasting cycles when building batch
+            // packets, so let's just do sanity checks for the sake of it.
+            // TODO: go back when clang has implemented C++20 [[unlikely]]
+            auto full = [&]() {
+                return ((batch_len + command_size) >= MAX_IPC_SIZE ||
+                        (reply_len + reply_size) >= MAX_IPC_RETURN_SIZE ||
+                        arg_cnt + 1 >= MAX_BATCH_REPLY_COUNT);
+            };
+            if (batch_split && arg_cnt > 0 && full())
+                SplitBatch();
+            return full();
+        }
+
+        /**
+         * Whether the batch being built gets split into several IPC messages
+         * instead of failing once too big.
+         * @see Initialize
+         */
+        bool batch_split = false;
+
+        /**
+         * Whether the batch being built has placeholders, which keeps it from
+         * being optimized.
+         * @see AddressSlot
+         * @see ValueSlot
+         */
+        bool batch_prepared = false;
+
+        /**
+         * IPC messages of the batch being built already split off, back to
+         * back.
+         * @see SplitBatch
+         */
+        std::vector<char> split_message;
+
+        /**
+         * Position of the arguments of the IPC messages already split off, each
+         * one relative to the reply of its message.
+         * @see SplitBatch
+         */
+        std::vector<unsigned int> split_places;
+
+        /**
+         * IPC messages already split off.
+         * @see SplitBatch
+         */
+        std::vector<BatchCommand::Part> split_parts;
+
+        /**
+         * Size of the replies of the IPC messages already split off.
+         * @see SplitBatch
+         */
+        int split_reply = 0;
+
+        /**
+         * Whether any of the IPC messages already split off needs relocation.
+         * @see SplitBatch
+         */
+        bool split_reloc = false;
+
+        /**
+         * Splits off the batch IPC message being built, so the batch goes on
+         * in a new one.
+         * @see Initialize
+         */
+        auto SplitBatch() -> void {
+            ToArray<uint32_t>(ipc_buffer, batch_len, 0);
+            split_parts.push_back(BatchCommand::Part{
+                (int)split_message.size(), (int)batch_len, split_reply,
+                (int)reply_len, (unsigned int)split_places.size(), arg_cnt });
+            split_message.insert(split_message.end(), ipc_buffer,
+                                 ipc_buffer + batch_len);
+            split_places.insert(split_places.end(), batch_arg_place,
+                                batch_arg_place + arg_cnt);
+            split_reply += reply_len;
+            split_reloc = split_reloc || needs_reloc;
+            batch_len = 4;
+            reply_len = 5;
+            needs_reloc = false;
+            arg_cnt = 0;
+        }
+
+        /**
+         * Command of a batch IPC message being optimized.
+         * @see OptimizeBatch
+         */
+        struct BatchOp {
+            unsigned int offset; /**< Offset of the command in the message. */
+            unsigned int size;   /**< Size of the command. */
+            unsigned char tag;   /**< IPCCommand of the command. */
+            uint32_t address;    /**< Address accessed by a memory command. */
+            unsigned int width;  /**< Bytes accessed by a memory command. */
+            int slot;            /**< BatchSlot of a read, -1 if none. */
+            bool dead;           /**< Whether a write gets overwritten. */
+        };
+
+        /**
+         * Reads of the same aligned 8 bytes of memory, with no write to them in
+         * between, sent as a single read when it is smaller.
+         * @see OptimizeBatch
+         */
+        struct BatchSlot {
+            uint32_t base;      /**< Address of the 8 bytes. */
+            unsigned int first; /**< First read, where the slot gets sent. */
+            uint32_t keys;      /**< Set of the distinct reads, by key. */
+            unsigned int location[32]; /**< Reply location of each read. */
+
+            /**
+             * Key of a read in the slot: its offset and the log2 of its width,
+             * the latter being its opcode.
+             */
+            static auto Key(const BatchOp &op) -> unsigned int {
+                return ((op.address & 7) << 2) | op.tag;
+            }
+        };
+
+        /**
+         * Optimizes a batch IPC message in place. @n
+         * Duplicate reads are dropped, narrow reads of the same aligned 8 bytes
+         * are merged into a wider one when that is smaller, and writes
+         * overwritten before being read are dropped. Reads only move up to
+         * their first neighbour, never past a write to their bytes nor past a
+         * command that is not a memory one, so the batch reads and writes the
+         * same values. @n
+         * The message and its reply only ever shrink.
+         * @param msg The IPC message, with its header.
+         * @param size The size of the message, updated.
+         * @param reply The size of the reply, updated.
+         * @param places Position of the arguments in the reply, updated.
+         * @param count Number of arguments.
+         * @see FinalizeBatch
+         */
+        auto OptimizeBatch(char *msg, unsigned int &size, unsigned int &reply,
+                           unsigned int *places, unsigned int count) -> void {
+            std::vector<char> source(msg, msg + size);
+            std::vector<BatchOp> ops;
+            ops.reserve(count);
+            for (unsigned int i = 4; i < size;) {
+                BatchOp op{ i, 1, (unsigned char)source[i], 0, 0, -1, false };
+                if (op.tag <= MsgWrite64) {
+                    op.address = FromArray<uint32_t>(source.data(), i + 1);
+                    op.width = 1 << (op.tag & 3);
+                    op.size = 5 + (op.tag >= MsgWrite8 ? op.width : 0);
+                } else if (op.tag == MsgSaveState || op.tag == MsgLoadState) {
+                    op.size = 2;
+                } else if (op.tag == MsgReadRange ||
+                           op.tag == MsgWriteRange) {
+                    // ranges are left in place, like commands that are not
+                    // memory ones
+                    op.width = FromArray<uint32_t>(source.data(), i + 5);
+                    op.size = 9 + (op.tag == MsgWriteRange ? op.width : 0);
+                } else if (op.tag == MsgReadStrided) {
+                    // and so are gathers, their width being their reply
+                    op.width = FromArray<uint32_t>(source.data(), i + 9) *
+                               (unsigned char)source[i + 13];
+                    op.size = 14;
+                } else if (op.tag == MsgReadGather) {
+                    uint32_t n = FromArray<uint32_t>(source.data(), i + 2);
+                    op.width = n * (unsigned char)source[i + 1];
+                    op.size = 6 + 4 * n;
+                } else if (op.tag == MsgReadPointer) {
+                    // the pointers it reads are only known by the server
+                    op.width = (unsigned char)source[i + 5];
+                    op.width = op.width == 0 ? 4 : op.width;
+                    op.size = 7 + 4 * (unsigned char)source[i + 6];
+                } else if (op.tag > MsgStatus) {
+                    // we do not know this one, leave the message as is
+                    return;
+                }
+                ops.push_back(op);
+                i += op.size;
+            }
+            if (ops.size() != count)
+                return;
+
+            // going backwards, a write is dead if every byte of it gets written
+            // again before being read.
+            std::unordered_set<uint32_t> overwritten;
+            for (auto op = ops.rbegin(); op != ops.rend(); ++op) {
+                if (op->tag >= MsgWrite8 && op->tag <= MsgWrite64) {
+                    op->dead = true;
+                    for (unsigned int b = 0; b < op->width; b++) {
+                        op->dead =
+                            op->dead && overwritten.count(op->address + b);
+                        overwritten.insert(op->address + b);
+                    }
+                } else if (op->tag <= MsgRead64) {
+                    for (unsigned int b = 0; b < op->width; b++)
+                        overwritten.erase(op->address + b);
+                } else {
+                    overwritten.clear();
+                }
+            }
+
+            // going forward, reads join the slot of their 8 bytes until a write
+            // to them closes it.
+            std::vector<BatchSlot> slots;
+            std::unordered_map<uint32_t, int> open;
+            for (unsigned int i = 0; i < ops.size(); i++) {
+                auto &op = ops[i];
+                if (op.tag <= MsgRead64) {
+                    // straddling two slots, sent as is
+                    if ((op.address & 7) + op.width > 8)
+                        continue;
+                    auto slot = open.find(op.address & ~7u);
+                    if (slot == open.end()) {
+                        slot = open.emplace(op.address & ~7u, (int)slots.size())
+                                   .first;
+                        slots.push_back(
+                            BatchSlot{ op.address & ~7u, i, 0, {} });
+                    }
+                    op.slot = slot->second;
+                    slots[op.slot].keys |= 1u << BatchSlot::Key(op);
+                } else if (op.tag <= MsgWrite64) {
+                    if (op.dead)
+                        continue;
+                    open.erase(op.address & ~7u);
+                    open.erase((op.address + op.width - 1) & ~7u);
+                } else {
+                    open.clear();
+                }
+            }
+
+            // 0-3 = reply size, 4 = result
+            reply = 5;
+            auto read = [&](uint32_t address, unsigned char tag) {
+                msg[size] = tag;
+                ToArray<uint32_t>(msg, address, size + 1);
+                size += 5;
+            };
+            size = 4;
+            for (unsigned int i = 0; i < ops.size(); i++) {
+                auto &op = ops[i];
+                if (op.slot >= 0) {
+                    auto &slot = slots[op.slot];
+                    if (slot.first == i) {
+                        unsigned int lo = 8, hi = 0, sum = 0, distinct = 0;
+                        for (unsigned int k = 0; k < 32; k++) {
+                            if ((slot.keys & (1u << k)) == 0)
+                                continue;
+                            lo = std::min(lo, k >> 2);
+                            hi = std::max(hi, (k >> 2) + (1 << (k & 3)));
+                            sum += 1 << (k & 3);
+                            distinct++;
+                        }
+                        // smallest aligned read covering them all
+                        unsigned char tag = MsgRead8;
+                        while ((lo & ~((1u << tag) - 1)) + (1u << tag) < hi)
+                            tag++;
+                        unsigned int start = lo & ~((1u << tag) - 1);
+                        bool merge = distinct > 1 && (1u << tag) <= sum;
+                        if (merge) {
+                            read(slot.base + start, tag);
+                            reply += 1 << tag;
+                        }
+                        for (unsigned int k = 0; k < 32; k++) {
+                            if ((slot.keys & (1u << k)) == 0)
+                                continue;
+                            if (merge) {
+                                slot.location[k] = reply - (1 << tag) +
+                                                   (k >> 2) - start;
+                            } else {
+                                read(slot.base + (k >> 2), k & 3);
+                                slot.location[k] = reply;
+                                reply += 1 << (k & 3);
+                            }
+                        }
+                    }
+                    places[i] = slot.location[BatchSlot::Key(op)];
+                    continue;
+                }
+                places[i] = reply;
+                if (op.dead)
+                    continue;
+                memcpy(&msg[size], &source[op.offset], op.size);
+                size += op.size;
+                if (op.tag <= MsgRead64 || op.tag == MsgReadRange ||
+                    op.tag == MsgReadStrided || op.tag == MsgReadGather ||
+                    op.tag == MsgReadPointer) {
+                    reply += op.width;
+                } else if (op.tag == MsgStatus) {
+                    reply += 4;
+                } else if (op.tag == MsgVersion ||
+                           (op.tag >= MsgTitle && op.tag <= MsgGameVersion)) {
+                    places[i] |= 0x80000000;
+                    reply += 4;
+                }
+            }
+            ToArray<uint32_t>(msg, size, 0);
+        }
+
+        /**
+         * Reports a batch too big. @n
+         * On C++, throws an OutOfMemory IPCStatus, on C, lets the IPC class
+         * set it.
+         * @return No command.
+         */
+        static auto Full() -> char * {
+#ifndef C_FFI
+            throw OutOfMemory;
+#endif
+            return nullptr;
+        }
+
+        /**
+         * Log2 of the width of a memory command, added to its opcode.
+         * @param Y The type of the value read or written.
+         */
+        template <typename Y>
+        static constexpr auto Width() -> unsigned char {
+            static_assert(sizeof(Y) == 1 || sizeof(Y) == 2 || sizeof(Y) == 4 ||
+                              sizeof(Y) == 8,
+                          "unimplemented width");
+            return (sizeof(Y) == 1) ? 0
+                   : (sizeof(Y) == 2) ? 1
+                   : (sizeof(Y) == 4) ? 2
+                                      : 3;
+        }
+
+      public:
+        /**
+         * Starts building a new batch, dropping the one being built if any.
+         * @param split Whether to split the batch if too big.
+         * @see Shared::InitializeBatch
+         */
+        auto Initialize(bool split = false) -> void {
+            // 0-3 = header size, 4 = opcode
+            batch_len = 4;
+            reply_len = 5;
+            needs_reloc = false;
+            arg_cnt = 0;
+            batch_split = split;
+            batch_prepared = false;
+            split_message.clear();
+            split_places.clear();
+            split_parts.clear();
+            split_reply = 0;
+            split_reloc = false;
+        }
+
+        /**
+         * Finalizes the batch being built into a new BatchCommand.
+         * @param optimize Whether to optimize the batch.
+         * @see Shared::FinalizeBatch
+         */
+        auto Finalize(bool optimize = false) -> BatchCommand {
+            BatchCommand cmd;
+            Finalize(cmd, optimize);
+            return cmd;
+        }
+
+        /**
+         * Finalizes the batch being built into an existing BatchCommand,
+         * reusing its buffers.
+         * @param cmd The BatchCommand to overwrite, neither in flight nor
+         * being sent.
+         * @param optimize Whether to optimize the batch, unless it has
+         * placeholders.
+         * @see Shared::FinalizeBatch
+         */
+        auto Finalize(BatchCommand &cmd, bool optimize = false) -> void {
+            // save size in IPC message header.
+            ToArray<uint32_t>(ipc_buffer, batch_len, 0);
+
+            // we copy our arrays so the builder can go on. The size of the
+            // reply of a message needing relocation is only known once
+            // received, its buffer grows to fit it then.
+            // placeholders point into the message as built
+            optimize = optimize && !batch_prepared;
+            if (split_parts.empty()) {
+                if (optimize)
+                    OptimizeBatch(ipc_buffer, batch_len, reply_len,
+                                  batch_arg_place, arg_cnt);
+                cmd.Reserve(batch_len, reply_len, arg_cnt);
+                cmd.ipc_message.size = batch_len;
+                memcpy(cmd.ipc_message.buffer, ipc_buffer,
+                       batch_len * sizeof(char));
+                memcpy(cmd.return_locations, batch_arg_place,
+                       arg_cnt * sizeof(unsigned int));
+                cmd.msg_size = arg_cnt;
+                cmd.reloc = needs_reloc;
+                cmd.parts.clear();
+            } else {
+                if (arg_cnt > 0)
+                    SplitBatch();
+                // each IPC message shrinks in place, then they get packed again
+                if (optimize) {
+                    int offset = 0;
+                    split_reply = 0;
+                    for (auto &part : split_parts) {
+                        unsigned int size = part.message_size;
+                        unsigned int reply = part.reply_size;
+                        OptimizeBatch(&split_message[part.message_offset], size,
+                                      reply, &split_places[part.first],
+                                      part.count);
+                        memmove(&split_message[offset],
+                                &split_message[part.message_offset], size);
+                        part.message_offset = offset;
+                        part.message_size = size;
+                        part.reply_offset = split_reply;
+                        part.reply_size = reply;
+                        offset += size;
+                        split_reply += reply;
+                    }
+                    split_message.resize(offset);
+                }
+                unsigned int count = split_places.size();
+                cmd.Reserve(split_message.size(), split_reply, count);
+                cmd.ipc_message.size = split_message.size();
+                memcpy(cmd.ipc_message.buffer, split_message.data(),
+                       split_message.size());
+                memcpy(cmd.return_locations, split_places.data(),
+                       count * sizeof(unsigned int));
+                cmd.msg_size = count;
+                cmd.reloc = split_reloc;
+                cmd.parts = split_parts;
+                // without relocation every reply is where it will be received
+                if (!cmd.reloc)
+                    for (auto &part : cmd.parts)
+                        for (unsigned int i = 0; i < part.count; i++)
+                            cmd.return_locations[part.first + i] +=
+                                part.reply_offset;
+            }
+        }
+
+        /**
+         * Adds a read to the batch.
+         * @param address The address to read.
+         * @param Y The type of the variable to read (eg uint8_t).
+         * @return The command.
+         * @see Shared::Read
+         */
+        template <typename Y>
+        auto Read(uint32_t address) -> char * {
+            if (BatchSafetyChecks(5, sizeof(Y)))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgRead8 + Width<Y>();
+            ToArray(cmd, address, 1);
+            batch_len += 5;
+            batch_arg_place[arg_cnt] = reply_len;
+            reply_len += sizeof(Y);
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a write to the batch.
+         * @param address The address to write to.
+         * @param value The value to write.
+         * @param Y The type of the variable to write (eg uint8_t).
+         * @return The command.
+         * @see Shared::Write
+         */
+        template <typename Y>
+        auto Write(uint32_t address, Y value) -> char * {
+            if (BatchSafetyChecks(5 + sizeof(Y)))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgWrite8 + Width<Y>();
+            ToArray(cmd, address, 1);
+            ToArray(cmd, value, 5);
+            batch_len += 5 + sizeof(Y);
+            // no reply, but relocation walks every argument
+            batch_arg_place[arg_cnt] = reply_len;
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a read of a range of memory to the batch. Its reply is the
+         * memory read.
+         * @param address The address to read from.
+         * @param size Size of the range, at most MAX_RANGE_SIZE.
+         * @return The command.
+         * @see Shared::ReadRange
+         */
+        auto ReadRange(uint32_t address, uint32_t size) -> char * {
+            if (size > MAX_RANGE_SIZE || BatchSafetyChecks(9, size))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgReadRange;
+            ToArray(cmd, address, 1);
+            ToArray(cmd, size, 5);
+            batch_len += 9;
+            batch_arg_place[arg_cnt] = reply_len;
+            reply_len += size;
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a write of a range of memory to the batch.
+         * @param address The address to write to.
+         * @param src The memory to write.
+         * @param size Size of the range, at most MAX_RANGE_SIZE.
+         * @return The command.
+         * @see Shared::WriteRange
+         */
+        auto WriteRange(uint32_t address, const void *src, uint32_t size)
+            -> char * {
+            if (size > MAX_RANGE_SIZE || BatchSafetyChecks(9 + size))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgWriteRange;
+            ToArray(cmd, address, 1);
+            ToArray(cmd, size, 5);
+            memcpy(&cmd[9], src, size);
+            batch_len += 9 + size;
+            batch_arg_place[arg_cnt] = reply_len;
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a gather of count values, stride bytes apart, to the batch.
+         * Its reply is the values read, packed one after the other.
+         * @param address The address of the first value.
+         * @param stride Distance between two values.
+         * @param count Number of values, at most MAX_RANGE_SIZE bytes of them.
+         * @param Y The type of the values.
+         * @return The command.
+         * @see Shared::ReadStrided
+         */
+        template <typename Y>
+        auto ReadStrided(uint32_t address, uint32_t stride, uint32_t count)
+            -> char * {
+            if (count > MAX_RANGE_SIZE / sizeof(Y) ||
+                (count > 0 &&
+                 address + (uint64_t)stride * (count - 1) > 0xFFFFFFFF) ||
+                BatchSafetyChecks(14, count * sizeof(Y)))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgReadStrided;
+            ToArray(cmd, address, 1);
+            ToArray(cmd, stride, 5);
+            ToArray(cmd, count, 9);
+            cmd[13] = sizeof(Y);
+            batch_len += 14;
+            batch_arg_place[arg_cnt] = reply_len;
+            reply_len += count * sizeof(Y);
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a gather of the values at a list of addresses to the batch.
+         * Its reply is the values read, packed one after the other.
+         * @param addresses The addresses of the values.
+         * @param count Number of values, at most MAX_RANGE_SIZE bytes of them
+         * and of their addresses.
+         * @param Y The type of the values.
+         * @return The command.
+         * @see Shared::ReadGather
+         */
+        template <typename Y>
+        auto ReadGather(const uint32_t *addresses, uint32_t count) -> char * {
+            if (count > MAX_RANGE_SIZE / std::max<size_t>(sizeof(Y), 4) ||
+                BatchSafetyChecks(6 + 4 * count, count * sizeof(Y)))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgReadGather;
+            cmd[1] = sizeof(Y);
+            ToArray(cmd, count, 2);
+            for (uint32_t i = 0; i < count; i++)
+                ToArray(cmd, addresses[i], 6 + 4 * i);
+            batch_len += 6 + 4 * count;
+            batch_arg_place[arg_cnt] = reply_len;
+            reply_len += count * sizeof(Y);
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a read at the end of a pointer path to the batch. Its reply is
+         * the value read, or the address the path ends at for a width of 0.
+         * @param address The address of the first pointer.
+         * @param offsets The offsets added to each pointer read in turn.
+         * @param count Number of offsets.
+         * @param width Width of the value read, 0 for none.
+         * @return The command.
+         * @see Shared::ReadPointerPath
+         */
+        auto ReadPointerPath(uint32_t address, const uint32_t *offsets,
+                             uint8_t count, uint8_t width) -> char * {
+            unsigned int reply = width == 0 ? 4 : width;
+            if (BatchSafetyChecks(7 + 4 * count, reply))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgReadPointer;
+            ToArray(cmd, address, 1);
+            cmd[5] = width;
+            cmd[6] = count;
+            for (uint8_t i = 0; i < count; i++)
+                ToArray(cmd, offsets[i], 7 + 4 * i);
+            batch_len += 7 + 4 * count;
+            batch_arg_place[arg_cnt] = reply_len;
+            reply_len += reply;
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a savestate command to the batch.
+         * @param slot The savestate slot to use.
+         * @param Y IPCCommand to use.
+         * @return The command.
+         * @see SaveState
+         * @see LoadState
+         */
+        template <IPCCommand Y>
+        auto EmuState(uint8_t slot) -> char * {
+            if (BatchSafetyChecks(2))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = Y;
+            cmd[1] = slot;
+            batch_len += 2;
+            batch_arg_place[arg_cnt] = reply_len;
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a command returning a string to the batch.
+         * @param Y IPCCommand to use.
+         * @return The command.
+         * @see Version
+         */
+        template <IPCCommand Y>
+        auto StringCommands() -> char * {
+            // reply is automatically set to max because of reloc, so let's
+            // not check that
+            if (BatchSafetyChecks(1, 4))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = Y;
+            batch_len += 1;
+            // MSB is used as a flag to warn pine that the reply is a VLE!
+            batch_arg_place[arg_cnt] = (reply_len | 0x80000000);
+            reply_len += 4;
+            needs_reloc = true;
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Adds a Version command to the batch.
+         * @see Shared::Version
+         */
+        auto Version() -> char * { return StringCommands<MsgVersion>(); }
+
+        /**
+         * Adds a GetGameTitle command to the batch.
+         * @see Shared::GetGameTitle
+         */
+        auto GetGameTitle() -> char * { return StringCommands<MsgTitle>(); }
+
+        /**
+         * Adds a GetGameID command to the batch.
+         * @see Shared::GetGameID
+         */
+        auto GetGameID() -> char * { return StringCommands<MsgID>(); }
+
+        /**
+         * Adds a GetGameUUID command to the batch.
+         * @see Shared::GetGameUUID
+         */
+        auto GetGameUUID() -> char * { return StringCommands<MsgUUID>(); }
+
+        /**
+         * Adds a GetGameVersion command to the batch.
+         * @see Shared::GetGameVersion
+         */
+        auto GetGameVersion() -> char * {
+            return StringCommands<MsgGameVersion>();
+        }
+
+        /**
+         * Adds a SaveState command to the batch.
+         * @param slot The savestate slot to use.
+         * @see Shared::SaveState
+         */
+        auto SaveState(uint8_t slot) -> char * {
+            return EmuState<MsgSaveState>(slot);
+        }
+
+        /**
+         * Adds a LoadState command to the batch.
+         * @param slot The savestate slot to use.
+         * @see Shared::LoadState
+         */
+        auto LoadState(uint8_t slot) -> char * {
+            return EmuState<MsgLoadState>(slot);
+        }
+
+        /**
+         * Adds a Status command to the batch.
+         * @see Shared::Status
+         */
+        auto Status() -> char * {
+            if (BatchSafetyChecks(1, 4))
+                return Full();
+            char *cmd = &ipc_buffer[batch_len];
+            cmd[0] = MsgStatus;
+            batch_len += 1;
+            batch_arg_place[arg_cnt] = reply_len;
+            reply_len += 4;
+            arg_cnt += 1;
+            return cmd;
+        }
+
+        /**
+         * Placeholder for the address of a read or write of the batch.
+         * @param cmd The command, before another one gets added.
+         * @see Shared::AddressSlot
+         */
+        auto AddressSlot(const char *cmd) -> BatchCommand::Slot<uint32_t> {
+            batch_prepared = true;
+            // the message being built goes after the ones already split off
+            return BatchCommand::Slot<uint32_t>{
+                (int)split_message.size() + (int)(cmd - ipc_buffer) + 1
+            };
+        }
+
+        /**
+         * Placeholder for the value of a write of the batch.
+         * @param cmd The command, before another one gets added.
+         * @param Y The type of the value written.
+         * @see Shared::ValueSlot
+         */
+        template <typename Y>
+        auto ValueSlot(const char *cmd) -> BatchCommand::Slot<Y> {
+            batch_prepared = true;
+            return BatchCommand::Slot<Y>{ (int)split_message.size() +
+                                          (int)(cmd - ipc_buffer) + 5 };
+        }
+
+        /**
+         * BatchBuilder Constructor, ready to build a batch.
+         */
+        BatchBuilder()
+            : ipc_buffer(new char[MAX_IPC_SIZE]),
+              batch_arg_place(new unsigned int[MAX_BATCH_REPLY_COUNT]) {
+            Initialize();
+        }
+
+        BatchBuilder(const BatchBuilder &) = delete;
+        auto operator=(const BatchBuilder &) -> BatchBuilder & = delete;
+
+        /**
+         * BatchBuilder Destructor.
+         */
+        ~BatchBuilder() {
+            delete[] ipc_buffer;
+            delete[] batch_arg_place;
+        }
+    };
+
+  protected:
+    /**
+     * Builder of the batches initialized by InitializeBatch, shared by
+     * every thread, one at a time.
+     * @see batch_blocking
+     */
+    BatchBuilder batch_builder;
+
+    /**
+     * Command in flight in the pipeline.
+     * @see Submit
+     */
+    struct InFlight {
+        IPCBuffer ret;             /**< Where to receive the reply. */
+        const BatchCommand *batch; /**< Batch command to relocate, if any. */
+        unsigned int bytes;        /**< Size of the message and reply. */
+        std::function<void(IPCStatus)> done; /**< Completion of an
+                                                  asynchronous command, if
+                                                  any. */
+        unsigned int part = 0; /**< Part of the batch command, if split. */
+    };
+
+    /**
+     * Asynchronous command collected, whose completion has yet to run.
+     */
+    using Completion = std::pair<std::function<void(IPCStatus)>, IPCStatus>;
+
+    /**
+     * Connection to the server. @n
+     * Every connection has its own transport, scratch buffers and pipeline,
+     * so threads using different connections never wait on each other.
+     * @see Acquire
+     */
+    struct Connection {
+        /**
+         * IPC transport. @n
+         * Used to send the IPC messages of this connection to the server.
+         * @see Transport
+         * @see TransportType
+         */
+        std::unique_ptr<Transport> transport;
+
+        /**
+         * Held by the thread using the connection.
+         * @see Acquire
+         */
+        std::mutex blocking;
+
+        /**
+         * IPC messages buffer. @n
+         * Used to build single IPC messages, the biggest one being a
+         * Write<uint64_t> of 4 + 1 + 4 + 8 bytes.
+         */
+        char ipc_buffer[32];
+
+        /**
+         * IPC return buffer. @n
+         * A preallocated buffer used to store IPC replies, of
+         * MAX_IPC_RETURN_SIZE bytes.
+         */
+        char *ret_buffer;
+
+        /**
+         * Pipeline of commands in flight. @n
+         * A ring buffer whose size is the pipeline depth.
+         * @see Submit
+         * @see SetPipelineDepth
+         */
+        std::vector<InFlight> pipeline;
+
+        /**
+         * Position of the oldest command in flight in the pipeline.
+         */
+        unsigned int pipeline_head = 0;
+
+        /**
+         * Number of commands in flight in the pipeline.
+         */
+        unsigned int pipeline_count = 0;
+
+        /**
+         * Size of the messages and replies in flight in the pipeline.
+         * @see pipeline_window
+         */
+        unsigned int pipeline_bytes = 0;
+
+        /**
+         * Maximum size of the messages and replies in flight in the
+         * pipeline. @n
+         * Neither side reads while it is writing, so if everything in flight
+         * does not fit in the socket buffers both ends wait for each other
+         * forever.
+         * @see PIPELINE_WINDOW
+         */
+        unsigned int pipeline_window = PIPELINE_WINDOW;
+
+        /**
+         * Sequence number of the next command submitted to the pipeline.
+         */
+        uint64_t pipeline_seq = 0;
+
+        /**
+         * Asynchronous commands collected while the connection was held. @n
+         * Their completions run once it is given back, so they are free to
+         * send IPC commands themselves.
+         * @see Release
+         */
+        std::vector<Completion> completed;
+
+        /**
+         * Whether the reactor found the connection held while it had
+         * replies to collect, which its holder then has to collect.
+         * @see Shared::Drain
+         */
+        std::atomic<bool> missed{ false };
+
+        /**
+         * Connection Initializer.
+         * @param t The transport of the connection, owned by it.
+         */
+        Connection(Transport *t)
+            : transport(t), ret_buffer(new char[MAX_IPC_RETURN_SIZE]),
+              pipeline(PIPELINE_DEPTH) {}
+
+        /**
+         * Connection Destructor.
+         */
+        ~Connection() { delete[] ret_buffer; }
+    };
+
+    /**
+     * Exclusive use of a connection. @n
+     * Gives the connection back to the pool when destroyed.
+     * @see Acquire
+     */
+    class Lease {
+        Shared *ipc;
+        Connection *conn;
+
+      public:
+        Lease(Shared *ipc, Connection *conn) : ipc(ipc), conn(conn) {}
+        Lease(const Lease &) = delete;
+        ~Lease() { ipc->Release(*conn); }
+        auto operator->() -> Connection * { return conn; }
+        auto operator*() -> Connection & { return *conn; }
+    };
+
+    /**
+     * Connections to the server. @n
+     * Created on demand, up to pool_size of them, and never empty.
+     * @see Acquire
+     */
+    std::vector<std::unique_ptr<Connection>> connections;
+
+    /**
+     * Maximum number of connections to the server.
+     * @see SetPoolSize
+     */
+    unsigned int pool_size = 1;
+
+    /**
+     * Creates the transport of new connections, none if they cannot be
+     * created.
+     * @see SetTransport
+     */
+    std::function<Transport *()> transport_factory;
+
+    /**
+     * Protects connections and pool_size.
+     */
+    std::mutex pool_blocking;
+
+    /**
+     * Signaled when a connection is given back to the pool.
+     */
+    std::condition_variable pool_released;
+
+    /**
+     * Number of threads waiting for a connection.
+     */
+    unsigned int pool_waiters = 0;
+
+    /**
+     * Single read waiting to be merged into a batch.
+     * @see Coalesce
+     */
+    struct Coalesced {
+        char message[1 + 4]; /**< Batch IPC message of the read. */
+        char reply[8];       /**< Reply of the read. */
+        int reply_size;      /**< Size of the reply. */
+        bool done;           /**< Whether the batch got sent. */
+        bool ok;             /**< Whether the batch succeeded. */
+    };
+
+    /**
+     * How long single reads wait for others to be merged with, 0 if they do
+     * not.
+     * @see SetCoalescing
+     */
+    std::chrono::microseconds coalesce_window{ 0 };
+
+    /**
+     * Number of single reads after which a batch gets sent right away, and
+     * that the next batch never goes past.
+     * @see SetCoalescing
+     */
+    unsigned int coalesce_max = COALESCE_MAX;
+
+    /**
+     * Single reads waiting to be merged into the next batch.
+     */
+    std::vector<Coalesced *> coalesce_pending;
+
+    /**
+     * Whether a thread waits to send the next batch of single reads.
+     */
+    bool coalesce_leading = false;
+
+    /**
+     * Protects coalesce_pending and coalesce_leading.
+     */
+    std::mutex coalesce_blocking;
+
+    /**
+     * Signaled when the next batch of single reads is full.
+     */
+    std::condition_variable coalesce_full;
+
+    /**
+     * Signaled when the next batch of single reads got taken to be sent,
+     * making room for others.
+     */
+    std::condition_variable coalesce_room;
+
+    /**
+     * Signaled when a batch of single reads got sent.
+     */
+    std::condition_variable coalesce_sent;
+
+    /**
+     * Whether single reads go through the read cache.
+     * @see SetReadCache
+     */
+    std::atomic<bool> cache_enabled{ false };
+
+    /**
+     * Values read or written during the current epoch, their bytes keyed by
+     * CacheKey.
+     * @see SetReadCache
+     */
+    std::unordered_map<uint64_t, uint64_t> cache;
+
+    /**
+     * Current epoch of the read cache. @n
+     * A new one starts on every Tick, and before and after every write, so
+     * that values read while memory got written do not get cached.
+     * @see Tick
+     * @see CacheInvalidate
+     */
+    uint64_t cache_epoch = 0;
+
+    /**
+     * Protects cache and cache_epoch.
+     */
+    std::mutex cache_blocking;
+
+    /**
+     * Number of single reads served by, or missing, the read cache.
+     * @see GetCacheStats
+     */
+    std::atomic<uint64_t> cache_hits{ 0 }, cache_misses{ 0 };
+
+    /**
+     * Key of a value in the read cache.
+     * @param address The address of the value.
+     * @param width The width of the value.
+     * @return The key.
+     */
+    static auto CacheKey(uint32_t address, unsigned int width) -> uint64_t {
+        return ((uint64_t)address << 4) | width;
+    }
+
+    /**
+     * Looks a value up in the read cache.
+     * @param address The address of the value.
+     * @param width The width of the value.
+     * @param value Where to store the bytes of the value on a hit.
+     * @param epoch Set to the current epoch, for CacheStore.
+     * @return Whether the value was cached.
+     */
+    auto CacheLookup(uint32_t address, unsigned int width, char *value,
+                     uint64_t &epoch) -> bool {
+        std::lock_guard<std::mutex> lock(cache_blocking);
+        epoch = cache_epoch;
+        auto hit = cache.find(CacheKey(address, width));
+        if (hit == cache.end()) {
+            cache_misses++;
+            return false;
+        }
+        cache_hits++;
+        memcpy(value, &hit->second, width);
+        return true;
+    }
+
+    /**
+     * Stores a value read or written into the read cache, unless the epoch
+     * changed since the command got sent or the command failed. @n
+     * A value written also starts a new epoch, as reads sent before the
+     * write may have been served after it.
+     * @param address The address of the value.
+     * @param width The width of the value.
+     * @param value The bytes of the value.
+     * @param epoch The epoch the command got sent in.
+     * @param written Whether the value got written.
+     */
+    auto CacheStore(uint32_t address, unsigned int width, const char *value,
+                    uint64_t epoch, bool written = false) -> void {
+#ifdef C_FFI
+        if (ipc_errno != Success)
+            return;
+#endif
+        std::lock_guard<std::mutex> lock(cache_blocking);
+        if (epoch == cache_epoch) {
+            uint64_t bytes = 0;
+            memcpy(&bytes, value, width);
+            cache[CacheKey(address, width)] = bytes;
+        } else if (written) {
+            // another write got in the way, which one landed last is unknown
+            CacheDrop(address, width);
+        }
+        if (written)
+            cache_epoch++;
+    }
+
+    /**
+     * Drops every cached value overlapping some memory. @n
+     * Holds cache_blocking.
+     * @param address The address of the memory.
+     * @param size The number of bytes of the memory.
+     */
+    auto CacheDrop(uint32_t address, uint32_t size) -> void {
+        if (size > 64) {
+            cache.clear();
+            return;
+        }
+        for (uint32_t width = 1; width <= 8; width <<= 1) {
+            uint64_t start = address < width ? 0 : address - width + 1;
+            for (; start < (uint64_t)address + size; start++)
+                cache.erase(CacheKey(start, width));
+        }
+    }
+
+    /**
+     * Drops every cached value overlapping memory written, and starts a new
+     * epoch so that reads in flight do not get cached. @n
+     * Called before a write gets sent, and once it completed unless the
+     * value written gets stored.
+     * @param address The address written to.
+     * @param size The number of bytes written.
+     * @return The new epoch, for CacheStore.
+     */
+    auto CacheInvalidate(uint32_t address, uint32_t size) -> uint64_t {
+        std::lock_guard<std::mutex> lock(cache_blocking);
+        CacheDrop(address, size);
+        return ++cache_epoch;
+    }
+
+#if defined(__linux__) || defined(DOXYGEN)
+    /**
+     * Reactor collecting the replies of asynchronous commands, nullptr until
+     * the first one is sent.
+     * @see SetReactor
+     */
+    Reactor *reactor = nullptr;
+
+    /**
+     * Forwards the notifications of the reactor to OnReadable.
+     */
+    struct AsyncHandler : Reactor::Handler {
+        Shared *ipc;
+        AsyncHandler(Shared *ipc) : ipc(ipc) {}
+        auto OnReadable() -> void override { ipc->OnReadable(); }
+    } async_handler{ this };
+
+    /**
+     * Notified by the reactor when replies arrived.
+     * @see Reactor
+     */
+    auto OnReadable() -> void {
+        Connection *c;
+        {
+            std::lock_guard<std::mutex> lock(pool_blocking);
+            if (connections.empty())
+                return;
+            c = connections[0].get();
+        }
+        Drain(c);
+    }
+
+    /**
+     * Collects the replies of the asynchronous commands that have arrived.
+     * @n Never waits for the connection: if it is held, its holder drains it
+     * once given back.
+     * @param c The connection.
+     * @see Release
+     */
+    auto Drain(Connection *c) -> void {
+        if (!c->blocking.try_lock()) {
+            c->missed = true;
+            // it might have been given back before seeing the flag
+            if (!c->blocking.try_lock())
+                return;
+        }
+        Lease lease(this, c);
+        while (c->pipeline_count > 0 && c->pipeline[c->pipeline_head].done) {
+            InFlight &p = c->pipeline[c->pipeline_head];
+            int receive_length = c->transport->TryReceive(p.ret.buffer,
+                                                          p.ret.size);
+            if (receive_length == 0)
+                break;
+            Complete(*c, std::max(receive_length, 0), false);
+        }
+    }
+#endif
+
+    /**
+     * Acquires an idle connection, creating one or waiting for one if need
+     * be. @n
+     * Connections with pipelined commands in flight are only picked when no
+     * other is idle, as using them collects their replies first.
+     * @return The connection, given back when the lease is destroyed.
+     * @see Connection
+     */
+    auto Acquire() -> Lease {
+        std::unique_lock<std::mutex> lock(pool_blocking);
+        while (true) {
+            Connection *busy = nullptr;
+            for (auto &c : connections) {
+                if (!c->blocking.try_lock())
+                    continue;
+                if (c->pipeline_count == 0) {
+                    if (busy)
+                        busy->blocking.unlock();
+                    return Lease(this, c.get());
+                }
+                if (busy)
+                    c->blocking.unlock();
+                else
+                    busy = c.get();
+            }
+            if (connections.size() < pool_size && transport_factory) {
+                if (busy)
+                    busy->blocking.unlock();
+                connections.emplace_back(new Connection(transport_factory()));
+                connections.back()->blocking.lock();
+                return Lease(this, connections.back().get());
+            }
+            if (busy)
+                return Lease(this, busy);
+            pool_waiters += 1;
+            pool_released.wait(lock);
+            pool_waiters -= 1;
+        }
+    }
+
+    /**
+     * Gives a connection back to the pool.
+     * @param conn The connection.
+     * @see Acquire
+     */
+    auto Release(Connection &conn) -> void {
+        std::vector<Completion> completed;
+        completed.swap(conn.completed);
+#ifdef __linux__
+        // the reactor collects the asynchronous commands left in front, unless
+        // their reply already got read along with a previous one
+        bool buffered = false;
+        if (reactor && conn.pipeline_count > 0 &&
+            conn.pipeline[conn.pipeline_head].done) {
+            int fd = conn.transport->Descriptor();
+            buffered = conn.transport->Buffered();
+            if (fd >= 0 && !buffered)
+                reactor->Arm(fd, &async_handler);
+        }
+#endif
+        conn.blocking.unlock();
+        {
+            std::lock_guard<std::mutex> lock(pool_blocking);
+            if (pool_waiters > 0)
+                pool_released.notify_one();
+        }
+#ifdef __linux__
+        if (conn.missed.exchange(false) || buffered)
+            Drain(&conn);
+#endif
+        for (auto &done : completed)
+            done.first(done.second);
+    }
+
+    /**
+     * Drops every command in flight on a connection. @n
+     * Asynchronous ones get completed with status once the connection is
+     * given back.
+     * @param c The connection, held.
+     * @param status The status to complete them with.
+     */
+    auto Abandon(Connection &c, IPCStatus status) -> void {
+        for (unsigned int i = 0; i < c.pipeline_count; i++) {
+            InFlight &p = c.pipeline[(c.pipeline_head + i) % c.pipeline.size()];
+            if (p.done)
+                c.completed.emplace_back(std::move(p.done), status);
+            p.done = nullptr;
+        }
+        c.pipeline_count = 0;
+        c.pipeline_bytes = 0;
+    }
+
+    /**
+     * Drops every connection, completing the asynchronous commands still in
+     * flight with NoConnection. @n
+     * Must not be called while other threads use this IPC session.
+     */
+    auto DropConnections() -> void {
+#ifdef __linux__
+        if (reactor && !connections.empty())
+            reactor->Forget(connections[0]->transport->Descriptor(),
+                            &async_handler);
+#endif
+        std::vector<Completion> completed;
+        for (auto &c : connections) {
+            Abandon(*c, NoConnection);
+            for (auto &done : c->completed)
+                completed.push_back(std::move(done));
+        }
+        connections.clear();
+        for (auto &done : completed)
+            done.first(done.second);
+    }
+
+    /**
+     * Acquires the connection used by Submit and friends, waiting for it if
+     * need be.
+     * @return The connection, given back when the lease is destroyed.
+     * @see Submit
+     */
+    auto PipelineConnection() -> Lease {
+        Connection *c;
+        {
+            std::lock_guard<std::mutex> lock(pool_blocking);
+            c = connections[0].get();
+        }
+        c->blocking.lock();
+        return Lease(this, c);
+    }
+
+    /**
+     * Formats an IPC buffer. @n
+     * Creates a new buffer with IPC opcode set and first address argument
+     * currently used for memory IPC commands.
+     * @param size The size of the array to allocate.
+     * @param address The address to put as an argument of the IPC command.
+     * @param command The IPC message tag(opcode).
+     * @param T false to make a full packet or true for a part of one, used for
+     * batch commands.
+     * @see IPCCommand
+     * @return The IPC buffer.
+     */
+    template <bool T = false>
+    auto FormatBeginning(char *cmd, uint32_t address, IPCCommand command,
+                         uint32_t size = 0) -> char * {
+        if constexpr (T) {
+            cmd[0] = (unsigned char)command;
+            return ToArray(cmd, address, 1);
+        } else {
+            ToArray(cmd, size, 0);
+            cmd[4] = (unsigned char)command;
+            return ToArray(cmd, address, 5);
+        }
+    }
+
+#if defined(C_FFI) || defined(DOXYGEN)
+    /**
+     * Error number. @n
+     * Result code of the last executed function. @n
+     * Used instead of exceptions on the C library bindings.
+     */
+    IPCStatus ipc_errno = Success;
+#endif
+
+    /**
+     * Sets the error code for the last operation. @n
+     * On C++, throws an exception, on C, sets the error code. @n
+     * @param err The error to set.
+     */
+    auto SetError(IPCStatus err) -> void {
+#ifdef C_FFI
+        ipc_errno = err;
+#else
+        throw err;
+#endif
+    }
+
+  public:
+#if defined(C_FFI) || defined(DOXYGEN)
+    /**
+     * Gets the last error code set. @n
+     * Only for C bindings.
+     */
+    auto GetError() -> IPCStatus {
+        IPCStatus copy = ipc_errno;
+        ipc_errno = Success;
+        return copy;
+    }
+#endif
+
+    /**
+     * Returns the reply of an IPC command. @n
+     * Throws an IPCStatus if there is no reply to read.
+     * @param cmd A char array containing the IPC return buffer OR a
+     * BatchCommand.
+     * @param place An integer specifying where the argument is
+     * in the buffer OR which function to read the reply of in
+     * the case of a BatchCommand.
+     * @return The reply, variable type. Refer to the documentation of the
+     * standard function. Ownership of datastreams is also passed down to you,
+     * so don't forget to read carefully the documentation and see if you need
+     * to free anything!
+     * @see IPCResult
+     * @see IPCBuffer
+     */
+    template <IPCCommand T, typename Y>
+    auto GetReply(const Y &cmd, int place) {
+        [[maybe_unused]] char *buf;
+        [[maybe_unused]] int loc;
+        if constexpr (std::is_same<Y, BatchCommand>::value) {
+            buf = cmd.ipc_return.buffer;
+            loc = cmd.reloc ? cmd.reply_locations[place]
+                            : cmd.return_locations[place];
+        } else {
+            buf = cmd;
+            loc = place;
+        }
+        if constexpr (T == MsgRead8)
+            return FromArray<uint8_t>(buf, loc);
+        else if constexpr (T == MsgRead16)
+            return FromArray<uint16_t>(buf, loc);
+        else if constexpr (T == MsgRead32)
+            return FromArray<uint32_t>(buf, loc);
+        else if constexpr (T == MsgRead64)
+            return FromArray<uint64_t>(buf, loc);
+        else if constexpr (T == MsgStatus)
+            return FromArray<EmuStatus>(buf, loc);
+        else if constexpr (T == MsgVersion || T == MsgID || T == MsgTitle ||
+                           T == MsgUUID || T == MsgGameVersion) {
+            uint32_t size = FromArray<uint32_t>(buf, loc);
+            char *datastream = new char[size];
+            memcpy(datastream, &buf[loc + 4], size);
+            return datastream;
+        } else if constexpr (T == MsgReadRange || T == MsgReadStrided ||
+                             T == MsgReadGather) {
+            // the memory read, its size being the one asked for
+            return (const char *)&buf[loc];
+        } else {
+            SetError(Unimplemented);
+            return;
+        }
+    }
+
+  protected:
+    /**
+     * Relocates the replies of a batch command once received. @n
+     * Batch commands are a bit more complex than you'd expect: some replies
+     * are VLE, so we need to relocate accordingly all future replies by an
+     * offset to ensure GetReply points to the correct buffer location. @n
+     * We can do it in an O(n) way by storing the global relocation offset
+     * and applying it to all future commands in one go instead of doing it
+     * in an O(n^2) and updating the list every time we encounter an offset
+     * update. @n
+     * Why not just assume a standard size instead of going through the pain
+     * of relocating everything in the protocol? math is cheap, io isn't. @n
+     * The relocated locations go to a table of their own, recomputed on every
+     * reply, so the batch command itself stays untouched and can be sent
+     * again as many times as needed. @n
+     * The reply gets stored in the batch command along the way, after the
+     * ones of the previous parts if the batch is split.
+     * @param cmd The batch command.
+     * @param part The part whose reply got received, 0 if not split.
+     * @param reply The reply.
+     * @param size The size of the reply.
+     */
+    auto Relocate(const BatchCommand &cmd, unsigned int part,
+                  const char *reply, int size) -> void {
+        if (!cmd.reloc)
+            return;
+        int base = (part == 0) ? 0 : cmd.ipc_return.size;
+        if (part == 0)
+            cmd.ipc_return.size = 0;
+        cmd.ReserveReturn(base + size);
+        memcpy(&cmd.ipc_return.buffer[base], reply, size);
+
+        unsigned int first = 0;
+        unsigned int count = cmd.msg_size;
+        if (!cmd.parts.empty()) {
+            first = cmd.parts[part].first;
+            count = cmd.parts[part].count;
+        }
+        unsigned int reloc_add = base;
+        for (unsigned int i = first; i < first + count; i++) {
+            unsigned int loc = cmd.return_locations[i];
+            cmd.reply_locations[i] = (loc & ~0x80000000) + reloc_add;
+            if ((loc & 0x80000000) != 0)
+                reloc_add += FromArray<uint32_t>(cmd.ipc_return.buffer,
+                                                 cmd.reply_locations[i]);
+        }
+    }
+
+    /**
+     * Where to receive the reply of a batch command. @n
+     * The size of a reply needing relocation is only known once received, so
+     * it goes through the scratch buffer of the connection first.
+     * @param c The connection, held.
+     * @param cmd The batch command.
+     * @param part The part of the batch command, if split.
+     * @return The buffer.
+     */
+    auto ReplyBuffer(Connection &c, const BatchCommand &cmd,
+                     unsigned int part = 0) -> IPCBuffer {
+        if (cmd.reloc)
+            return IPCBuffer{ MAX_IPC_RETURN_SIZE, c.ret_buffer };
+        if (!cmd.parts.empty())
+            return IPCBuffer{
+                cmd.parts[part].reply_size,
+                &cmd.ipc_return.buffer[cmd.parts[part].reply_offset]
+            };
+        return cmd.ipc_return;
+    }
+
+    /**
+     * Receives the reply of the oldest command of the pipeline.
+     * @param c The connection, held.
+     * @param report Whether to report an IPC_FAIL reply.
+     * @return false if the command failed.
+     * @see Submit
+     */
+    auto CollectOne(Connection &c, bool report) -> bool {
+        InFlight &p = c.pipeline[c.pipeline_head];
+        return Complete(c, c.transport->Receive(p.ret.buffer, p.ret.size),
+                        report);
+    }
+
+    /**
+     * Pops the oldest command of the pipeline, its reply received. @n
+     * Failures of asynchronous commands go to their completion instead of
+     * being reported.
+     * @param c The connection, held.
+     * @param receive_length The size of the reply, 0 if the connection was
+     * lost.
+     * @param report Whether to report a failure.
+     * @return false if the command failed.
+     * @see CollectOne
+     */
+    auto Complete(Connection &c, int receive_length, bool report) -> bool {
+        InFlight &p = c.pipeline[c.pipeline_head];
+        c.pipeline_head = (c.pipeline_head + 1) % c.pipeline.size();
+        c.pipeline_count -= 1;
+        c.pipeline_bytes -= p.bytes;
+#ifdef DEBUG
+        printf("pipelined reply received:\n");
+        hexdump(p.ret.buffer, receive_length);
+#endif
+        IPCStatus status = Success;
+        if (receive_length == 0)
+            status = Fail;
+        else if ((unsigned char)p.ret.buffer[4] == IPC_FAIL)
+            status = Fail;
+        else if (p.batch)
+            Relocate(*p.batch, p.part, p.ret.buffer, receive_length);
+
+        if (p.done) {
+            c.completed.emplace_back(std::move(p.done), status);
+            p.done = nullptr;
+            report = false;
+        }
+        if (receive_length == 0) {
+            // every reply still in flight is lost
+            c.transport->Close();
+            Abandon(c, Fail);
+        }
+        if (status != Success && report)
+            SetError(status);
+        return status == Success;
+    }
+
+    /**
+     * Sends an IPC message without waiting for its reply, queuing it in the
+     * pipeline. @n
+     * Collects the oldest commands first if the pipeline is full.
+     * @param c The connection, held.
+     * @param command The IPC message.
+     * @param p Where to receive its reply.
+     * @param report Whether to report the failure of the commands collected.
+     * @return false if the message could not be sent.
+     * @see Submit
+     */
+    auto Enqueue(Connection &c, const IPCBuffer &command, InFlight p,
+                 bool report) -> bool {
+        auto &transport = c.transport;
+        p.bytes = command.size + p.ret.size;
+
+        // backpressure
+        while (c.pipeline_count == c.pipeline.size() ||
+               (c.pipeline_count > 0 &&
+                c.pipeline_bytes + p.bytes > c.pipeline_window))
+            CollectOne(c, report);
+
+        if (c.pipeline_count == 0 && !transport->Connected())
+            transport->Connect();
+
+        if (!transport->Send(command.buffer, command.size)) {
+            transport->Close();
+            Abandon(c, NoConnection);
+            if (p.done)
+                c.completed.emplace_back(std::move(p.done), NoConnection);
+            return false;
+        }
+#ifdef DEBUG
+        printf("pipelined packet sent:\n");
+        hexdump(command.buffer, command.size);
+#endif
+
+        c.pipeline_bytes += p.bytes;
+        c.pipeline[(c.pipeline_head + c.pipeline_count) % c.pipeline.size()] =
+            std::move(p);
+        c.pipeline_count += 1;
+        c.pipeline_seq += 1;
+        return true;
+    }
+
+    /**
+     * Sends a batch command without waiting for its reply, queuing it in the
+     * pipeline, every part of it if it is split.
+     * @param c The connection, held.
+     * @param cmd The batch command.
+     * @param done Completion of an asynchronous batch command, if any, called
+     * once every part is completed.
+     * @param report Whether to report the failure of the commands collected.
+     * @return false if the batch command could not be sent.
+     * @see Enqueue
+     */
+    auto EnqueueBatch(Connection &c, const BatchCommand &cmd,
+                      std::function<void(IPCStatus)> done, bool report)
+        -> bool {
+        if (cmd.parts.empty())
+            return Enqueue(c, cmd.ipc_message,
+                           InFlight{ ReplyBuffer(c, cmd), &cmd, 0,
+                                     std::move(done) },
+                           report);
+
+        // the batch fails if any of its parts does
+        std::shared_ptr<IPCStatus> status;
+        if (done)
+            status = std::make_shared<IPCStatus>(Success);
+        unsigned int last = cmd.parts.size() - 1;
+        for (unsigned int i = 0; i <= last; i++) {
+            InFlight p{ ReplyBuffer(c, cmd, i), &cmd, 0, nullptr, i };
+            if (done && i < last)
+                p.done = [status](IPCStatus result) {
+                    if (result != Success)
+                        *status = result;
+                };
+            else if (done)
+                p.done = [status, done](IPCStatus result) {
+                    done(result != Success ? result : *status);
+                };
+            if (!Enqueue(c, cmd.Message(cmd.parts[i]), std::move(p), report)) {
+                // the last part would have completed the batch
+                if (done && i < last)
+                    c.completed.emplace_back(std::move(done), NoConnection);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Merges a single read with the ones other threads send at the same time
+     * into one batch. @n
+     * The first read to arrive waits for the others, up to the coalescing
+     * window or until there are enough of them, then sends the batch while
+     * the next read to arrive starts gathering the next one. Reads arriving
+     * while the next batch is full wait for it to leave. Every thread gets
+     * woken up with its own reply once the batch is sent.
+     * @param cmd The read, its reply set on success.
+     * @return false if the batch failed, in which case the read has to be
+     * sent on its own to know whether it is the one failing.
+     * @see SetCoalescing
+     */
+    auto Coalesce(Coalesced &cmd) -> bool {
+        std::unique_lock<std::mutex> lock(coalesce_blocking);
+        cmd.done = false;
+        coalesce_room.wait(lock, [&]() {
+            return coalesce_pending.size() < coalesce_max;
+        });
+        coalesce_pending.push_back(&cmd);
+        if (coalesce_leading) {
+            if (coalesce_pending.size() >= coalesce_max)
+                coalesce_full.notify_one();
+            coalesce_sent.wait(lock, [&]() { return cmd.done; });
+            return cmd.ok;
+        }
+
+        coalesce_leading = true;
+        coalesce_full.wait_for(lock, coalesce_window, [&]() {
+            return coalesce_pending.size() >= coalesce_max;
+        });
+        // swapped back and forth so neither ends up allocating
+        thread_local std::vector<Coalesced *> batch;
+        batch.clear();
+        batch.swap(coalesce_pending);
+        coalesce_leading = false;
+        coalesce_room.notify_all();
+        lock.unlock();
+
+        bool ok = SendCoalesced(batch);
+
+        lock.lock();
+        for (auto *c : batch) {
+            c->ok = ok;
+            c->done = true;
+        }
+        coalesce_sent.notify_all();
+        return cmd.ok;
+    }
+
+    /**
+     * Sends single reads as one batch.
+     * @param batch The reads.
+     * @return false if the batch failed.
+     * @see Coalesce
+     */
+    auto SendCoalesced(const std::vector<Coalesced *> &batch) -> bool {
+        thread_local std::vector<char> message;
+        message.resize(4);
+        int reply_size = 5;
+        for (auto *c : batch) {
+            message.insert(message.end(), c->message,
+                           c->message + sizeof(c->message));
+            reply_size += c->reply_size;
+        }
+        ToArray<uint32_t>(message.data(), message.size(), 0);
+
+        auto conn = Acquire();
+        int size = 0;
+        char *reply = nullptr;
+        try {
+            reply = Exchange(*conn, IPCBuffer{ (int)message.size(),
+                                               message.data() },
+                             conn->ret_buffer, size);
+        } catch (IPCStatus) {
+        }
+        if (size != reply_size)
+            return false;
+        int offset = 5;
+        for (auto *c : batch) {
+            memcpy(c->reply, &reply[offset], c->reply_size);
+            offset += c->reply_size;
+        }
+        return true;
+    }
+
+    /**
+     * Sends an IPC message and receives its reply. @n
+     * Fails if the IPC cannot be sent or if the emulator returns IPC_FAIL.
+     * Throws an IPCStatus on failure.
+     * @param c The connection to use, held.
+     * @param command The IPC message.
+     * @param buf Buffer to receive the reply into, if the transport cannot
+     * hand it over in place.
+     * @param size Set to the size of the reply, 0 on failure.
+     * @return The reply, either in buf or in place in the transport, valid
+     * as long as the connection is held.
+     * @see Transport::ReceiveInPlace
+     */
+    auto Exchange(Connection &c, const IPCBuffer &command, char *buf,
+                  int &size) -> char * {
+        size = 0;
+        auto &transport = c.transport;
+        // replies come back in order, so whatever is still in flight has to
+        // get out of the way first
+        while (c.pipeline_count > 0)
+            CollectOne(c, false);
+
+        if (!transport->Connected())
+            transport->Connect();
+
+        int receive_length;
+        char *reply = transport->SendReceive(command.buffer, command.size, buf,
+                                             MAX_IPC_RETURN_SIZE,
+                                             receive_length);
+        if (receive_length < 0) {
+            // if our write failed, assume the socket connection cannot be
+            // established
+            transport->Close();
+            SetError(NoConnection);
+            return buf;
+        }
+
+#ifdef DEBUG
+        printf("packet sent:\n");
+        hexdump(command.buffer, command.size);
+#endif
+#ifdef DEBUG
+        printf("reply received:\n");
+        hexdump(reply, receive_length);
+#endif
+        if (receive_length == 0) {
+            // we do not know where we are in the reply stream anymore, so
+            // let's start over with a new connection
+            transport->Close();
+            SetError(Fail);
+            return buf;
+        }
+
+        if ((unsigned char)reply[4] == IPC_FAIL) {
+            SetError(Fail);
+            return buf;
+        }
+        size = receive_length;
+        return reply;
+    }
+
+  public:
+    /**
+     * Sends an IPC command to the emulator. @n
+     * Fails if the IPC cannot be sent or if the emulator returns IPC_FAIL.
+     * Throws an IPCStatus on failure.
+     * @param cmd An IPCBuffer containing the IPC command size and buffer OR a
+     * BatchCommand.
+     * @param rt An IPCBuffer containing the IPC return size and buffer.
+     * @see IPCResult
+     * @see IPCBuffer
+     */
+    template <typename T>
+    auto SendCommand(const T &cmd, const T &rt = T()) -> void {
+        IPCBuffer command;
+        IPCBuffer ret;
+
+        auto conn = Acquire();
+        if constexpr (std::is_same<T, BatchCommand>::value) {
+            if (!cmd.parts.empty()) {
+                // the parts of a split batch go through the pipeline
+                Connection &c = *conn;
+                while (c.pipeline_count > 0)
+                    CollectOne(c, false);
+                if (!EnqueueBatch(c, cmd, nullptr, true)) {
+                    SetError(NoConnection);
+                    return;
+                }
+                bool ok = true;
+                while (c.pipeline_count > 0)
+                    ok = CollectOne(c, false) && ok;
+                if (!ok)
+                    SetError(Fail);
+                return;
+            }
+            command = cmd.ipc_message;
+            ret = ReplyBuffer(*conn, cmd);
+        } else {
+            command = cmd;
+            ret = rt;
+        }
+
+        int receive_length;
+        char *reply = Exchange(*conn, command, ret.buffer, receive_length);
+        if (receive_length == 0)
+            return;
+
+        if constexpr (std::is_same<T, BatchCommand>::value) {
+            if (cmd.reloc) {
+                Relocate(cmd, 0, reply, receive_length);
+                return;
+            }
+        }
+        if (reply != ret.buffer)
+            memcpy(ret.buffer, reply, receive_length);
+    }
+
+    /**
+     * Sends a batch whose layout is known at compile time and decodes its
+     * replies. @n
+     * On error throws an IPCStatus.
+     * @param batch The batch.
+     * @return A tuple of the replies of the commands returning something, in
+     * order.
+     * @see Batch
+     */
+    template <typename... C>
+    auto Send(const Batch<C...> &batch) -> typename Batch<C...>::Result {
+        typename Batch<C...>::Result result;
+        auto conn = Acquire();
+        int size;
+        char *reply =
+            Exchange(*conn, batch.Message(), conn->ret_buffer, size);
+        if (size != 0 && !batch.Decode(reply, size, result))
+            SetError(Fail);
+        return result;
+    }
+
+    /**
+     * Sends an IPC command to the emulator without waiting for its reply.
+     * @n Commands can be submitted back to back and their replies collected
+     * later, in order, with Collect or Flush, keeping the connection busy
+     * while you work on something else. @n
+     * Up to the pipeline depth can be in flight at once, as long as their
+     * messages and replies fit in the pipeline window; if not, the oldest
+     * command gets collected first, reporting its failure here. The first
+     * command always gets sent, whatever its size. @n
+     * Pipelined commands go through the first connection of the pool. Any
+     * other IPC command using it collects everything still in flight before
+     * executing, without reporting failures: check the reply buffers. @n
+     * Throws an IPCStatus on failure.
+     * @param cmd An IPCBuffer containing the IPC command size and buffer OR a
+     * BatchCommand, which has to stay alive until collected.
+     * @param rt An IPCBuffer containing the IPC return size and buffer, which
+     * has to stay alive until collected.
+     * @return The sequence number of the command, as returned by Collect,
+     * asynchronous commands taking up sequence numbers too. A split batch
+     * command takes up one per part, the last one being returned.
+     * @see SetPipelineDepth
+     * @see Collect
+     * @see Flush
+     */
+    template <typename T>
+    auto Submit(const T &cmd, const T &rt = T()) -> uint64_t {
+        auto conn = PipelineConnection();
+        Connection &c = *conn;
+        bool sent;
+        if constexpr (std::is_same<T, BatchCommand>::value)
+            sent = EnqueueBatch(c, cmd, nullptr, true);
+        else
+            sent = Enqueue(c, cmd, InFlight{ rt, nullptr, 0 }, true);
+        if (!sent) {
+            SetError(NoConnection);
+            return c.pipeline_seq;
+        }
+        return c.pipeline_seq - 1;
+    }
+
+    /**
+     * Receives the reply of the oldest command in flight. @n
+     * Throws an IPCStatus if that command failed or if there is nothing in
+     * flight.
+     * @return The sequence number of the command.
+     * @see Submit
+     */
+    auto Collect() -> uint64_t {
+        auto conn = PipelineConnection();
+        Connection &c = *conn;
+        if (c.pipeline_count == 0) {
+            SetError(Unknown);
+            return c.pipeline_seq;
+        }
+        uint64_t seq = c.pipeline_seq - c.pipeline_count;
+        CollectOne(c, true);
+        return seq;
+    }
+
+    /**
+     * Receives the replies of every command in flight. @n
+     * Throws an IPCStatus if any of them failed, once they have all been
+     * collected.
+     * @see Submit
+     */
+    auto Flush() -> void {
+        auto conn = PipelineConnection();
+        Connection &c = *conn;
+        bool ok = true;
+        while (c.pipeline_count > 0)
+            ok = CollectOne(c, false) && ok;
+        if (!ok)
+            SetError(Fail);
+    }
+
+    /**
+     * Number of commands in flight.
+     * @see Submit
+     */
+    auto Pending() -> unsigned int {
+        return PipelineConnection()->pipeline_count;
+    }
+
+    /**
+     * Sets how many commands Submit keeps in flight. @n
+     * Collects everything in flight first.
+     * @param depth Maximum number of commands in flight, at least 1.
+     * @param window Maximum size of their messages and replies. Raise it
+     * along with the socket buffer sizes, or both ends can end up waiting on
+     * each other.
+     * @see Submit
+     * @see PIPELINE_DEPTH
+     * @see PIPELINE_WINDOW
+     */
+    auto SetPipelineDepth(unsigned int depth,
+                          unsigned int window = PIPELINE_WINDOW) -> void {
+        Flush();
+        auto conn = PipelineConnection();
+        Connection &c = *conn;
+        c.pipeline.resize(std::max(depth, 1u));
+        c.pipeline_head = 0;
+        c.pipeline_window = window;
+    }
+
+#if defined(__linux__) || defined(DOXYGEN)
+    /**
+     * Sets the reactor collecting the replies of asynchronous commands. @n
+     * Must be called before sending any of them, and the reactor must
+     * outlive this IPC session. Defaults to Reactor::Default(). @n
+     * Linux only.
+     * @param r The reactor.
+     * @see Reactor
+     */
+    auto SetReactor(Reactor *r) -> void {
+        auto conn = PipelineConnection();
+        reactor = r;
+    }
+#endif
+
+  protected:
+    /**
+     * Sends an asynchronous IPC command. @n
+     * Asynchronous commands go through the pipeline, whose replies the
+     * reactor collects as they arrive. Without a reactor, or with a
+     * transport it cannot wait on, they are collected right away.
+     * @param command The IPC message.
+     * @param ret Where to receive the reply, alive until completed.
+     * @param batch Batch command to send instead, if any.
+     * @param done Completion, called with the status of the command.
+     * @see Reactor
+     */
+    auto SubmitAsync(const IPCBuffer &command, const IPCBuffer &ret,
+                     const BatchCommand *batch,
+                     std::function<void(IPCStatus)> done) -> void {
+        auto conn = PipelineConnection();
+        Connection &c = *conn;
+        bool wait = true;
+#ifdef __linux__
+        if (!reactor)
+            reactor = &Reactor::Default();
+        wait = c.transport->Descriptor() < 0;
+#endif
+        bool sent =
+            batch ? EnqueueBatch(c, *batch, std::move(done), false)
+                  : Enqueue(c, command, InFlight{ ret, nullptr, 0,
+                                                  std::move(done) },
+                            false);
+        if (sent && wait) {
+            while (c.pipeline_count > 0)
+                CollectOne(c, false);
+        }
+    }
+
+    /**
+     * Settles a promise according to the status of an IPC command.
+     * @param promise The promise.
+     * @param status The status of the IPC command, set as the exception of
+     * the promise on failure.
+     * @param value The value of the promise, if any.
+     */
+    template <typename Y, typename... V>
+    static auto Settle(std::promise<Y> &promise, IPCStatus status,
+                       V... value) -> void {
+        if (status != Success)
+            promise.set_exception(std::make_exception_ptr(status));
+        else
+            promise.set_value(value...);
+    }
+
+  public:
+    /**
+     * Reads a value from the emulator's memory without waiting for it. @n
+     * The IPC message is sent right away and callback gets called with the
+     * value read once its reply arrives, on the reactor thread or on a
+     * thread that had to collect it first, eg one sending a blocking IPC
+     * command. Callbacks must neither throw nor take long, as they hold up
+     * every IPC session of the reactor. @n
+     * Asynchronous commands go through the pipeline, so they only wait when
+     * it is full. @n
+     * On error callback gets the IPCStatus along with a zero value.
+     * @see Read
+     * @see Reactor
+     * @param address The address to read.
+     * @param callback Called with the status of the read and the value read.
+     * @param Y The type of the variable to read (eg uint8_t).
+     */
+    template <typename Y>
+    auto ReadAsync(uint32_t address,
+                   std::function<void(IPCStatus, Y)> callback) -> void {
+        constexpr IPCCommand tag = []() -> IPCCommand {
+            switch (sizeof(Y)) {
+                case 1:
+                    return MsgRead8;
+                case 2:
+                    return MsgRead16;
+                case 4:
+                    return MsgRead32;
+                case 8:
+                    return MsgRead64;
+                default:
+                    return MsgUnimplemented;
+            }
+        }();
+        if constexpr (tag == MsgUnimplemented) {
+            SetError(Unimplemented);
+            return;
+        }
+
+        char cmd[4 + 5];
+        FormatBeginning(cmd, address, tag, 4 + 5);
+        std::shared_ptr<char[]> reply(new char[5 + sizeof(Y)]);
+        SubmitAsync(IPCBuffer{ 4 + 5, cmd },
+                    IPCBuffer{ (int)(5 + sizeof(Y)), reply.get() }, nullptr,
+                    [reply, callback](IPCStatus status) {
+                        callback(status, status == Success
+                                             ? FromArray<Y>(reply.get(), 5)
+                                             : Y());
+                    });
+    }
+
+    /**
+     * Reads a value from the emulator's memory without waiting for it.
+     * @param address The address to read.
+     * @param Y The type of the variable to read (eg uint8_t).
+     * @return The value read, or the IPCStatus thrown on error.
+     * @see ReadAsync
+     */
+    template <typename Y>
+    auto ReadAsync(uint32_t address) -> std::future<Y> {
+        auto promise = std::make_shared<std::promise<Y>>();
+        ReadAsync<Y>(address, [promise](IPCStatus status, Y value) {
+            Settle(*promise, status, value);
+        });
+        return promise->get_future();
+    }
+
+    /**
+     * Writes a value to the emulator's memory without waiting for it.
+     * @param address The address to write to.
+     * @param value The value to write.
+     * @param callback Called with the status of the write.
+     * @param Y The type of the variable to write (eg uint8_t).
+     * @see Write
+     * @see ReadAsync
+     */
+    template <typename Y>
+    auto WriteAsync(uint32_t address, Y value,
+                    std::function<void(IPCStatus)> callback) -> void {
+        constexpr IPCCommand tag = []() -> IPCCommand {
+            switch (sizeof(Y)) {
+                case 1:
+                    return MsgWrite8;
+                case 2:
+                    return MsgWrite16;
+                case 4:
+                    return MsgWrite32;
+                case 8:
+                    return MsgWrite64;
+                default:
+                    return MsgUnimplemented;
+            }
+        }();
+        if constexpr (tag == MsgUnimplemented) {
+            SetError(Unimplemented);
+            return;
+        }
+
+        bool cached = cache_enabled;
+        if (cached)
+            CacheInvalidate(address, sizeof(Y));
+        int size = 4 + 5 + sizeof(Y);
+        char cmd[4 + 5 + sizeof(Y)];
+        ToArray(FormatBeginning(cmd, address, tag, size), value, 4 + 5);
+        std::shared_ptr<char[]> reply(new char[5]);
+        SubmitAsync(IPCBuffer{ size, cmd }, IPCBuffer{ 5, reply.get() },
+                    nullptr,
+                    [this, reply, callback, address,
+                     cached](IPCStatus status) {
+                        if (cached)
+                            CacheInvalidate(address, sizeof(Y));
+                        callback(status);
+                    });
+    }
+
+    /**
+     * Writes a value to the emulator's memory without waiting for it.
+     * @param address The address to write to.
+     * @param value The value to write.
+     * @param Y The type of the variable to write (eg uint8_t).
+     * @return Ready once written, or the IPCStatus thrown on error.
+     * @see WriteAsync
+     */
+    template <typename Y>
+    auto WriteAsync(uint32_t address, Y value) -> std::future<void> {
+        auto promise = std::make_shared<std::promise<void>>();
+        WriteAsync<Y>(address, value, [promise](IPCStatus status) {
+            Settle(*promise, status);
+        });
+        return promise->get_future();
+    }
+
+    /**
+     * Retrieves the emulator status without waiting for it.
+     * @param callback Called with the status of the IPC command and the
+     * emulator status.
+     * @see Status
+     * @see ReadAsync
+     */
+    auto StatusAsync(std::function<void(IPCStatus, EmuStatus)> callback)
+        -> void {
+        char cmd[4 + 1];
+        ToArray(cmd, 4 + 1, 0);
+        cmd[4] = MsgStatus;
+        std::shared_ptr<char[]> reply(new char[5 + 4]);
+        SubmitAsync(IPCBuffer{ 4 + 1, cmd }, IPCBuffer{ 5 + 4, reply.get() },
+                    nullptr, [reply, callback](IPCStatus status) {
+                        callback(status,
+                                 status == Success
+                                     ? FromArray<EmuStatus>(reply.get(), 5)
+                                     : Running);
+                    });
+    }
+
+    /**
+     * Retrieves the emulator status without waiting for it.
+     * @return The emulator status, or the IPCStatus thrown on error.
+     * @see StatusAsync
+     */
+    auto StatusAsync() -> std::future<EmuStatus> {
+        auto promise = std::make_shared<std::promise<EmuStatus>>();
+        StatusAsync([promise](IPCStatus status, EmuStatus value) {
+            Settle(*promise, status, value);
+        });
+        return promise->get_future();
+    }
+
+    /**
+     * Sends a batch command without waiting for its reply. @n
+     * Use it for the IPC commands without an asynchronous flavor, eg
+     * strings, read with GetReply once completed.
+     * @param cmd The batch command, which has to stay alive until
+     * completed.
+     * @param callback Called with the status of the batch command.
+     * @see SendCommand
+     * @see ReadAsync
+     */
+    auto SendAsync(BatchCommand &cmd, std::function<void(IPCStatus)> callback)
+        -> void {
+        SubmitAsync(cmd.ipc_message, cmd.ipc_return, &cmd, callback);
+    }
+
+    /**
+     * Sends a batch command without waiting for its reply.
+     * @param cmd The batch command, which has to stay alive until
+     * completed.
+     * @return Ready once completed, or the IPCStatus thrown on error.
+     * @see SendAsync
+     */
+    auto SendAsync(BatchCommand &cmd) -> std::future<void> {
+        auto promise = std::make_shared<std::promise<void>>();
+        SendAsync(cmd,
+                  [promise](IPCStatus status) { Settle(*promise, status); });
+        return promise->get_future();
+    }
+
+    /**
+     * Initializes a batch command IPC message.  @n
+     * Batch IPC messages are preferred when dealing with a lot of IPC
+     * messages in a quick fashion. They are _very_ fast, 1000
+     * Write<uint8_t> are as fast as one Read<uint32_t> in non-batch mode,
+     * give or take, which is about 100µs. @n You'll have to build the IPC
+     * messages in advance, with this function and FinalizeBatch, and will
+     * have to send the command yourself, along with dealing with the
+     * extraction of return values, if need there is. It is a little bit
+     * less convenient than the standard IPC but has, at the very least, a
+     * 1000x speedup on big commands. @n
+     * Building a batch does not hold any connection, other threads keep
+     * sending their IPC messages in the meantime, but only one thread at a
+     * time builds a batch this way: threads building batches concurrently
+     * should have a BatchBuilder each. @n
+     * A batch can only be so big, past MAX_IPC_SIZE, MAX_IPC_RETURN_SIZE or
+     * MAX_BATCH_REPLY_COUNT adding commands fails with OutOfMemory, unless it
+     * gets split: it then goes on in a new IPC message, sent right after the
+     * previous one. GetReply keeps counting the commands from the start of
+     * the batch. The IPC messages of a split batch are not executed
+     * atomically, and they go through the pipeline, so the replies of one
+     * are read while the next one is sent as long as they fit in the
+     * pipeline window.
+     * @param split Whether to split the batch if too big.
+     * @see batch_blocking
+     * @see BatchBuilder
+     * @see FinalizeBatch
+     * @see SetPipelineDepth
+     */
+    auto InitializeBatch(bool split = false) -> void {
+        batch_blocking.lock();
+        batch_builder.Initialize(split);
+    }
+
+    /**
+     * Finalizes a batch command IPC message. @n
+     * WARNING: You will ALWAYS have to call a FinalizeBatch, even on
+     * exceptions, once an InitializeBatch has been called overthise the
+     * class will deadlock.
+     * @return A BatchCommand with:
+     *         * The IPCBuffer of the message.
+     *         * The IPCBuffer of the return.
+     *         * The argument location in the reply buffer.
+     * @see batch_blocking
+     * @see BatchBuilder
+     * @see InitializeBatch
+     * @param optimize Whether to optimize the batch, see
+     * FinalizeBatch(BatchCommand &, bool).
+     * @see IPCBuffer
+     * @see BatchCommand
+     */
+    auto FinalizeBatch(bool optimize = false) -> BatchCommand {
+        BatchCommand cmd;
+        FinalizeBatch(cmd, optimize);
+        return cmd;
+    }
+
+    /**
+     * Finalizes a batch command IPC message into an existing BatchCommand.
+     * @n Its buffers get reused when big enough, so a batch rebuilt every
+     * frame into the same BatchCommand stops allocating after the first
+     * one. @n
+     * An optimized batch drops duplicate reads, merges narrow reads of
+     * neighbouring addresses into wider ones and drops writes overwritten
+     * before being read, without moving a read past a write to it. GetReply
+     * keeps its indices; the arguments of dropped writes have no reply. @n
+     * WARNING: You will ALWAYS have to call a FinalizeBatch, even on
+     * exceptions, once an InitializeBatch has been called overthise the
+     * class will deadlock.
+     * @param cmd The BatchCommand to overwrite, neither in flight nor
+     * being sent.
+     * @param optimize Whether to optimize the batch, unless it has
+     * placeholders.
+     * @see FinalizeBatch
+     * @see OptimizeBatch
+     */
+    auto FinalizeBatch(BatchCommand &cmd, bool optimize = false) -> void {
+        batch_builder.Finalize(cmd, optimize);
+        // we unblock the mutex
+        batch_blocking.unlock();
+    }
+
+    /**
+     * Placeholder for the address of a read or write of the batch being
+     * built. @n
+     * Once finalized, the batch can be bound to new addresses and sent again
+     * without being rebuilt, eg to follow a pointer changing every frame.
+     * A batch with placeholders is never optimized.
+     * @param cmd The command, as returned by Read or Write in batch mode,
+     * before another one gets added.
+     * @return The placeholder.
+     * @see BatchCommand::Bind
+     * @see ValueSlot
+     */
+    auto AddressSlot(const char *cmd) -> BatchCommand::Slot<uint32_t> {
+        return batch_builder.AddressSlot(cmd);
+    }
+
+    /**
+     * Placeholder for the value of a write of the batch being built.
+     * @param cmd The command, as returned by Write in batch mode, before
+     * another one gets added.
+     * @param Y The type of the value written.
+     * @return The placeholder.
+     * @see BatchCommand::Bind
+     * @see AddressSlot
+     */
+    template <typename Y>
+    auto ValueSlot(const char *cmd) -> BatchCommand::Slot<Y> {
+        return batch_builder.template ValueSlot<Y>(cmd);
+    }
+
+    /**
+     * Reads a value from the emulator's memory. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY YY YY YY @n
+     * Legend: XX = IPC Tag, YY = Address. @n
+     * Return: (ZZ*??) @n
+     * Legend: ZZ = Value read.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @see GetReply
+     * @param address The address to read.
+     * @param T Flag to enable batch processing or not.
+     * @param Y The type of the variable to read (eg uint8_t).
+     * @return The value read in memory. If in batch mode the IPC message.
+     */
+    template <typename Y, bool T = false>
+    auto Read(uint32_t address) {
+
+        // easiest way to get tag into a constexpr is a lambda, necessary
+        // for GetReply
+        constexpr IPCCommand tag = []() -> IPCCommand {
+            switch (sizeof(Y)) {
+                case 1:
+                    return MsgRead8;
+                case 2:
+                    return MsgRead16;
+                case 4:
+                    return MsgRead32;
+                case 8:
+                    return MsgRead64;
+                default:
+                    return MsgUnimplemented;
+            }
+        }();
+        if constexpr (tag == MsgUnimplemented) {
+            SetError(Unimplemented);
+            return;
+        }
+
+        // batch mode
+        if constexpr (T) {
+            char *cmd = batch_builder.Read<Y>(address);
+            if (cmd == nullptr)
+                SetError(OutOfMemory);
+            return cmd;
+        } else {
+            uint64_t epoch = 0;
+            bool cached = cache_enabled;
+            if (cached) {
+                char value[8];
+                if (CacheLookup(address, sizeof(Y), value, epoch))
+                    return GetReply<tag>((char *)value, 0);
+            }
+            if (coalesce_window.count() > 0) {
+                Coalesced cmd;
+                FormatBeginning<true>(cmd.message, address, tag);
+                cmd.reply_size = sizeof(Y);
+                if (Coalesce(cmd)) {
+                    if (cached)
+                        CacheStore(address, sizeof(Y), cmd.reply, epoch);
+                    return GetReply<tag>((char *)cmd.reply, 0);
+                }
+            }
+            // any idle connection will do
+            auto conn = Acquire();
+            IPCBuffer cmd = IPCBuffer{
+                4 + 5, FormatBeginning(conn->ipc_buffer, address, tag, 4 + 5)
+            };
+            int size;
+            char *reply = Exchange(*conn, cmd, conn->ret_buffer, size);
+            if (cached)
+                CacheStore(address, sizeof(Y), &reply[5], epoch);
+            return GetReply<tag>(reply, 5);
+        }
+    }
+
+    /**
+     * Writes a value to the emulator's game memory. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY YY YY YY (ZZ*??) @n
+     * Legend: XX = IPC Tag, YY = Address, ZZ = Value.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param address The address to write to.
+     * @param value The value to write.
+     * @param T Flag to enable batch processing or not.
+     * @param Y The type of the variable to write (eg uint8_t).
+     * @return If in batch mode the IPC message otherwise void.
+     */
+    template <typename Y, bool T = false>
+    auto Write(uint32_t address, Y value) {
+
+        // easiest way to get tag into a constexpr is a lambda, necessary
+        // for GetReply
+        constexpr IPCCommand tag = []() -> IPCCommand {
+            switch (sizeof(Y)) {
+                case 1:
+                    return MsgWrite8;
+                case 2:
+                    return MsgWrite16;
+                case 4:
+                    return MsgWrite32;
+                case 8:
+                    return MsgWrite64;
+                default:
+                    return MsgUnimplemented;
+            }
+        }();
+        if constexpr (tag == MsgUnimplemented) {
+            SetError(Unimplemented);
+            return;
+        }
+
+        // batch mode
+        if constexpr (T) {
+            char *cmd = batch_builder.Write<Y>(address, value);
+            if (cmd == nullptr)
+                SetError(OutOfMemory);
+            return cmd;
+        } else {
+            // written through the read cache, once written
+            uint64_t epoch = 0;
+            bool cached = cache_enabled;
+            if (cached)
+                epoch = CacheInvalidate(address, sizeof(Y));
+            // any idle connection will do
+            auto conn = Acquire();
+            int size = 4 + 5 + sizeof(Y);
+            char *cmd = ToArray(
+                FormatBeginning(conn->ipc_buffer, address, tag, size), value,
+                4 + 5);
+            int reply_size;
+            Exchange(*conn, IPCBuffer{ size, cmd }, conn->ret_buffer,
+                     reply_size);
+            if (cached)
+                CacheStore(address, sizeof(Y), &cmd[4 + 5], epoch, true);
+            return;
+        }
+    }
+
+  protected:
+    /**
+     * Whether the server knows about range commands: 1 if it does, 0 if it
+     * does not, -1 until probed.
+     * @see Supports
+     */
+    std::atomic<int> range_support{ -1 };
+
+    /**
+     * Whether the server knows about gather commands, like range_support.
+     * @see Supports
+     */
+    std::atomic<int> gather_support{ -1 };
+
+    /**
+     * Whether the server knows about pointer paths, like range_support.
+     * @see Supports
+     */
+    std::atomic<int> pointer_support{ -1 };
+
+    /**
+     * Probes the server for an optional command, once. @n
+     * The command is sent with all of its arguments zeroed, which moves
+     * nothing and is valid whatever the address, so only a server not
+     * knowing about the command fails it.
+     * @param command The command to probe.
+     * @param args Size of the arguments of the command.
+     * @param support Where to remember the answer.
+     * @return Whether the server knows about the command.
+     * @see ReadRange
+     * @see ReadStrided
+     */
+    auto Supports(IPCCommand command, uint32_t args, std::atomic<int> &support)
+        -> bool {
+        if (support >= 0)
+            return support == 1;
+        IPCStatus status = Success;
+        try {
+            auto conn = Acquire();
+            char *cmd = conn->ipc_buffer;
+            ToArray<uint32_t>(cmd, 4 + 1 + args, 0);
+            cmd[4] = command;
+            memset(&cmd[5], 0, args);
+            int size;
+            Exchange(*conn, IPCBuffer{ (int)(4 + 1 + args), cmd },
+                     conn->ret_buffer, size);
+        } catch (IPCStatus err) {
+            status = err;
+        }
+#ifdef C_FFI
+        status = GetError();
+#endif
+        if (status != Success && status != Fail) {
+            // we know nothing more than before
+            SetError(status);
+            return false;
+        }
+        support = (status == Success) ? 1 : 0;
+        return support == 1;
+    }
+
+    /**
+     * A batch built and sent on the calling thread by the commands spanning
+     * a whole batch, reusing the same buffers from one call to the other.
+     * @see ReadRange
+     */
+    struct ThreadBatch {
+        BatchBuilder builder;
+        BatchCommand batch;
+    };
+
+    /**
+     * Gets the batch of the calling thread.
+     * @return The batch, shared by every IPC session.
+     * @see ThreadBatch
+     */
+    static auto LocalBatch() -> ThreadBatch & {
+        thread_local ThreadBatch local;
+        return local;
+    }
+
+    /**
+     * Sends a batch of gathers, or of reads standing in for them, and copies
+     * out the values read.
+     * @param batch The batch, each of its commands reading chunk values.
+     * @param dst Where to store the values.
+     * @param count Number of values.
+     * @param chunk Number of values per command, the last one excepted.
+     * @see ReadStrided
+     */
+    template <typename Y>
+    auto Gathered(BatchCommand &batch, Y *dst, uint32_t count, uint32_t chunk)
+        -> void {
+        SendCommand(batch);
+#ifdef C_FFI
+        if (ipc_errno != Success)
+            return;
+#endif
+        for (unsigned int arg = 0; arg < batch.msg_size; arg++) {
+            uint32_t n = std::min(count - arg * chunk, chunk);
+            // a read replies with its raw memory, like a gather
+            memcpy(&dst[arg * chunk], GetReply<MsgReadGather>(batch, arg),
+                   n * sizeof(Y));
+        }
+    }
+
+  public:
+    /**
+     * Reads a range of the emulator's memory. @n
+     * On error throws an IPCStatus. @n
+     * Moves the whole range in as few IPC messages as possible with range
+     * commands, and falls back to a batch of 64 bit reads on servers not
+     * knowing about them. Either way the range is not read atomically if
+     * it needs more than one IPC message.
+     * @param address The address to read from.
+     * @param size Size of the range.
+     * @param dst Where to store the memory read, of size bytes.
+     * @see WriteRange
+     * @see MAX_RANGE_SIZE
+     */
+    auto ReadRange(uint32_t address, uint32_t size, void *dst) -> void {
+        if (size == 0)
+            return;
+        auto &[builder, batch] = LocalBatch();
+        bool ranges = Supports(MsgReadRange, 8, range_support);
+        builder.Initialize(true);
+        uint32_t i = 0;
+        if (ranges) {
+            for (; i < size; i += MAX_RANGE_SIZE)
+                builder.ReadRange(address + i,
+                                  std::min<uint32_t>(size - i, MAX_RANGE_SIZE));
+        } else {
+            // aligned 64 bit reads, with the bytes around them
+            for (; i < size && (address + i) % 8 != 0; i++)
+                builder.Read<uint8_t>(address + i);
+            for (; i + 8 <= size; i += 8)
+                builder.Read<uint64_t>(address + i);
+            for (; i < size; i++)
+                builder.Read<uint8_t>(address + i);
+        }
+        builder.Finalize(batch);
+        SendCommand(batch);
+#ifdef C_FFI
+        if (ipc_errno != Success)
+            return;
+#endif
+
+        char *out = (char *)dst;
+        i = 0;
+        for (unsigned int arg = 0; arg < batch.msg_size; arg++) {
+            uint32_t width = 1;
+            if (ranges)
+                width = std::min<uint32_t>(size - i, MAX_RANGE_SIZE);
+            else if ((address + i) % 8 == 0 && i + 8 <= size)
+                width = 8;
+            memcpy(&out[i], GetReply<MsgReadRange>(batch, arg), width);
+            i += width;
+        }
+    }
+
+    /**
+     * Batch flavour of ReadRange, reading at most MAX_RANGE_SIZE bytes. @n
+     * Only for servers knowing about range commands, GetReply of
+     * MsgReadRange then returns the memory read. @n
+     * On error throws an IPCStatus.
+     * @param address The address to read from.
+     * @param size Size of the range.
+     * @param T Flag to enable batch processing, must be set.
+     * @return The IPC message.
+     */
+    template <bool T>
+    auto ReadRange(uint32_t address, uint32_t size) -> char * {
+        static_assert(T, "use ReadRange(address, size, dst) instead");
+        char *cmd = batch_builder.ReadRange(address, size);
+        if (cmd == nullptr)
+            SetError(OutOfMemory);
+        return cmd;
+    }
+
+    /**
+     * Writes a range of the emulator's memory. @n
+     * On error throws an IPCStatus. @n
+     * Falls back to a batch of 64 bit writes on servers not knowing about
+     * range commands, like ReadRange.
+     * @param address The address to write to.
+     * @param src The memory to write, of size bytes.
+     * @param size Size of the range.
+     * @see ReadRange
+     * @see MAX_RANGE_SIZE
+     */
+    auto WriteRange(uint32_t address, const void *src, uint32_t size)
+        -> void {
+        if (size == 0)
+            return;
+        auto &[builder, batch] = LocalBatch();
+        const char *in = (const char *)src;
+        bool ranges = Supports(MsgReadRange, 8, range_support);
+        bool cached = cache_enabled;
+        if (cached)
+            CacheInvalidate(address, size);
+        builder.Initialize(true);
+        uint32_t i = 0;
+        if (ranges) {
+            for (; i < size; i += MAX_RANGE_SIZE)
+                builder.WriteRange(
+                    address + i, &in[i],
+                    std::min<uint32_t>(size - i, MAX_RANGE_SIZE));
+        } else {
+            for (; i < size && (address + i) % 8 != 0; i++)
+                builder.Write<uint8_t>(address + i, in[i]);
+            for (; i + 8 <= size; i += 8)
+                builder.Write<uint64_t>(address + i,
+                                        FromArray<uint64_t>((char *)in, i));
+            for (; i < size; i++)
+                builder.Write<uint8_t>(address + i, in[i]);
+        }
+        builder.Finalize(batch);
+        SendCommand(batch);
+        if (cached)
+            CacheInvalidate(address, size);
+    }
+
+    /**
+     * Batch flavour of WriteRange, writing at most MAX_RANGE_SIZE bytes,
+     * only for servers knowing about range commands. @n
+     * On error throws an IPCStatus.
+     * @param address The address to write to.
+     * @param src The memory to write, of size bytes.
+     * @param size Size of the range.
+     * @param T Flag to enable batch processing, must be set.
+     * @return The IPC message.
+     */
+    template <bool T>
+    auto WriteRange(uint32_t address, const void *src, uint32_t size)
+        -> char * {
+        static_assert(T, "use WriteRange(address, src, size) instead");
+        char *cmd = batch_builder.WriteRange(address, src, size);
+        if (cmd == nullptr)
+            SetError(OutOfMemory);
+        return cmd;
+    }
+
+    /**
+     * Gathers values evenly spaced in the emulator's memory, like one field
+     * of every element of an array of structures. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX AA AA AA AA SS SS SS SS CC CC CC CC WW @n
+     * Legend: XX = IPC Tag, AA = address of the first value, SS = stride,
+     * CC = count, WW = width of a value in bytes. @n
+     * Return: (ZZ*CC*WW) @n
+     * Legend: ZZ = the values, packed. @n
+     * Falls back to a batch of reads on servers not knowing about gather
+     * commands.
+     * @param address The address of the first value.
+     * @param stride Distance between two values.
+     * @param count Number of values.
+     * @param dst Where to store the values, count of them.
+     * @param Y The type of the values.
+     * @see ReadGather
+     * @see MAX_RANGE_SIZE
+     */
+    template <typename Y>
+    auto ReadStrided(uint32_t address, uint32_t stride, uint32_t count,
+                     Y *dst) -> void {
+        if (count == 0)
+            return;
+        // values past the top of memory do not wrap around to its bottom
+        if (address + (uint64_t)stride * (count - 1) > 0xFFFFFFFF) {
+            SetError(OutOfMemory);
+            return;
+        }
+        auto &[builder, batch] = LocalBatch();
+        bool gathers = Supports(MsgReadStrided, 13, gather_support);
+        uint32_t chunk = gathers ? MAX_RANGE_SIZE / sizeof(Y) : 1;
+        builder.Initialize(true);
+        for (uint32_t i = 0; i < count; i += chunk) {
+            uint32_t at = (uint32_t)(address + (uint64_t)stride * i);
+            if (gathers)
+                builder.ReadStrided<Y>(at, stride, std::min(count - i, chunk));
+            else
+                builder.Read<Y>(at);
+        }
+        builder.Finalize(batch);
+        Gathered(batch, dst, count, chunk);
+    }
+
+    /**
+     * Gathers values evenly spaced in the emulator's memory. @n
+     * On error throws an IPCStatus.
+     * @param address The address of the first value.
+     * @param stride Distance between two values.
+     * @param count Number of values.
+     * @param Y The type of the values.
+     * @return The values.
+     * @see ReadStrided
+     */
+    template <typename Y>
+    auto ReadStrided(uint32_t address, uint32_t stride, uint32_t count)
+        -> std::vector<Y> {
+        std::vector<Y> values(count);
+        ReadStrided(address, stride, count, values.data());
+        return values;
+    }
+
+    /**
+     * Batch flavour of ReadStrided, gathering at most MAX_RANGE_SIZE bytes.
+     * @n
+     * Only for servers knowing about gather commands, GetReply of
+     * MsgReadStrided then returns the values read. @n
+     * On error throws an IPCStatus.
+     * @param address The address of the first value.
+     * @param stride Distance between two values.
+     * @param count Number of values.
+     * @param Y The type of the values.
+     * @param T Flag to enable batch processing, must be set.
+     * @return The IPC message.
+     */
+    template <typename Y, bool T>
+    auto ReadStrided(uint32_t address, uint32_t stride, uint32_t count)
+        -> char * {
+        static_assert(T, "use ReadStrided(address, stride, count) instead");
+        char *cmd = batch_builder.ReadStrided<Y>(address, stride, count);
+        if (cmd == nullptr)
+            SetError(OutOfMemory);
+        return cmd;
+    }
+
+    /**
+     * Gathers the values at a list of addresses of the emulator's memory.
+     * @n
+     * On error throws an IPCStatus. @n
+     * Format: XX WW CC CC CC CC (AA AA AA AA*CC) @n
+     * Legend: XX = IPC Tag, WW = width of a value in bytes, CC = count,
+     * AA = addresses. @n
+     * Return: (ZZ*CC*WW) @n
+     * Legend: ZZ = the values, packed. @n
+     * Falls back to a batch of reads on servers not knowing about gather
+     * commands.
+     * @param addresses The addresses of the values.
+     * @param count Number of values.
+     * @param dst Where to store the values, count of them.
+     * @param Y The type of the values.
+     * @see ReadStrided
+     * @see MAX_RANGE_SIZE
+     */
+    template <typename Y>
+    auto ReadGather(const uint32_t *addresses, uint32_t count, Y *dst)
+        -> void {
+        if (count == 0)
+            return;
+        auto &[builder, batch] = LocalBatch();
+        bool gathers = Supports(MsgReadStrided, 13, gather_support);
+        uint32_t chunk =
+            gathers ? MAX_RANGE_SIZE / std::max<uint32_t>(sizeof(Y), 4) : 1;
+        builder.Initialize(true);
+        for (uint32_t i = 0; i < count; i += chunk) {
+            if (gathers)
+                builder.ReadGather<Y>(&addresses[i],
+                                      std::min(count - i, chunk));
+            else
+                builder.Read<Y>(addresses[i]);
+        }
+        builder.Finalize(batch);
+        Gathered(batch, dst, count, chunk);
+    }
+
+    /**
+     * Gathers the values at a list of addresses of the emulator's memory.
+     * @n
+     * On error throws an IPCStatus.
+     * @param addresses The addresses of the values.
+     * @param Y The type of the values.
+     * @return The values, in the order of their addresses.
+     * @see ReadGather
+     */
+    template <typename Y>
+    auto ReadGather(const std::vector<uint32_t> &addresses) -> std::vector<Y> {
+        std::vector<Y> values(addresses.size());
+        ReadGather(addresses.data(), (uint32_t)addresses.size(),
+                   values.data());
+        return values;
+    }
+
+    /**
+     * Batch flavour of ReadGather, gathering at most MAX_RANGE_SIZE bytes.
+     * @n
+     * Only for servers knowing about gather commands, GetReply of
+     * MsgReadGather then returns the values read. @n
+     * On error throws an IPCStatus.
+     * @param addresses The addresses of the values.
+     * @param count Number of values.
+     * @param Y The type of the values.
+     * @param T Flag to enable batch processing, must be set.
+     * @return The IPC message.
+     */
+    template <typename Y, bool T>
+    auto ReadGather(const uint32_t *addresses, uint32_t count) -> char * {
+        static_assert(T, "use ReadGather(addresses, count, dst) instead");
+        char *cmd = batch_builder.ReadGather<Y>(addresses, count);
+        if (cmd == nullptr)
+            SetError(OutOfMemory);
+        return cmd;
+    }
+
+    /**
+     * Reads a value at the end of a pointer path, like
+     * [[[address]+0x10]+0x24]+0x8 with the offsets 0x10, 0x24 and 0x8. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX AA AA AA AA WW CC (OO OO OO OO*CC) @n
+     * Legend: XX = IPC Tag, AA = address of the first pointer, WW = width of
+     * the value, CC = number of offsets, OO = offsets. @n
+     * Return: (ZZ*WW) @n
+     * Legend: ZZ = Value read. @n
+     * The server follows the whole path in a single round trip. Servers not
+     * knowing about pointer paths get one 32 bit read per pointer instead,
+     * outside of batches only.
+     * @param address The address of the first pointer.
+     * @param offsets The offsets added to each pointer read in turn, at most
+     * 255 of them.
+     * @param T Flag to enable batch processing or not.
+     * @param Y The type of the value to read (eg uint8_t), void for the
+     * address the path ends at.
+     * @return The value read in memory. If in batch mode the IPC message,
+     * GetReply of the read of the same width, MsgRead32 for an address, then
+     * returns the value.
+     */
+    template <typename Y, bool T = false, typename... O>
+    auto ReadPointerPath(uint32_t address, O... offsets) {
+        static_assert(sizeof...(O) <= 255, "too many offsets");
+        using R = typename std::conditional<std::is_void<Y>::value, uint32_t,
+                                            Y>::type;
+        static_assert(sizeof(R) == 1 || sizeof(R) == 2 || sizeof(R) == 4 ||
+                          sizeof(R) == 8,
+                      "unsupported width");
+        constexpr uint8_t width = std::is_void<Y>::value ? 0 : sizeof(R);
+        constexpr IPCCommand tag = sizeof(R) == 1   ? MsgRead8
+                                   : sizeof(R) == 2 ? MsgRead16
+                                   : sizeof(R) == 4 ? MsgRead32
+                                                    : MsgRead64;
+        std::array<uint32_t, sizeof...(O)> path{ { (uint32_t)offsets... } };
+
+        // batch mode
+        if constexpr (T) {
+            char *cmd = batch_builder.ReadPointerPath(address, path.data(),
+                                                      path.size(), width);
+            if (cmd == nullptr)
+                SetError(OutOfMemory);
+            return cmd;
+        } else {
+            if (!Supports(MsgReadPointer, 6, pointer_support)) {
+                for (uint32_t offset : path)
+                    address = Read<uint32_t>(address) + offset;
+                if constexpr (std::is_void<Y>::value)
+                    return address;
+                else
+                    return Read<Y>(address);
+            }
+            // too big for the buffer of the connection past a few offsets
+            std::array<char, 4 + 7 + 4 * sizeof...(O)> message;
+            char *cmd = message.data();
+            int size = message.size();
+            ToArray<uint32_t>(cmd, size, 0);
+            cmd[4] = MsgReadPointer;
+            ToArray(cmd, address, 5);
+            cmd[9] = width;
+            cmd[10] = path.size();
+            for (size_t i = 0; i < path.size(); i++)
+                ToArray(cmd, path[i], 11 + 4 * i);
+            auto conn = Acquire();
+            int reply_size;
+            return GetReply<tag>(Exchange(*conn, IPCBuffer{ size, cmd },
+                                          conn->ret_buffer, reply_size),
+                                 5);
+        }
+    }
+
+  protected:
+    /**
+     * Byte pattern, some of its bytes being wildcards.
+     * @see FindPatterns
+     */
+    struct Pattern {
+        /**
+         * Bytes of the pattern, zero for wildcards.
+         */
+        std::vector<uint8_t> bytes;
+
+        /**
+         * Mask of the bytes compared, 0xFF for known ones and zero for
+         * wildcards.
+         */
+        std::vector<uint8_t> mask;
+
+        /**
+         * Index of the known byte first searched for, -1 if there is none.
+         */
+        int anchor = -1;
+    };
+
+    /**
+     * Parses a byte pattern, like "8F A2 ?? ?? 24 03".
+     * @param text The pattern, hexadecimal bytes separated by spaces, ?? or
+     * ? being a wildcard.
+     * @param pattern Where to store the pattern parsed.
+     * @return false if the pattern is empty or malformed.
+     */
+    static auto ParsePattern(const std::string &text, Pattern &pattern)
+        -> bool {
+        size_t i = 0;
+        while (true) {
+            while (i < text.size() && isspace((unsigned char)text[i]))
+                i++;
+            if (i == text.size())
+                break;
+            size_t end = i;
+            while (end < text.size() && !isspace((unsigned char)text[end]))
+                end++;
+            std::string token = text.substr(i, end - i);
+            i = end;
+            if (token == "?" || token == "??") {
+                pattern.bytes.push_back(0);
+                pattern.mask.push_back(0);
+                continue;
+            }
+            if (token.size() != 2 || !isxdigit((unsigned char)token[0]) ||
+                !isxdigit((unsigned char)token[1]))
+                return false;
+            pattern.bytes.push_back(strtoul(token.c_str(), nullptr, 16));
+            pattern.mask.push_back(0xFF);
+        }
+
+        // zeroes and 0xFF fill most of the memory, they make for the worst
+        // bytes to search for
+        int best = 3;
+        for (size_t j = 0; j < pattern.bytes.size(); j++) {
+            if (!pattern.mask[j])
+                continue;
+            uint8_t byte = pattern.bytes[j];
+            int rank = byte == 0 ? 2 : byte == 0xFF ? 1 : 0;
+            if (rank < best) {
+                best = rank;
+                pattern.anchor = j;
+            }
+        }
+        return !pattern.bytes.empty();
+    }
+
+    /**
+     * Finds a byte pattern in a chunk of memory. @n
+     * memchr, vectorized by the C library, skips to the occurrences of the
+     * anchor byte, only those get compared to the whole pattern.
+     * @param pattern The pattern.
+     * @param data The chunk.
+     * @param size Size of the chunk.
+     * @param starts Number of the first bytes of the chunk a match may start
+     * at, the others being matched along with the next chunk.
+     * @param address Address of the chunk in the emulator's memory.
+     * @param hits Where to append the addresses of the matches.
+     */
+    static auto MatchPattern(const Pattern &pattern, const char *data,
+                             uint32_t size, uint32_t starts, uint32_t address,
+                             std::vector<uint32_t> &hits) -> void {
+        uint32_t length = pattern.bytes.size();
+        if (size < length)
+            return;
+        starts = std::min(starts, size - length + 1);
+        const uint8_t *bytes = pattern.bytes.data();
+        const uint8_t *mask = pattern.mask.data();
+        auto matches = [&](uint32_t at) {
+            const uint8_t *memory = (const uint8_t *)&data[at];
+            for (uint32_t j = 0; j < length; j++)
+                if ((memory[j] & mask[j]) != bytes[j])
+                    return false;
+            return true;
+        };
+
+        if (pattern.anchor < 0) {
+            for (uint32_t at = 0; at < starts; at++)
+                hits.push_back(address + at);
+            return;
+        }
+        const char *first = &data[pattern.anchor];
+        const char *last = first + starts;
+        const char *found = first;
+        while ((found = (const char *)memchr(found, bytes[pattern.anchor],
+                                             last - found)) != nullptr) {
+            uint32_t at = found - first;
+            if (matches(at))
+                hits.push_back(address + at);
+            found++;
+        }
+    }
+
+  public:
+    /**
+     * Searches a region of the emulator's memory for byte patterns, like
+     * signatures of the code to hook. @n
+     * On error throws an IPCStatus, Fail if a pattern is malformed or the
+     * region wraps around the address space. @n
+     * The region gets read in chunks of PATTERN_CHUNK_SIZE bytes, each one
+     * matched against every pattern on another thread while the next one is
+     * read, so that several patterns cost a single read of the region.
+     * @param address The address of the region.
+     * @param size Size of the region.
+     * @param patterns The patterns, hexadecimal bytes separated by spaces, ??
+     * or ? being a wildcard, eg "8F A2 ?? ?? 24 03".
+     * @return For each pattern the addresses it is found at, in ascending
+     * order.
+     * @see FindPattern
+     * @see PATTERN_CHUNK_SIZE
+     */
+    auto FindPatterns(uint32_t address, uint32_t size,
+                      const std::vector<std::string> &patterns)
+        -> std::vector<std::vector<uint32_t>> {
+        std::vector<std::vector<uint32_t>> hits(patterns.size());
+        if (patterns.empty())
+            return hits;
+        std::vector<Pattern> parsed(patterns.size());
+        uint32_t longest = 0;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (!ParsePattern(patterns[i], parsed[i])) {
+                SetError(Fail);
+                return hits;
+            }
+            longest = std::max<uint32_t>(longest, parsed[i].bytes.size());
+        }
+
+        // chunks overlap by the longest pattern, so that matches straddling
+        // two of them are found
+        std::vector<char> chunks[2];
+        std::future<void> matching;
+        // regions reaching the top of the address space do not wrap around
+        uint64_t end = (uint64_t)address + size;
+        if (end > (1ull << 32)) {
+            SetError(Fail);
+            return hits;
+        }
+        uint32_t k = 0;
+        for (uint64_t next = address; next < end;
+             next += PATTERN_CHUNK_SIZE, k++) {
+            uint32_t at = next;
+            uint32_t starts = std::min<uint64_t>(end - at, PATTERN_CHUNK_SIZE);
+            uint32_t read = std::min<uint64_t>(end - at, starts + longest - 1);
+            std::vector<char> &chunk = chunks[k % 2];
+            chunk.resize(read);
+            ReadRange(at, read, chunk.data());
+            if (matching.valid())
+                matching.get();
+#ifdef C_FFI
+            if (ipc_errno != Success)
+                return hits;
+#endif
+            const char *data = chunk.data();
+            auto match = [&parsed, &hits, data, read, starts, at]() {
+                for (size_t i = 0; i < parsed.size(); i++)
+                    MatchPattern(parsed[i], data, read, starts, at, hits[i]);
+            };
+            matching = std::async(std::launch::async, match);
+        }
+        if (matching.valid())
+            matching.get();
+        return hits;
+    }
+
+    /**
+     * Searches a region of the emulator's memory for a byte pattern. @n
+     * On error throws an IPCStatus, Fail if the pattern is malformed.
+     * @param address The address of the region.
+     * @param size Size of the region.
+     * @param pattern The pattern, eg "8F A2 ?? ?? 24 03".
+     * @return The addresses the pattern is found at, in ascending order.
+     * @see FindPatterns
+     */
+    auto FindPattern(uint32_t address, uint32_t size,
+                     const std::string &pattern) -> std::vector<uint32_t> {
+        return std::move(FindPatterns(address, size, { pattern })[0]);
+    }
+
+  protected:
+    /**
+     * Largest number of instances of a structure whose reads or writes fit
+     * in one IPC message.
+     * @param B The batch of the reads or writes of one instance.
+     * @param fields Number of fields of the structure.
+     */
+    template <typename B>
+    static constexpr auto StructsPerMessage(uint32_t fields) -> uint32_t {
+        uint32_t message = B::message_size - 4;
+        uint32_t reply = std::max(B::reply_size - 5, 1);
+        return std::min({ (uint32_t)(MAX_IPC_SIZE - 4) / message,
+                          (uint32_t)(MAX_IPC_RETURN_SIZE - 5) / reply,
+                          (uint32_t)(MAX_BATCH_REPLY_COUNT - 1) / fields });
+    }
+
+  public:
+    /**
+     * Reads instances of a structure lying back to back in the emulator's
+     * memory. @n
+     * On error throws an IPCStatus. @n
+     * Every field of every instance gets read in the same IPC message, as
+     * many as fit in one. The structure is described once by its
+     * StructLayout, so the message gets encoded and the replies decoded at
+     * offsets known at compile time.
+     * @param address The address of the first instance.
+     * @param count Number of instances.
+     * @param dst Where to store the instances, count of them.
+     * @param T The structure, described by a StructLayout.
+     * @see PINE_STRUCT
+     * @see WriteStructs
+     */
+    template <typename T>
+    auto ReadStructs(uint32_t address, uint32_t count, T *dst) -> void {
+        using L = StructLayout<T>;
+        using B = typename L::Reads;
+        constexpr uint32_t message = B::message_size - 4;
+        constexpr uint32_t reply = B::reply_size - 5;
+        constexpr uint32_t per = StructsPerMessage<B>(L::fields);
+        // the messages get encoded in the buffer of the batch of the thread
+        BatchCommand &batch = LocalBatch().batch;
+        batch.Reserve(4 + std::min(count, per) * message, 0, 0);
+        char *cmd = batch.ipc_message.buffer;
+        auto conn = Acquire();
+        for (uint32_t first = 0; first < count; first += per) {
+            uint32_t n = std::min(count - first, per);
+            ToArray<uint32_t>(cmd, 4 + n * message, 0);
+            for (uint32_t i = 0; i < n; i++)
+                L::EncodeRead(&cmd[4 + i * message],
+                              address + (first + i) * L::size);
+            int size;
+            char *replies =
+                Exchange(*conn, IPCBuffer{ (int)(4 + n * message), cmd },
+                         conn->ret_buffer, size);
+            if (size == 0)
+                return;
+            if (size < (int)(5 + n * reply)) {
+                SetError(Fail);
+                return;
+            }
+            for (uint32_t i = 0; i < n; i++)
+                L::Decode(&replies[5 + i * reply], dst[first + i]);
+        }
+    }
+
+    /**
+     * Reads instances of a structure lying back to back in the emulator's
+     * memory. @n
+     * On error throws an IPCStatus.
+     * @param address The address of the first instance.
+     * @param count Number of instances.
+     * @param T The structure, described by a StructLayout.
+     * @return The instances.
+     * @see ReadStructs
+     */
+    template <typename T>
+    auto ReadStructs(uint32_t address, uint32_t count) -> std::vector<T> {
+        std::vector<T> values(count);
+        ReadStructs(address, count, values.data());
+        return values;
+    }
+
+    /**
+     * Reads an instance of a structure from the emulator's memory. @n
+     * On error throws an IPCStatus.
+     * @param address The address of the instance.
+     * @param T The structure, described by a StructLayout.
+     * @return The instance, its fields not described by the StructLayout
+     * value initialized.
+     * @see ReadStructs
+     */
+    template <typename T> auto ReadStruct(uint32_t address) -> T {
+        T value{};
+        ReadStructs(address, 1, &value);
+        return value;
+    }
+
+    /**
+     * Writes instances of a structure lying back to back in the emulator's
+     * memory. @n
+     * On error throws an IPCStatus. @n
+     * Only the fields described by the StructLayout get written, like
+     * ReadStructs reads them.
+     * @param address The address of the first instance.
+     * @param src The instances, count of them.
+     * @param count Number of instances.
+     * @param T The structure, described by a StructLayout.
+     * @see ReadStructs
+     */
+    template <typename T>
+    auto WriteStructs(uint32_t address, const T *src, uint32_t count)
+        -> void {
+        using L = StructLayout<T>;
+        using B = typename L::Writes;
+        constexpr uint32_t message = B::message_size - 4;
+        constexpr uint32_t per = StructsPerMessage<B>(L::fields);
+        bool cached = cache_enabled;
+        if (cached)
+            CacheInvalidate(address, count * L::size);
+        BatchCommand &batch = LocalBatch().batch;
+        batch.Reserve(4 + std::min(count, per) * message, 0, 0);
+        char *cmd = batch.ipc_message.buffer;
+        auto conn = Acquire();
+        for (uint32_t first = 0; first < count; first += per) {
+            uint32_t n = std::min(count - first, per);
+            ToArray<uint32_t>(cmd, 4 + n * message, 0);
+            for (uint32_t i = 0; i < n; i++)
+                L::EncodeWrite(&cmd[4 + i * message],
+                               address + (first + i) * L::size,
+                               src[first + i]);
+            int size;
+            Exchange(*conn, IPCBuffer{ (int)(4 + n * message), cmd },
+                     conn->ret_buffer, size);
+            if (size == 0)
                 break;
+        }
+        if (cached)
+            CacheInvalidate(address, count * L::size);
+    }
+
+    /**
+     * Writes instances of a structure lying back to back in the emulator's
+     * memory. @n
+     * On error throws an IPCStatus.
+     * @param address The address of the first instance.
+     * @param values The instances.
+     * @param T The structure, described by a StructLayout.
+     * @see WriteStructs
+     */
+    template <typename T>
+    auto WriteStructs(uint32_t address, const std::vector<T> &values)
+        -> void {
+        WriteStructs(address, values.data(), (uint32_t)values.size());
+    }
+
+    /**
+     * Writes an instance of a structure to the emulator's memory. @n
+     * On error throws an IPCStatus.
+     * @param address The address of the instance.
+     * @param value The instance.
+     * @param T The structure, described by a StructLayout.
+     * @see WriteStructs
+     */
+    template <typename T>
+    auto WriteStruct(uint32_t address, const T &value) -> void {
+        WriteStructs(address, &value, 1);
+    }
+
+    /**
+     * Retrieves the emulator's version. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag. @n
+     * Return: YY YY YY YY (ZZ*??) @n
+     * Legend: YY = string size, ZZ = version string.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise the version
+     * string. @n
+     * /!\ If not in batch mode this function passes ownership of a
+     * datastream to you, do not forget to free it!
+     */
+    template <bool T = false>
+    auto Version() {
+        constexpr IPCCommand tag = MsgVersion;
+        return StringCommands<tag, T>();
+    }
+
+    /**
+     * Retrieves emulator status. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag. @n
+     * Return: ZZ ZZ ZZ ZZ @n
+     * Legend: ZZ = emulator status.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise the emulator
+     * status.
+     */
+    template <bool T = false>
+    auto Status() {
+        constexpr IPCCommand tag = MsgStatus;
+        // batch mode
+        if constexpr (T) {
+            char *cmd = batch_builder.Status();
+            if (cmd == nullptr)
+                SetError(OutOfMemory);
+            return cmd;
+        } else {
+            // any idle connection will do
+            auto conn = Acquire();
+            ToArray(conn->ipc_buffer, 4 + 1, 0);
+            conn->ipc_buffer[4] = tag;
+            int size;
+            return GetReply<tag>(Exchange(*conn,
+                                          IPCBuffer{ 4 + 1, conn->ipc_buffer },
+                                          conn->ret_buffer, size),
+                                 5);
+        }
+    }
+
+    /**
+     * Retrieves the game title. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag. @n
+     * Return: YY YY YY YY (ZZ*??) @n
+     * Legend: YY = string size, ZZ = title string.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise the version
+     * string. @n
+     * /!\ If not in batch mode this function passes ownership of a
+     * datastream to you, do not forget to free it!
+     */
+    template <bool T = false>
+    auto GetGameTitle() {
+        constexpr IPCCommand tag = MsgTitle;
+        return StringCommands<tag, T>();
+    }
+
+    /**
+     * Retrieves the game ID. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag. @n
+     * Return: YY YY YY YY (ZZ*??) @n
+     * Legend: YY = string size, ZZ = ID string.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise the version
+     * string. @n
+     * /!\ If not in batch mode this function passes ownership of a
+     * datastream to you, do not forget to free it!
+     */
+    template <bool T = false>
+    auto GetGameID() {
+        constexpr IPCCommand tag = MsgID;
+        return StringCommands<tag, T>();
+    }
+
+    /**
+     * Retrieves the game UUID. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag. @n
+     * Return: YY YY YY YY (ZZ*??) @n
+     * Legend: YY = string size, ZZ = UUID string.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise the version
+     * string. @n
+     * /!\ If not in batch mode this function passes ownership of a
+     * datastream to you, do not forget to free it!
+     */
+    template <bool T = false>
+    auto GetGameUUID() {
+        constexpr IPCCommand tag = MsgUUID;
+        return StringCommands<tag, T>();
+    }
+
+    /**
+     * Retrieves the game version. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX @n
+     * Legend: XX = IPC Tag. @n
+     * Return: YY YY YY YY (ZZ*??) @n
+     * Legend: YY = string size, ZZ = game version string.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise the game version
+     * string. @n
+     * /!\ If not in batch mode this function passes ownership of a
+     * datastream to you, do not forget to free it!
+     */
+    template <bool T = false>
+    auto GetGameVersion() {
+        constexpr IPCCommand tag = MsgGameVersion;
+        return StringCommands<tag, T>();
+    }
+
+    /**
+     * Asks the emulator to save a savestate. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY @n
+     * Legend: XX = IPC Tag, YY = Slot.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param slot The savestate slot to use.
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise void.
+     */
+    template <bool T = false>
+    auto SaveState(uint8_t slot) {
+        constexpr IPCCommand tag = MsgSaveState;
+        return EmuState<tag, T>(slot);
+    }
+
+    /**
+     * Asks the emulator to load a savestate. @n
+     * On error throws an IPCStatus. @n
+     * Format: XX YY @n
+     * Legend: XX = IPC Tag, YY = Slot.
+     * @see IPCCommand
+     * @see IPCStatus
+     * @param slot The savestate slot to use.
+     * @param T Flag to enable batch processing or not.
+     * @return If in batch mode the IPC message otherwise void.
+     */
+    template <bool T = false>
+    auto LoadState(uint8_t slot) {
+        constexpr IPCCommand tag = MsgLoadState;
+        return EmuState<tag, T>(slot);
+    }
+
+    /**
+     * Replaces the transports of this IPC session. @n
+     * Use this to plug a transport that is not built-in, eg a Loopback. The
+     * IPC session takes ownership of the transport, and only uses this one:
+     * the connection pool cannot grow anymore. @n
+     * Must not be called while other threads use this IPC session.
+     * @param t The new transport.
+     * @see Transport
+     */
+    auto SetTransport(Transport *t) -> void {
+        SetTransport(std::function<Transport *()>());
+        std::lock_guard<std::mutex> lock(pool_blocking);
+        connections.emplace_back(new Connection(t));
+        t->Connect();
+    }
+
+    /**
+     * Replaces the transports of this IPC session. @n
+     * Every new connection of the pool gets its transport from factory,
+     * which the IPC session takes ownership of. @n
+     * Must not be called while other threads use this IPC session.
+     * @param factory Function creating a new transport.
+     * @see Transport
+     * @see SetPoolSize
+     */
+    auto SetTransport(std::function<Transport *()> factory) -> void {
+        // replies in flight are lost with the old transports
+        DropConnections();
+        std::lock_guard<std::mutex> lock(pool_blocking);
+        // and the server might not be the same anymore
+        range_support = -1;
+        gather_support = -1;
+        pointer_support = -1;
+        transport_factory = factory;
+        if (transport_factory)
+            connections.emplace_back(new Connection(transport_factory()));
+    }
+
+    /**
+     * Sets the maximum number of connections to the server. @n
+     * Threads sending IPC messages at the same time each use their own
+     * connection, created on demand, instead of waiting for each other.
+     * Existing connections are kept. @n
+     * The server has to serve concurrent connections: PCSX2, for one, serves
+     * them one after the other, which would make every extra connection
+     * hang. Hence the default of 1.
+     * @param size Maximum number of connections, at least 1.
+     * @see Acquire
+     */
+    auto SetPoolSize(unsigned int size) -> void {
+        std::lock_guard<std::mutex> lock(pool_blocking);
+        pool_size = std::max(size, 1u);
+    }
+
+    /**
+     * Merges the single reads of concurrent threads into batches. @n
+     * A single Read then waits up to window for the ones of other threads,
+     * sending them all in one IPC message as soon as max of them are
+     * waiting, the reads arriving meanwhile waiting for the next batch.
+     * Many threads polling a few values each thus share a handful of round
+     * trips instead of taking turns, at the cost of up to window of latency
+     * for each of them. @n
+     * If a batch fails its reads get sent again one by one, so only the
+     * failing ones report an error. A failed batch does not tell which of
+     * its commands got executed, so writes are never merged: sending them
+     * again could undo the writes of other threads in between. @n
+     * Must not be called while other threads use this IPC session.
+     * @param window How long to wait for other commands, 0 to disable.
+     * @param max Number of commands sending a batch right away, at most
+     * MAX_BATCH_REPLY_COUNT - 1.
+     * @see COALESCE_MAX
+     */
+    auto SetCoalescing(std::chrono::microseconds window,
+                       unsigned int max = COALESCE_MAX) -> void {
+        coalesce_window = window;
+        coalesce_max = std::min(std::max(max, 1u),
+                                (unsigned int)MAX_BATCH_REPLY_COUNT - 1);
+    }
+
+    /**
+     * Statistics of the read cache.
+     * @see GetCacheStats
+     */
+    struct CacheStats {
+        uint64_t hits;   /**< Single reads served from the cache. */
+        uint64_t misses; /**< Single reads sent to the server. */
+    };
+
+    /**
+     * Caches the values of single reads until the next Tick. @n
+     * Reading the same address with the same width again during an epoch,
+     * typically an emulated frame, then gets served from memory without any
+     * IPC message. Single writes and asynchronous ones go through the cache,
+     * so do WriteRange and LoadState, but batches, asynchronous reads and
+     * whatever the emulator writes do not: values cached stay until the next
+     * Tick. @n
+     * Enabling or disabling the cache empties it and resets its statistics.
+     * @param enable Whether to cache reads.
+     * @see Tick
+     * @see GetCacheStats
+     */
+    auto SetReadCache(bool enable) -> void {
+        std::lock_guard<std::mutex> lock(cache_blocking);
+        cache_enabled = enable;
+        cache.clear();
+        cache_epoch++;
+        cache_hits = 0;
+        cache_misses = 0;
+    }
+
+    /**
+     * Starts a new epoch of the read cache, emptying it. @n
+     * Meant to be called once per emulated frame, or whenever the values
+     * cached might have changed. Reads in flight do not get cached anymore.
+     * @see SetReadCache
+     */
+    auto Tick() -> void {
+        std::lock_guard<std::mutex> lock(cache_blocking);
+        cache.clear();
+        cache_epoch++;
+    }
+
+    /**
+     * Gets the statistics of the read cache.
+     * @return How many single reads hit and missed the cache since it got
+     * enabled.
+     * @see SetReadCache
+     */
+    auto GetCacheStats() -> CacheStats { return { cache_hits, cache_misses }; }
+
+    /**
+     * Shared Initializer.
+     * @param slot Slot to use for this IPC session.
+     * @param emulator_name Emulator name to use for this IPC session.
+     * @param default_slot Whether this is the default slot for the emulator
+     * or not.
+     * @param type Transport to use for this IPC session.
+     * @see slot
+     * @see TransportType
+     */
+    Shared(const unsigned int slot, const std::string emulator_name,
+           const bool default_slot,
+           const TransportType type = DefaultTransport) {
+        // some basic input sanitization
+        if (slot > 65536) {
+            SetError(NoConnection);
+            return;
+        }
+        this->slot = slot;
+#ifdef _WIN32
+        // We initialize winsock.
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+        char *runtime_dir = nullptr;
+#ifdef __APPLE__
+        runtime_dir = std::getenv("TMPDIR");
+#else
+        runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+#endif
+        // fallback in case macOS or other OSes don't implement the XDG base
+        // spec
+        if (runtime_dir == nullptr)
+            SOCKET_NAME = "/tmp/" + emulator_name + ".sock";
+        else {
+            SOCKET_NAME = runtime_dir;
+            SOCKET_NAME += "/" + emulator_name + ".sock";
+        }
+
+        if (!default_slot) {
+            SOCKET_NAME += "." + std::to_string(slot);
+        }
+#endif
+        transport_factory = [this, type]() { return MakeTransport(type); };
+        connections.emplace_back(new Connection(transport_factory()));
+        connections[0]->transport->Connect();
+    }
+
+    /**
+     * Shared Destructor.
+     */
+    virtual ~Shared() {
+        // the transports might still need winsock to close themselves
+        DropConnections();
+        // We clean up winsock.
+#ifdef _WIN32
+        WSACleanup();
+#endif
+    }
+};
+
+/**
+ * Commands of a Batch. @n
+ * Each one holds its arguments along with what the Batch needs to know
+ * at compile time: the size of its message and reply, and what its reply
+ * decodes into.
+ * @see Batch
+ */
+namespace Command {
+
+/**
+ * Reads a value from the emulator's memory.
+ * @see Shared::Read
+ * @param T The type of the value to read (eg uint8_t).
+ */
+template <typename T> struct Read {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 ||
+                      sizeof(T) == 8,
+                  "Read only supports 8, 16, 32 and 64 bit values");
+
+    static constexpr int message_size = 1 + 4; /**< Size of the message. */
+    static constexpr int reply_size = sizeof(T); /**< Size of the reply. */
+    static constexpr bool vle = false; /**< Whether the reply is a VLE. */
+    using Result = std::tuple<T>; /**< What the reply decodes into. */
+
+    uint32_t address; /**< The address to read. */
+
+    /**
+     * Encodes the message.
+     * @param buf Where to encode it.
+     */
+    auto Encode(char *buf) const -> void {
+        buf[0] = (sizeof(T) == 1)   ? Shared::MsgRead8
+                 : (sizeof(T) == 2) ? Shared::MsgRead16
+                 : (sizeof(T) == 4) ? Shared::MsgRead32
+                                    : Shared::MsgRead64;
+        memcpy(&buf[1], &address, 4);
+    }
+
+    /**
+     * Decodes the reply.
+     * @param reply The reply.
+     * @param offset Location of the reply of this command.
+     */
+    static auto Decode(const char *reply, int offset) -> Result {
+        T value;
+        memcpy(&value, &reply[offset], sizeof(T));
+        return Result(value);
+    }
+};
+
+/**
+ * Writes a value to the emulator's memory.
+ * @see Shared::Write
+ * @param T The type of the value to write (eg uint8_t).
+ */
+template <typename T> struct Write {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 ||
+                      sizeof(T) == 8,
+                  "Write only supports 8, 16, 32 and 64 bit values");
+
+    static constexpr int message_size = 1 + 4 + sizeof(T); /**< @see Read */
+    static constexpr int reply_size = 0;                   /**< @see Read */
+    static constexpr bool vle = false;                     /**< @see Read */
+    using Result = std::tuple<>;                           /**< @see Read */
+
+    uint32_t address; /**< The address to write. */
+    T value;          /**< The value to write. */
+
+    /**
+     * Encodes the message.
+     * @param buf Where to encode it.
+     */
+    auto Encode(char *buf) const -> void {
+        buf[0] = (sizeof(T) == 1)   ? Shared::MsgWrite8
+                 : (sizeof(T) == 2) ? Shared::MsgWrite16
+                 : (sizeof(T) == 4) ? Shared::MsgWrite32
+                                    : Shared::MsgWrite64;
+        memcpy(&buf[1], &address, 4);
+        memcpy(&buf[5], &value, sizeof(T));
+    }
+
+    /**
+     * Decodes the reply, which is empty.
+     */
+    static auto Decode(const char *, int) -> Result { return Result(); }
+};
+
+/**
+ * Saves or loads a savestate.
+ * @see Shared::SaveState
+ * @see Shared::LoadState
+ * @param Y IPCCommand to use.
+ */
+template <Shared::IPCCommand Y> struct EmuState {
+    static constexpr int message_size = 1 + 1; /**< @see Read */
+    static constexpr int reply_size = 0;       /**< @see Read */
+    static constexpr bool vle = false;         /**< @see Read */
+    using Result = std::tuple<>;               /**< @see Read */
+
+    uint8_t slot; /**< The savestate slot to use. */
+
+    /**
+     * Encodes the message.
+     * @param buf Where to encode it.
+     */
+    auto Encode(char *buf) const -> void {
+        buf[0] = Y;
+        buf[1] = slot;
+    }
+
+    /**
+     * Decodes the reply, which is empty.
+     */
+    static auto Decode(const char *, int) -> Result { return Result(); }
+};
+
+/**
+ * Returns a string, eg the emulator version. @n
+ * Its reply is a VLE, so the replies following it are only located once
+ * received.
+ * @see Shared::Version
+ * @param Y IPCCommand to use.
+ */
+template <Shared::IPCCommand Y> struct String {
+    static constexpr int message_size = 1; /**< @see Read */
+    static constexpr int reply_size = 4;   /**< Size of the reply, not
+                                                counting the string. */
+    static constexpr bool vle = true;      /**< @see Read */
+    using Result = std::tuple<std::string>; /**< @see Read */
+
+    /**
+     * Encodes the message.
+     * @param buf Where to encode it.
+     */
+    auto Encode(char *buf) const -> void { buf[0] = Y; }
+
+    /**
+     * Size of the reply, string included.
+     * @param reply The reply.
+     * @param offset Location of the reply of this command.
+     */
+    static auto Size(const char *reply, int offset) -> int {
+        uint32_t size;
+        memcpy(&size, &reply[offset], 4);
+        return (size > MAX_IPC_RETURN_SIZE) ? MAX_IPC_RETURN_SIZE : 4 + size;
+    }
+
+    /**
+     * Decodes the reply.
+     * @param reply The reply.
+     * @param offset Location of the reply of this command.
+     */
+    static auto Decode(const char *reply, int offset) -> Result {
+        const char *str = &reply[offset + 4];
+        return Result(std::string(str, strnlen(str, Size(reply, offset) - 4)));
+    }
+};
+
+/**
+ * Returns the emulator status.
+ * @see Shared::Status
+ */
+struct Status {
+    static constexpr int message_size = 1; /**< @see Read */
+    static constexpr int reply_size = 4;   /**< @see Read */
+    static constexpr bool vle = false;     /**< @see Read */
+    using Result = std::tuple<Shared::EmuStatus>; /**< @see Read */
+
+    /**
+     * Encodes the message.
+     * @param buf Where to encode it.
+     */
+    auto Encode(char *buf) const -> void { buf[0] = Shared::MsgStatus; }
+
+    /**
+     * Decodes the reply.
+     * @param reply The reply.
+     * @param offset Location of the reply of this command.
+     */
+    static auto Decode(const char *reply, int offset) -> Result {
+        uint32_t status;
+        memcpy(&status, &reply[offset], 4);
+        return Result((Shared::EmuStatus)status);
+    }
+};
+
+using SaveState = EmuState<Shared::MsgSaveState>; /**< @see EmuState */
+using LoadState = EmuState<Shared::MsgLoadState>; /**< @see EmuState */
+using Version = String<Shared::MsgVersion>;       /**< @see String */
+using Title = String<Shared::MsgTitle>;           /**< @see String */
+using ID = String<Shared::MsgID>;                 /**< @see String */
+using UUID = String<Shared::MsgUUID>;             /**< @see String */
+using GameVersion = String<Shared::MsgGameVersion>; /**< @see String */
+
+} // namespace Command
+
+/**
+ * Batch command whose layout is known at compile time. @n
+ * The message is encoded in place, every command at an offset computed at
+ * compile time, and its replies get decoded into a tuple, their types
+ * following the commands. Unlike BatchCommand there is no index nor
+ * IPCCommand to get right when reading the replies, and no bookkeeping at
+ * runtime, which suits batches whose shape does not change, eg the ones
+ * sent every frame: @n
+ * Batch<Command::Read<uint32_t>, Command::Version> batch({ 0x100 }, {}); @n
+ * auto [value, version] = ipc.Send(batch); @n
+ * Replies following a string get located once received. Fixed size ones
+ * are located at compile time.
+ * @see Shared::Send
+ * @see Command
+ * @param C The commands, in order.
+ */
+template <typename... C> class Batch {
+    static_assert(sizeof...(C) > 0, "A batch needs at least one command");
+
+  public:
+    /**
+     * What the replies decode into: the replies of the commands returning
+     * something, in order.
+     */
+    using Result =
+        decltype(std::tuple_cat(std::declval<typename C::Result>()...));
+
+    /**
+     * Number of commands.
+     */
+    static constexpr size_t count = sizeof...(C);
+
+    /**
+     * Size of the message, header included.
+     */
+    static constexpr int message_size = 4 + (C::message_size + ...);
+
+    /**
+     * Size of the reply, header included, not counting the strings.
+     */
+    static constexpr int reply_size = 5 + (C::reply_size + ...);
+
+    /**
+     * Whether every reply is located at compile time.
+     */
+    static constexpr bool fixed = (!C::vle && ...);
+
+  protected:
+    static_assert(message_size <= MAX_IPC_SIZE, "Batch message too big");
+    static_assert(reply_size <= MAX_IPC_RETURN_SIZE, "Batch reply too big");
+    static_assert(count < MAX_BATCH_REPLY_COUNT, "Too many commands");
+
+    /**
+     * Lays out back to back items of the given sizes.
+     * @param sizes The sizes of the items.
+     * @param start Where the first one goes.
+     * @return The offsets of the items.
+     */
+    static constexpr auto Layout(std::array<int, count> sizes, int start)
+        -> std::array<int, count> {
+        std::array<int, count> offsets{};
+        for (size_t i = 0; i < count; i++) {
+            offsets[i] = start;
+            start += sizes[i];
+        }
+        return offsets;
+    }
+
+  public:
+    /**
+     * Offsets of the commands in the message.
+     */
+    static constexpr std::array<int, count> message_offsets =
+        Layout({ C::message_size... }, 4);
+
+    /**
+     * Offsets of the replies of the commands, up to the first string.
+     */
+    static constexpr std::array<int, count> reply_offsets =
+        Layout({ C::reply_size... }, 5);
+
+  protected:
+    /**
+     * Type of a command.
+     * @param I Index of the command.
+     */
+    template <size_t I>
+    using Nth = typename std::tuple_element<I, std::tuple<C...>>::type;
+
+    /**
+     * The message.
+     */
+    std::array<char, message_size> message;
+
+    /**
+     * Decodes a reply.
+     * @see Decode
+     */
+    template <size_t... I>
+    auto Decode(const char *reply, int size, Result &result,
+                std::index_sequence<I...>) const -> bool {
+        std::array<int, count> offsets = reply_offsets;
+        int end = reply_size;
+        if constexpr (!fixed) {
+            // strings have to be walked through to locate what follows them,
+            // without going past the reply
+            end = 5;
+            ((offsets[I] = end, end = Next<C>(reply, size, end)), ...);
+        }
+        if (end > size)
+            return false;
+        result = std::tuple_cat(C::Decode(reply, offsets[I])...);
+        return true;
+    }
+
+    /**
+     * Locates the end of the reply of a command.
+     * @param reply The reply.
+     * @param size The size of the reply.
+     * @param offset Location of the reply of the command.
+     * @param Y The command.
+     * @return Where its reply ends, past size if the reply is too short.
+     */
+    template <typename Y>
+    static auto Next(const char *reply, int size, int offset) -> int {
+        if constexpr (Y::vle) {
+            // the size of a string is only known once it is received
+            if (offset + 4 > size)
+                return size + 1;
+            return std::min(offset + Y::Size(reply, offset), size + 1);
+        } else {
+            return std::min(offset + Y::reply_size, size + 1);
+        }
+    }
+
+  public:
+    /**
+     * Batch Initializer, every command without arguments.
+     */
+    Batch() : Batch(C{}...) {}
+
+    /**
+     * Batch Initializer.
+     * @param commands The commands along with their arguments.
+     */
+    Batch(const C &...commands) {
+        uint32_t size = message_size;
+        memcpy(message.data(), &size, 4);
+        size_t i = 0;
+        (commands.Encode(&message[message_offsets[i++]]), ...);
+    }
+
+    /**
+     * Replaces the arguments of a command.
+     * @param command The command along with its new arguments.
+     * @param I Index of the command.
+     */
+    template <size_t I> auto Set(const Nth<I> &command) -> void {
+        command.Encode(&message[std::get<I>(message_offsets)]);
+    }
+
+    /**
+     * The message, ready to be sent.
+     */
+    auto Message() const -> Shared::IPCBuffer {
+        return Shared::IPCBuffer{ message_size,
+                                  const_cast<char *>(message.data()) };
+    }
+
+    /**
+     * Decodes a reply.
+     * @param reply The reply.
+     * @param size The size of the reply.
+     * @param result Set to the replies decoded.
+     * @return false if the reply is too short.
+     */
+    auto Decode(const char *reply, int size, Result &result) const -> bool {
+        return Decode(reply, size, result, std::index_sequence_for<C...>());
+    }
+};
+
+/**
+ * Field of a structure mirrored from the emulator's memory.
+ * @see Layout
+ * @param M The member of the C++ structure it is decoded into, of 8, 16, 32
+ * or 64 bits, eg &Player::health.
+ * @param O Offset of the field in the structure of the emulator's memory.
+ */
+template <auto M, uint32_t O> struct Field;
+
+/**
+ * @see Field
+ */
+template <typename T, typename Y, Y T::*M, uint32_t O> struct Field<M, O> {
+    using Type = Y;                       /**< Type of the field. */
+    static constexpr uint32_t offset = O; /**< Offset of the field. */
+
+    /**
+     * Value of the field.
+     * @param value The instance of the structure.
+     */
+    static auto Get(const T &value) -> Y { return value.*M; }
+
+    /**
+     * Decodes the field.
+     * @param reply The reply of the read of the field.
+     * @param value The instance of the structure to decode it into.
+     */
+    static auto Set(const char *reply, T &value) -> void {
+        memcpy(&(value.*M), reply, sizeof(Y));
+    }
+};
+
+/**
+ * Layout of a structure mirrored from the emulator's memory, the fields of
+ * an instance being read or written as one batch. @n
+ * Where each field goes in the message, and where its reply is, follows
+ * from the fields at compile time like for Batch, so encoding and decoding
+ * an instance is a fixed sequence of copies. @n
+ * A structure gets its layout by specializing StructLayout, usually
+ * through PINE_STRUCT.
+ * @see Shared::ReadStructs
+ * @see Shared::WriteStructs
+ * @param T The C++ structure.
+ * @param S Size of the structure in the emulator's memory, the distance
+ * between two instances of an array.
+ * @param F The fields, Field of members of T.
+ */
+template <typename T, uint32_t S, typename... F> struct Layout {
+    static constexpr uint32_t size = S;              /**< @see Layout */
+    static constexpr uint32_t fields = sizeof...(F); /**< Number of fields. */
+
+    /**
+     * Reads of the fields of an instance, as a batch.
+     */
+    using Reads = Batch<Command::Read<typename F::Type>...>;
+
+    /**
+     * Writes of the fields of an instance, as a batch.
+     */
+    using Writes = Batch<Command::Write<typename F::Type>...>;
+
+    /**
+     * Encodes the reads of an instance.
+     * @param buf Where to encode them, Reads::message_size - 4 bytes.
+     * @param address The address of the instance.
+     */
+    static auto EncodeRead(char *buf, uint32_t address) -> void {
+        size_t i = 0;
+        (Command::Read<typename F::Type>{ address + F::offset }.Encode(
+             &buf[Reads::message_offsets[i++] - 4]),
+         ...);
+    }
+
+    /**
+     * Encodes the writes of an instance.
+     * @param buf Where to encode them, Writes::message_size - 4 bytes.
+     * @param address The address of the instance.
+     * @param value The instance.
+     */
+    static auto EncodeWrite(char *buf, uint32_t address, const T &value)
+        -> void {
+        size_t i = 0;
+        (Command::Write<typename F::Type>{ address + F::offset,
+                                           F::Get(value) }
+             .Encode(&buf[Writes::message_offsets[i++] - 4]),
+         ...);
+    }
+
+    /**
+     * Decodes the replies of the reads of an instance.
+     * @param reply The replies, Reads::reply_size - 5 bytes.
+     * @param value The instance to decode them into.
+     */
+    static auto Decode(const char *reply, T &value) -> void {
+        size_t i = 0;
+        (F::Set(&reply[Reads::reply_offsets[i++] - 5], value), ...);
+    }
+};
+
+/**
+ * Describes a structure mirrored from the emulator's memory, at global
+ * scope: @n
+ * PINE_STRUCT(Player, 0x40, PINE::Field<&Player::health, 0x10>,
+ *             PINE::Field<&Player::speed, 0x24>); @n
+ * @see Layout
+ * @param T The C++ structure.
+ * @param S Size of the structure in the emulator's memory.
+ * @param ... The fields.
+ */
+#define PINE_STRUCT(T, S, ...)                                               \
+    template <>                                                              \
+    struct PINE::StructLayout<T> : PINE::Layout<T, S, __VA_ARGS__> {}
+
+/**
+ * Does something on a thread of its own at a steady rate, until stopped. @n
+ * Errors do not stop the thread, they get reported to OnError. Classes
+ * deriving from it must call Stop in their destructor, before the members
+ * their Step uses go away.
+ * @see Watcher
+ * @see MemoryMirror
+ */
+class Periodic {
+  protected:
+    /**
+     * Protects on_error and interval.
+     */
+    std::mutex settings_blocking;
+
+    /**
+     * Called with the IPCStatus of the steps failing.
+     * @see OnError
+     */
+    std::function<void(Shared::IPCStatus)> on_error;
+
+    /**
+     * Time between two steps.
+     * @see SetInterval
+     */
+    std::chrono::microseconds interval;
+
+    /**
+     * Whether the thread should keep going.
+     */
+    bool running = false;
+
+    /**
+     * Protects running.
+     */
+    std::mutex run_blocking;
+
+    /**
+     * Wakes the thread up when it should stop.
+     */
+    std::condition_variable run_changed;
+
+    /**
+     * The thread.
+     */
+    std::thread worker;
+
+    /**
+     * Does what the thread is for, once. @n
+     * On error throws an IPCStatus, or returns it on C.
+     * @return The IPCStatus of the step.
+     */
+    virtual auto Step() -> Shared::IPCStatus = 0;
+
+    /**
+     * Steps until Stop gets called, reporting errors to on_error.
+     */
+    auto Run() -> void {
+        auto next = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(run_blocking);
+        while (running) {
+            lock.unlock();
+            Shared::IPCStatus status;
+            try {
+                status = Step();
+            } catch (Shared::IPCStatus err) {
+                status = err;
+            }
+            std::function<void(Shared::IPCStatus)> report;
+            std::chrono::microseconds wait;
+            {
+                std::lock_guard<std::mutex> settings(settings_blocking);
+                report = on_error;
+                wait = interval;
+            }
+            if (status != Shared::Success && report)
+                report(status);
+
+            // at a steady rate, unless steps take longer than that
+            next = std::max(next + wait, std::chrono::steady_clock::now());
+            lock.lock();
+            run_changed.wait_until(lock, next, [&]() { return !running; });
+        }
+    }
+
+    /**
+     * Periodic Initializer. @n
+     * The thread only starts once Start gets called.
+     * @param interval Time between two steps.
+     */
+    Periodic(std::chrono::microseconds interval) : interval(interval) {}
+
+  public:
+    Periodic(const Periodic &) = delete;
+    auto operator=(const Periodic &) -> Periodic & = delete;
+
+    /**
+     * Periodic Destructor, stopping the thread if the derived class did not.
+     */
+    virtual ~Periodic() { Stop(); }
+
+    /**
+     * Sets what gets called when a step of the thread fails.
+     * @param callback Called with the IPCStatus of the failure.
+     */
+    auto OnError(std::function<void(Shared::IPCStatus)> callback) -> void {
+        std::lock_guard<std::mutex> lock(settings_blocking);
+        on_error = std::move(callback);
+    }
+
+    /**
+     * Sets the time between two steps, from the next one on.
+     * @param interval Time between two steps.
+     */
+    auto SetInterval(std::chrono::microseconds interval) -> void {
+        std::lock_guard<std::mutex> lock(settings_blocking);
+        this->interval = interval;
+    }
+
+    /**
+     * Starts the thread, if not already.
+     * @see Stop
+     */
+    auto Start() -> void {
+        std::lock_guard<std::mutex> lock(run_blocking);
+        if (running)
+            return;
+        running = true;
+        worker = std::thread([this]() { Run(); });
+    }
+
+    /**
+     * Stops the thread, waiting for the step in progress. @n
+     * Must not be called from the thread, eg from a callback.
+     * @see Start
+     */
+    auto Stop() -> void {
+        {
+            std::lock_guard<std::mutex> lock(run_blocking);
+            running = false;
+        }
+        run_changed.notify_all();
+        if (worker.joinable())
+            worker.join();
+    }
+};
+
+/**
+ * Polls values of the emulator's memory on its own thread, calling back
+ * whenever one of them changes. @n
+ * The values watched get compiled into a single batch, optimized and sent
+ * once per poll, so watching dozens of values costs one IPC message per poll
+ * instead of one loop each. Replies get compared with the ones of the
+ * previous poll, callbacks only get called for the values which changed, and
+ * once for their first value. @n
+ * Callbacks are called from the polling thread, one after the other, and may
+ * watch or unwatch values: it only takes effect on the next poll. Errors do
+ * not stop the polling, they get reported to OnError.
+ * @see Shared::BatchBuilder
+ * @see Periodic
+ */
+class Watcher : public Periodic {
+  public:
+    /**
+     * Identifies a watch.
+     * @see Watch
+     */
+    using Id = uint64_t;
+
+  protected:
+    /**
+     * A value watched.
+     */
+    struct Entry {
+        Id id;              /**< Identifier of the watch. */
+        uint32_t address;   /**< Address of the value. */
+        unsigned int width; /**< Width of the value. */
+        bool fresh;         /**< Whether it has not been polled yet. */
+        char last[8];       /**< Bytes of the value as of the last poll. */
+        /**
+         * Decodes the bytes of the value and calls back with it.
+         */
+        std::function<void(const char *)> callback;
+    };
+
+    /**
+     * The IPC session polled.
+     */
+    Shared &ipc;
+
+    /**
+     * Values watched, only touched while polling.
+     */
+    std::vector<Entry> watches;
+
+    /**
+     * Values to watch from the next poll on.
+     * @see Watch
+     */
+    std::vector<Entry> added;
+
+    /**
+     * Values to stop watching from the next poll on.
+     * @see Unwatch
+     */
+    std::vector<Id> removed;
+
+    /**
+     * Protects added, removed and next_id.
+     */
+    std::mutex pending_blocking;
+
+    /**
+     * Identifier of the next watch.
+     */
+    Id next_id = 1;
+
+    /**
+     * Builds the batch polled whenever the values watched change.
+     */
+    Shared::BatchBuilder builder;
+
+    /**
+     * The batch polled, reading every value watched.
+     */
+    Shared::BatchCommand batch;
+
+    /**
+     * Whether the batch has to be built again before the next poll.
+     */
+    bool stale = true;
+
+    /**
+     * Makes polls happen one at a time.
+     */
+    std::mutex poll_blocking;
+
+#ifdef C_FFI
+    /**
+     * Status of the last poll, errors not being thrown on C.
+     */
+    Shared::IPCStatus failed = Shared::Success;
+#endif
+
+    /**
+     * Takes the watches added and removed since the last poll into account.
+     * @n
+     * Holds poll_blocking.
+     */
+    auto Update() -> void {
+        std::lock_guard<std::mutex> lock(pending_blocking);
+        if (added.empty() && removed.empty())
+            return;
+        for (auto &entry : added)
+            watches.push_back(std::move(entry));
+        auto gone = [&](const Entry &e) {
+            return std::find(removed.begin(), removed.end(), e.id) !=
+                   removed.end();
+        };
+        watches.erase(std::remove_if(watches.begin(), watches.end(), gone),
+                      watches.end());
+        added.clear();
+        removed.clear();
+        stale = true;
+    }
+
+    /**
+     * Builds the batch polled again. @n
+     * Holds poll_blocking.
+     */
+    auto Compile() -> void {
+        builder.Initialize(true);
+        for (auto &watch : watches) {
+            switch (watch.width) {
+                case 1:
+                    builder.Read<uint8_t>(watch.address);
+                    break;
+                case 2:
+                    builder.Read<uint16_t>(watch.address);
+                    break;
+                case 4:
+                    builder.Read<uint32_t>(watch.address);
+                    break;
+                default:
+                    builder.Read<uint64_t>(watch.address);
+                    break;
+            }
+        }
+        builder.Finalize(batch, true);
+        stale = false;
+    }
+
+    /**
+     * Polls once, on the polling thread.
+     * @return The IPCStatus of the poll.
+     */
+    auto Step() -> Shared::IPCStatus override {
+        Poll();
+#ifdef C_FFI
+        return failed;
+#else
+        return Shared::Success;
+#endif
+    }
+
+  public:
+    /**
+     * Watcher Initializer. @n
+     * Polling only starts once Start gets called.
+     * @param ipc The IPC session to poll, outliving the watcher.
+     * @param interval Time between two polls.
+     */
+    Watcher(Shared &ipc, std::chrono::microseconds interval =
+                             std::chrono::milliseconds(16))
+        : Periodic(interval), ipc(ipc) {}
+
+    /**
+     * Watcher Destructor, stopping the polling thread.
+     */
+    ~Watcher() { Stop(); }
+
+    /**
+     * Watches a value of the emulator's memory.
+     * @param address The address of the value.
+     * @param callback Called with the value, first polled and then whenever
+     * it changes.
+     * @param Y The type of the value (eg uint8_t).
+     * @return The watch, to unwatch it.
+     * @see Unwatch
+     */
+    template <typename Y>
+    auto Watch(uint32_t address, std::function<void(Y)> callback) -> Id {
+        static_assert(sizeof(Y) == 1 || sizeof(Y) == 2 || sizeof(Y) == 4 ||
+                          sizeof(Y) == 8,
+                      "unsupported width");
+        std::lock_guard<std::mutex> lock(pending_blocking);
+        Id id = next_id++;
+        added.push_back(Entry{ id, address, sizeof(Y), true, {},
+                               [callback](const char *bytes) {
+                                   Y value;
+                                   memcpy(&value, bytes, sizeof(Y));
+                                   callback(value);
+                               } });
+        return id;
+    }
+
+    /**
+     * Stops watching a value. @n
+     * Its callback can still be running, or about to be, until the next poll
+     * starts.
+     * @param id The watch.
+     * @see Watch
+     */
+    auto Unwatch(Id id) -> void {
+        std::lock_guard<std::mutex> lock(pending_blocking);
+        removed.push_back(id);
+    }
+
+    /**
+     * Polls every value watched once, on the calling thread, calling back
+     * for the ones which changed. @n
+     * On error throws an IPCStatus, the values keeping their previous bytes.
+     */
+    auto Poll() -> void {
+        std::lock_guard<std::mutex> lock(poll_blocking);
+        Update();
+        if (watches.empty())
+            return;
+        if (stale)
+            Compile();
+        ipc.SendCommand(batch);
+#ifdef C_FFI
+        failed = ipc.GetError();
+        if (failed != Shared::Success)
+            return;
+#endif
+        for (unsigned int i = 0; i < watches.size(); i++) {
+            auto &watch = watches[i];
+            // every read replies with its raw memory
+            const char *bytes =
+                ipc.GetReply<Shared::MsgReadRange>(batch, (int)i);
+            if (watch.fresh || memcmp(bytes, watch.last, watch.width)) {
+                watch.fresh = false;
+                memcpy(watch.last, bytes, watch.width);
+                watch.callback(bytes);
+            }
+        }
+    }
+};
+
+#ifdef __linux__
+/**
+ * Mirrors regions of the emulator's memory into a file mapped in memory, so
+ * that any number of processes read them with plain memory loads instead
+ * of IPC commands. @n
+ * The mirror refreshes its regions MIRROR_PAGE_SIZE pages at a time with
+ * range commands, pipelined in a single batch: watched regions entirely
+ * on every refresh, the others only for the pages invalidated and a few
+ * more swept in turn. Only the pages which changed get copied into the
+ * file, each region guarded by a sequence counter which is odd while it
+ * gets copied, so readers retry instead of locking. @n
+ * Refreshes happen on a thread of its own once started, errors getting
+ * reported to OnError, or on the calling thread through Refresh. Needs a
+ * server knowing about range commands.
+ * @see MemoryMirror::Reader
+ * @see Shared::ReadRange
+ * @see Periodic
+ */
+class MemoryMirror : public Periodic {
+  public:
+    /**
+     * A region to mirror.
+     */
+    struct Region {
+        uint32_t address;    /**< Address of the region. */
+        uint32_t size;       /**< Size of the region. */
+        bool watched = true; /**< Whether every refresh reads it whole. */
+    };
+
+  protected:
+    /**
+     * Identifies the files of memory mirrors, set once they are ready.
+     */
+    static constexpr uint32_t magic = 0x52524D50;
+
+    /**
+     * Beginning of the file, followed by the Mapped regions.
+     */
+    struct Header {
+        std::atomic<uint32_t> magic;      /**< Set once the file is ready. */
+        uint32_t count;                   /**< Number of regions. */
+        std::atomic<uint64_t> refreshes;  /**< Number of refreshes done. */
+    };
+
+    /**
+     * A region in the file.
+     */
+    struct Mapped {
+        uint32_t address;                /**< Address of the region. */
+        uint32_t size;                   /**< Size of the region. */
+        uint64_t offset;                 /**< Location of its memory. */
+        std::atomic<uint32_t> sequence;  /**< Odd while it gets copied. */
+    };
+
+    /**
+     * A region, as the mirror keeps track of it.
+     */
+    struct Local {
+        Region region;           /**< The region. */
+        Mapped *mapped;          /**< The region in the file. */
+        std::vector<char> dirty; /**< Pages to read on the next refresh. */
+        size_t cursor = 0;       /**< Next page swept. */
+    };
+
+    /**
+     * Size of the part of the file holding the headers.
+     * @param count Number of regions.
+     */
+    static auto HeaderSize(size_t count) -> size_t {
+        size_t size = sizeof(Header) + count * sizeof(Mapped);
+        return (size + MIRROR_PAGE_SIZE - 1) / MIRROR_PAGE_SIZE *
+               MIRROR_PAGE_SIZE;
+    }
+
+    /**
+     * Copies memory out of a region, retrying while it gets refreshed.
+     * @param base The file.
+     * @param mapped The region.
+     * @param address The address of the memory, inside the region.
+     * @param size Size of the memory, inside the region.
+     * @param dst Where to copy it.
+     */
+    static auto Load(const char *base, const Mapped &mapped, uint32_t address,
+                     uint32_t size, void *dst) -> void {
+        const char *src = &base[mapped.offset + (address - mapped.address)];
+        while (true) {
+            uint32_t before = mapped.sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
             }
+            memcpy(dst, src, size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mapped.sequence.load(std::memory_order_relaxed) == before)
+                return;
+        }
+    }
 
-            receive_length += tmp_length;
+    /**
+     * Finds the region holding some memory.
+     * @param header The file.
+     * @param address The address of the memory.
+     * @param size Size of the memory.
+     * @return The region, nullptr if none holds the whole memory.
+     */
+    static auto Find(const Header *header, uint32_t address, uint32_t size)
+        -> const Mapped * {
+        const Mapped *regions = (const Mapped *)&header[1];
+        for (uint32_t i = 0; i < header->count; i++) {
+            const Mapped &r = regions[i];
+            if (address >= r.address &&
+                (uint64_t)address - r.address + size <= r.size)
+                return &r;
+        }
+        return nullptr;
+    }
 
-            // if we got at least the final size then update
-            if (end_length == 4 && receive_length >= 4) {
-                end_length = FromArray<uint32_t>(ret.buffer, 0);
-                if (end_length > MAX_IPC_SIZE) {
-                    receive_length = 0;
-                    break;
-                }
+    /**
+     * The IPC session refreshing the mirror.
+     */
+    Shared &ipc;
+
+    /**
+     * The file mapped, nullptr if it could not be.
+     */
+    char *base = nullptr;
+
+    /**
+     * Size of the file.
+     */
+    size_t length = 0;
+
+    /**
+     * The regions.
+     */
+    std::vector<Local> regions;
+
+    /**
+     * Pages of the regions not watched read on every refresh along with
+     * the ones invalidated, so that they converge anyway.
+     * @see SetSweep
+     */
+    uint32_t sweep = 16;
+
+    /**
+     * Ranges invalidated since the last refresh.
+     * @see Invalidate
+     */
+    std::vector<std::pair<uint32_t, uint32_t>> invalidated;
+
+    /**
+     * Protects invalidated and sweep.
+     */
+    std::mutex pending_blocking;
+
+    /**
+     * Builds the batch of range reads of a refresh.
+     */
+    Shared::BatchBuilder builder;
+
+    /**
+     * The batch of range reads of a refresh.
+     */
+    Shared::BatchCommand batch;
+
+    /**
+     * Makes refreshes happen one at a time.
+     */
+    std::mutex refresh_blocking;
+
+#ifdef C_FFI
+    /**
+     * Status of the last refresh, errors not being thrown on C.
+     */
+    Shared::IPCStatus failed = Shared::Success;
+#endif
+
+    /**
+     * Marks the pages to read on this refresh. @n
+     * Holds refresh_blocking.
+     */
+    auto Mark() -> void {
+        std::lock_guard<std::mutex> lock(pending_blocking);
+        for (auto &local : regions) {
+            Region &r = local.region;
+            auto &dirty = local.dirty;
+            if (r.watched) {
+                std::fill(dirty.begin(), dirty.end(), 1);
+                continue;
+            }
+            for (auto [address, size] : invalidated) {
+                uint64_t end = (uint64_t)address + size;
+                if (end <= r.address || address >= r.address + r.size)
+                    continue;
+                uint32_t first = std::max(address, r.address) - r.address;
+                uint64_t last = std::min<uint64_t>(end, r.address + r.size) -
+                                r.address;
+                for (uint64_t page = first / MIRROR_PAGE_SIZE;
+                     page * MIRROR_PAGE_SIZE < last; page++)
+                    dirty[page] = 1;
+            }
+            for (uint32_t i = 0; i < std::min<size_t>(sweep, dirty.size());
+                 i++) {
+                dirty[local.cursor] = 1;
+                local.cursor = (local.cursor + 1) % dirty.size();
             }
         }
-#ifdef DEBUG
-        printf("reply received:\n");
-        hexdump(ret.buffer, receive_length);
+        invalidated.clear();
+    }
+
+    /**
+     * Refreshes once, on the refreshing thread.
+     * @return The IPCStatus of the refresh.
+     */
+    auto Step() -> Shared::IPCStatus override {
+        Refresh();
+#ifdef C_FFI
+        return failed;
+#else
+        return Shared::Success;
 #endif
-        if (receive_length == 0) {
-            SetError(Fail);
-            return;
+    }
+
+  public:
+    /**
+     * Reads a memory mirror, from any process. @n
+     * Reads never block the mirror nor each other, and always see the
+     * memory of a region as of a single refresh.
+     */
+    class Reader {
+      protected:
+        /**
+         * The file mapped, nullptr if it could not be.
+         */
+        char *base = nullptr;
+
+        /**
+         * Size of the file.
+         */
+        size_t length = 0;
+
+      public:
+        /**
+         * Reader Initializer, mapping the file of a mirror.
+         * @param path The file of the mirror.
+         * @see Valid
+         */
+        Reader(const std::string &path) {
+            int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                return;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header)) {
+                void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED,
+                                 fd, 0);
+                if (mem != MAP_FAILED) {
+                    base = (char *)mem;
+                    length = st.st_size;
+                }
+            }
+            close(fd);
+
+            // the mirror might still be filling the file in, or not be one
+            const Header *header = (const Header *)base;
+            if (base &&
+                (header->magic.load(std::memory_order_acquire) != magic ||
+                 HeaderSize(header->count) > length)) {
+                munmap(base, length);
+                base = nullptr;
+            }
         }
 
-        if ((unsigned char)ret.buffer[4] == IPC_FAIL) {
-            SetError(Fail);
-            return;
+        Reader(const Reader &) = delete;
+        auto operator=(const Reader &) -> Reader & = delete;
+
+        /**
+         * Reader Destructor, unmapping the file.
+         */
+        ~Reader() {
+            if (base)
+                munmap(base, length);
         }
 
-        // batch commands are a bit more complex than you'd expect: some replies
-        // are VLE, so we need to relocate accordingly all future replies by an
-        // offset to ensure GetReply points to the correct buffer location.
-        // We can do it in an O(n) way by storing the global relocation offset
-        // and applying it to all future commands in one go instead of doing it
-        // in an O(n^2) and updating the list every time we encounter an offset
-        // update.
-        // why not just assume a standard size instead of going through the pain
-        // of relocating everything in the protocol? math is cheap, io isn't.
-        if constexpr (std::is_same<T, BatchCommand>::value) {
-            if (cmd.reloc) {
-                unsigned int reloc_add = 0;
-                for (unsigned int i = 0; i < cmd.msg_size; i++) {
-                    cmd.return_locations[i] += reloc_add;
-                    if ((cmd.return_locations[i] & 0x80000000) != 0) {
-                        cmd.return_locations[i] =
-                            (cmd.return_locations[i] & ~0x80000000);
-                        reloc_add += FromArray<uint32_t>(
-                            ret.buffer, (cmd.return_locations[i]));
-                    }
-                }
+        /**
+         * Whether the file could be mapped and is a memory mirror.
+         */
+        auto Valid() const -> bool { return base != nullptr; }
+
+        /**
+         * Number of refreshes the mirror went through, eg to know whether
+         * it is still being refreshed.
+         */
+        auto Refreshes() const -> uint64_t {
+            if (!base)
+                return 0;
+            return ((const Header *)base)
+                ->refreshes.load(std::memory_order_acquire);
+        }
+
+        /**
+         * Reads mirrored memory.
+         * @param address The address of the memory.
+         * @param size Size of the memory, in a single region.
+         * @param dst Where to store the memory.
+         * @return false if no region holds the whole memory.
+         */
+        auto Read(uint32_t address, uint32_t size, void *dst) const -> bool {
+            if (!base)
+                return false;
+            const Mapped *mapped = Find((const Header *)base, address, size);
+            if (!mapped || mapped->offset + mapped->size > length)
+                return false;
+            Load(base, *mapped, address, size, dst);
+            return true;
+        }
+
+        /**
+         * Reads a mirrored value.
+         * @param address The address of the value.
+         * @param value Where to store the value.
+         * @param Y The type of the value (eg uint8_t).
+         * @return false if no region holds the value.
+         */
+        template <typename Y>
+        auto Read(uint32_t address, Y &value) const -> bool {
+            return Read(address, sizeof(Y), &value);
+        }
+    };
+
+    /**
+     * MemoryMirror Initializer. @n
+     * Creates the file of the mirror, replacing the previous one: readers
+     * still mapping the latter keep reading it. Every page gets read on the
+     * first refresh, refreshes only starting once Start gets called.
+     * @param ipc The IPC session refreshing the mirror, outliving it.
+     * @param path The file of the mirror, eg in /dev/shm.
+     * @param mirrored The regions to mirror.
+     * @param interval Time between two refreshes.
+     * @see Valid
+     */
+    MemoryMirror(Shared &ipc, const std::string &path,
+                 const std::vector<Region> &mirrored,
+                 std::chrono::microseconds interval =
+                     std::chrono::milliseconds(16))
+        : Periodic(interval), ipc(ipc) {
+        size_t size = HeaderSize(mirrored.size());
+        std::vector<uint64_t> offsets;
+        for (const Region &r : mirrored) {
+            offsets.push_back(size);
+            size += (r.size + MIRROR_PAGE_SIZE - 1) / MIRROR_PAGE_SIZE *
+                    MIRROR_PAGE_SIZE;
+        }
+
+        unlink(path.c_str());
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                      0644);
+        if (fd < 0)
+            return;
+        if (ftruncate(fd, size) == 0) {
+            void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+            if (mem != MAP_FAILED) {
+                base = (char *)mem;
+                length = size;
             }
         }
+        close(fd);
+        if (!base)
+            return;
+
+        Header *header = (Header *)base;
+        Mapped *mapped = (Mapped *)&header[1];
+        header->count = mirrored.size();
+        for (size_t i = 0; i < mirrored.size(); i++) {
+            const Region &r = mirrored[i];
+            mapped[i].address = r.address;
+            mapped[i].size = r.size;
+            mapped[i].offset = offsets[i];
+            regions.push_back(Local{
+                r, &mapped[i],
+                std::vector<char>(
+                    (r.size + MIRROR_PAGE_SIZE - 1) / MIRROR_PAGE_SIZE, 1) });
+        }
+        header->magic.store(magic, std::memory_order_release);
     }
 
     /**
-     * Initializes a batch command IPC message.  @n
-     * Batch IPC messages are preferred when dealing with a lot of IPC
-     * messages in a quick fashion. They are _very_ fast, 1000
-     * Write<uint8_t> are as fast as one Read<uint32_t> in non-batch mode,
-     * give or take, which is about 100µs. @n You'll have to build the IPC
-     * messages in advance, with this function and FinalizeBatch, and will
-     * have to send the command yourself, along with dealing with the
-     * extraction of return values, if need there is. It is a little bit
-     * less convenient than the standard IPC but has, at the very least, a
-     * 1000x speedup on big commands.
-     * @see batch_blocking
-     * @see batch_len
-     * @see reply_len
-     * @see arg_cnt
-     * @see FinalizeBatch
+     * MemoryMirror Destructor, stopping the refreshing thread. @n
+     * The file is left behind for the readers still mapping it, stale.
      */
-    auto InitializeBatch() -> void {
-        batch_blocking.lock();
-        ipc_blocking.lock();
-        // 0-3 = header size, 4 = opcode
-        batch_len = 4;
-        reply_len = 5;
-        needs_reloc = false;
-        arg_cnt = 0;
+    ~MemoryMirror() {
+        Stop();
+        if (base)
+            munmap(base, length);
     }
 
     /**
-     * Finalizes a batch command IPC message. @n
-     * WARNING: You will ALWAYS have to call a FinalizeBatch, even on
-     * exceptions, once an InitializeBatch has been called overthise the
-     * class will deadlock.
-     * @return A BatchCommand with:
-     *         * The IPCBuffer of the message.
-     *         * The IPCBuffer of the return.
-     *         * The argument location in the reply buffer.
-     * @see batch_blocking
-     * @see batch_len
-     * @see reply_len
-     * @see arg_cnt
-     * @see InitializeBatch
-     * @see IPCBuffer
-     * @see BatchCommand
+     * Whether the file of the mirror could be created.
      */
-    auto FinalizeBatch() -> BatchCommand {
-        // save size in IPC message header.
-        ToArray<uint32_t>(ipc_buffer, batch_len, 0);
-
-        // we copy our arrays to unblock the IPC class.
-        uint16_t bl = batch_len;
-        int rl = needs_reloc ? MAX_IPC_RETURN_SIZE : reply_len;
-        char *c_cmd = new char[batch_len];
-        memcpy(c_cmd, ipc_buffer, batch_len * sizeof(char));
-        char *c_ret = new char[rl];
-        memcpy(c_ret, ret_buffer, rl * sizeof(char));
-        unsigned int *arg_place = new unsigned int[arg_cnt];
-        memcpy(arg_place, batch_arg_place, arg_cnt * sizeof(unsigned int));
+    auto Valid() const -> bool { return base != nullptr; }
 
-        // we unblock the mutex
-        batch_blocking.unlock();
-        ipc_blocking.unlock();
+    /**
+     * Marks memory as changed, so that the pages of the regions not watched
+     * holding it get read on the next refresh, eg after loading a state.
+     * @param address The address of the memory.
+     * @param size Size of the memory.
+     */
+    auto Invalidate(uint32_t address, uint32_t size) -> void {
+        std::lock_guard<std::mutex> lock(pending_blocking);
+        invalidated.emplace_back(address, size);
+    }
 
-        // MultiCommand is done!
-        return BatchCommand{ IPCBuffer{ bl, c_cmd }, IPCBuffer{ rl, c_ret },
-                             arg_place, arg_cnt, needs_reloc };
+    /**
+     * Sets how many pages of each region not watched get read on every
+     * refresh on top of the ones invalidated, from the next refresh on.
+     * @param pages Number of pages.
+     */
+    auto SetSweep(uint32_t pages) -> void {
+        std::lock_guard<std::mutex> lock(pending_blocking);
+        sweep = pages;
     }
 
     /**
-     * Reads a value from the emulator's memory. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX YY YY YY YY @n
-     * Legend: XX = IPC Tag, YY = Address. @n
-     * Return: (ZZ*??) @n
-     * Legend: ZZ = Value read.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @see GetReply
-     * @param address The address to read.
-     * @param T Flag to enable batch processing or not.
-     * @param Y The type of the variable to read (eg uint8_t).
-     * @return The value read in memory. If in batch mode the IPC message.
+     * Refreshes the mirror once, on the calling thread. @n
+     * On error throws an IPCStatus, Fail if the file could not be created,
+     * the pages marked getting read on the next refresh.
+     * @return The number of pages which changed.
      */
-    template <typename Y, bool T = false>
-    auto Read(uint32_t address) {
+    auto Refresh() -> uint32_t {
+        std::lock_guard<std::mutex> lock(refresh_blocking);
+#ifdef C_FFI
+        failed = base ? Shared::Success : Shared::Fail;
+        if (!base)
+            return 0;
+#else
+        if (!base)
+            throw Shared::Fail;
+#endif
+        Mark();
 
-        // easiest way to get tag into a constexpr is a lambda, necessary
-        // for GetReply
-        constexpr IPCCommand tag = []() -> IPCCommand {
-            switch (sizeof(Y)) {
-                case 1:
-                    return MsgRead8;
-                case 2:
-                    return MsgRead16;
-                case 4:
-                    return MsgRead32;
-                case 8:
-                    return MsgRead64;
-                default:
-                    return MsgUnimplemented;
+        // runs of pages to read, along with the region they belong to
+        struct Run {
+            Local *local;
+            uint32_t first, count;
+        };
+        std::vector<Run> runs;
+        builder.Initialize(true);
+        constexpr uint32_t most = MAX_RANGE_SIZE / MIRROR_PAGE_SIZE;
+        for (auto &local : regions) {
+            auto &dirty = local.dirty;
+            for (uint32_t page = 0; page < dirty.size(); page++) {
+                if (!dirty[page])
+                    continue;
+                uint32_t count = 1;
+                while (page + count < dirty.size() && dirty[page + count] &&
+                       count < most)
+                    count++;
+                uint32_t offset = page * MIRROR_PAGE_SIZE;
+                builder.ReadRange(
+                    local.region.address + offset,
+                    std::min(count * MIRROR_PAGE_SIZE,
+                             local.region.size - offset));
+                runs.push_back(Run{ &local, page, count });
+                page += count - 1;
+            }
+        }
+        if (!runs.empty()) {
+            builder.Finalize(batch);
+            ipc.SendCommand(batch);
+#ifdef C_FFI
+            failed = ipc.GetError();
+            if (failed != Shared::Success)
+                return 0;
+#endif
+        }
+
+        // only the pages which changed get copied, under the sequence of
+        // their region
+        uint32_t changed = 0;
+        Local *copying = nullptr;
+        for (unsigned int i = 0; i < runs.size(); i++) {
+            Local &local = *runs[i].local;
+            const char *bytes =
+                ipc.GetReply<Shared::MsgReadRange>(batch, (int)i);
+            for (uint32_t j = 0; j < runs[i].count; j++) {
+                uint32_t offset = (runs[i].first + j) * MIRROR_PAGE_SIZE;
+                uint32_t size = std::min<uint32_t>(MIRROR_PAGE_SIZE,
+                                                   local.region.size - offset);
+                const char *page = &bytes[j * MIRROR_PAGE_SIZE];
+                char *dst = &base[local.mapped->offset + offset];
+                local.dirty[runs[i].first + j] = 0;
+                if (memcmp(dst, page, size) == 0)
+                    continue;
+                if (copying != &local) {
+                    if (copying)
+                        copying->mapped->sequence.fetch_add(
+                            1, std::memory_order_release);
+                    copying = &local;
+                    copying->mapped->sequence.fetch_add(
+                        1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_release);
+                }
+                memcpy(dst, page, size);
+                changed++;
             }
-        }();
-        if constexpr (tag == MsgUnimplemented) {
-            SetError(Unimplemented);
-            return;
         }
+        if (copying)
+            copying->mapped->sequence.fetch_add(1, std::memory_order_release);
+        ((Header *)base)->refreshes.fetch_add(1, std::memory_order_release);
+        return changed;
+    }
+};
+#endif
+
+/**
+ * Searches a region of the emulator's memory for values, narrowing the
+ * candidates down scan after scan, like the scanners of cheat tools. @n
+ * The first scan snapshots the whole region with range commands, every
+ * value of it being a candidate. While candidates are many they are kept
+ * as a bitmap along with the snapshot, and compared 64 at a time without
+ * branching, spread over every core. Once few enough they are kept as a
+ * sorted array of addresses along with their values, and the following
+ * scans only gather these. @n
+ * On error throws an IPCStatus, the candidates staying as they were.
+ * @param Y The type of the values (eg uint32_t, float).
+ * @see Shared::ReadRange
+ * @see Shared::ReadGather
+ */
+template <typename Y> class Scanner {
+    static_assert(sizeof(Y) == 1 || sizeof(Y) == 2 || sizeof(Y) == 4 ||
+                      sizeof(Y) == 8,
+                  "unsupported width");
+
+  public:
+    /**
+     * How values get compared, either to the arguments of the scan or to
+     * their value as of the previous scan.
+     */
+    enum Comparison {
+        Exact,     /**< Equal to a. */
+        Between,   /**< Between a and b, both included. */
+        Changed,   /**< Different from the previous value. */
+        Unchanged, /**< Same as the previous value. */
+        Increased, /**< Greater than the previous value. */
+        Decreased  /**< Less than the previous value. */
+    };
+
+  protected:
+    /**
+     * The IPC session scanned.
+     */
+    Shared &ipc;
+
+    /**
+     * Start of the region scanned.
+     */
+    uint32_t address;
+
+    /**
+     * Size of the region scanned.
+     */
+    uint32_t size;
+
+    /**
+     * Distance between two values of the region.
+     */
+    uint32_t alignment;
+
+    /**
+     * Number of values of the region.
+     */
+    size_t slots;
+
+    /**
+     * Number of candidates left.
+     */
+    size_t count = 0;
+
+    /**
+     * Whether the region got scanned yet.
+     */
+    bool started = false;
+
+    /**
+     * Whether candidates are kept as a bitmap, or as an array.
+     */
+    bool dense = true;
+
+    /**
+     * Candidates while dense, one bit per value of the region.
+     */
+    std::vector<uint64_t> bitmap;
+
+    /**
+     * The region as of the previous scan, while dense.
+     */
+    std::vector<char> snapshot;
 
-        // batch mode
-        if constexpr (T) {
-            if (BatchSafetyChecks(5, sizeof(Y))) {
-                SetError(OutOfMemory);
-                return (char *)0;
-            }
-            char *cmd =
-                FormatBeginning<true>(&ipc_buffer[batch_len], address, tag);
-            batch_len += 5;
-            batch_arg_place[arg_cnt] = reply_len;
-            reply_len += sizeof(Y);
-            arg_cnt += 1;
-            return cmd;
-        } else {
-            // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            IPCBuffer cmd =
-                IPCBuffer{ 4 + 5,
-                           FormatBeginning(ipc_buffer, address, tag, 4 + 5) };
-            IPCBuffer ret = IPCBuffer{ 1 + sizeof(Y) + 4, ret_buffer };
-            SendCommand(cmd, ret);
-            return GetReply<tag>(ret_buffer, 5);
-        }
-    }
+    /**
+     * The region as of the current scan, while dense.
+     */
+    std::vector<char> current;
 
     /**
-     * Writes a value to the emulator's game memory. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX YY YY YY YY (ZZ*??) @n
-     * Legend: XX = IPC Tag, YY = Address, ZZ = Value.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param address The address to write to.
-     * @param value The value to write.
-     * @param T Flag to enable batch processing or not.
-     * @param Y The type of the variable to write (eg uint8_t).
-     * @return If in batch mode the IPC message otherwise void.
+     * Addresses of the candidates once sparse, sorted.
      */
-    template <typename Y, bool T = false>
-    auto Write(uint32_t address, Y value) {
+    std::vector<uint32_t> candidates;
 
-        // easiest way to get tag into a constexpr is a lambda, necessary
-        // for GetReply
-        constexpr IPCCommand tag = []() -> IPCCommand {
-            switch (sizeof(Y)) {
-                case 1:
-                    return MsgWrite8;
-                case 2:
-                    return MsgWrite16;
-                case 4:
-                    return MsgWrite32;
-                case 8:
-                    return MsgWrite64;
-                default:
-                    return MsgUnimplemented;
-            }
-        }();
-        if constexpr (tag == MsgUnimplemented) {
-            SetError(Unimplemented);
-            return;
-        }
+    /**
+     * Values of the candidates as of the previous scan, once sparse.
+     */
+    std::vector<Y> values;
 
-        // batch mode
-        if constexpr (T) {
-            if (BatchSafetyChecks(5 + sizeof(Y))) {
-                SetError(OutOfMemory);
-                return (char *)0;
-            }
-            char *cmd = ToArray<Y>(
-                FormatBeginning<true>(&ipc_buffer[batch_len], address, tag),
-                value, 5);
-            batch_len += 5 + sizeof(Y);
-            arg_cnt += 1;
-            return cmd;
-        } else {
-            // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            int size = 4 + 5 + sizeof(Y);
-            char *cmd = ToArray(FormatBeginning(ipc_buffer, address, tag, size),
-                                value, 4 + 5);
-            SendCommand(IPCBuffer{ size, cmd }, IPCBuffer{ 1 + 4, ret_buffer });
-            return;
-        }
-    }
+    /**
+     * Values of the candidates as of the current scan, once sparse.
+     */
+    std::vector<Y> fetched;
 
     /**
-     * Retrieves the emulator's version. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX @n
-     * Legend: XX = IPC Tag. @n
-     * Return: YY YY YY YY (ZZ*??) @n
-     * Legend: YY = string size, ZZ = version string.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise the version
-     * string. @n
-     * /!\ If not in batch mode this function passes ownership of a
-     * datastream to you, do not forget to free it!
+     * Value of the region at a slot.
+     * @param memory The region.
+     * @param slot The slot.
+     * @return The value.
      */
-    template <bool T = false>
-    auto Version() {
-        constexpr IPCCommand tag = MsgVersion;
-        return StringCommands<tag, T>();
+    auto At(const std::vector<char> &memory, size_t slot) const -> Y {
+        Y value;
+        memcpy(&value, &memory[slot * alignment], sizeof(Y));
+        return value;
     }
 
     /**
-     * Retrieves emulator status. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX @n
-     * Legend: XX = IPC Tag. @n
-     * Return: ZZ ZZ ZZ ZZ @n
-     * Legend: ZZ = emulator status.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise the emulator
-     * status.
+     * Copies out up to 64 values of the region.
+     * @param memory The region.
+     * @param first The slot of the first value.
+     * @param n The number of values.
+     * @param values Where to store the values.
      */
-    template <bool T = false>
-    auto Status() {
-        constexpr IPCCommand tag = MsgStatus;
-        // batch mode
-        if constexpr (T) {
-            if (BatchSafetyChecks(1, 4)) {
-                SetError(OutOfMemory);
-                return (char *)0;
-            }
-            char *cmd = &ipc_buffer[batch_len];
-            cmd[0] = tag;
-            batch_len += 1;
-            batch_arg_place[arg_cnt] = reply_len;
-            reply_len += 4;
-            arg_cnt += 1;
-            return cmd;
-        } else {
-            // we are already locked in batch mode
-            std::lock_guard<std::mutex> lock(ipc_blocking);
-            ToArray(ipc_buffer, 4 + 1, 0);
-            ipc_buffer[4] = tag;
-            SendCommand(IPCBuffer{ 4 + 1, ipc_buffer },
-                        IPCBuffer{ 4 + 1 + 4, ret_buffer });
-            return GetReply<tag>(ret_buffer, 5);
+    auto Load(const std::vector<char> &memory, size_t first, size_t n,
+              Y *values) const -> void {
+        if (alignment == sizeof(Y)) {
+            memcpy(values, &memory[first * sizeof(Y)], n * sizeof(Y));
+            return;
         }
+        for (size_t b = 0; b < n; b++)
+            values[b] = At(memory, first + b);
     }
 
     /**
-     * Retrieves the game title. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX @n
-     * Legend: XX = IPC Tag. @n
-     * Return: YY YY YY YY (ZZ*??) @n
-     * Legend: YY = string size, ZZ = title string.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise the version
-     * string. @n
-     * /!\ If not in batch mode this function passes ownership of a
-     * datastream to you, do not forget to free it!
+     * Narrows the bitmap down to the values matching, over every core.
+     * @param match Whether a value, along with its previous one, matches.
+     * @param previous The region as of the previous scan.
      */
-    template <bool T = false>
-    auto GetGameTitle() {
-        constexpr IPCCommand tag = MsgTitle;
-        return StringCommands<tag, T>();
+    template <typename F>
+    auto NarrowDense(F match, const std::vector<char> &previous) -> void {
+        size_t words = bitmap.size();
+        // 64Ki values per thread at least, not worth it otherwise
+        size_t threads = std::min<size_t>(
+            std::max(std::thread::hardware_concurrency(), 1u),
+            std::max<size_t>(words / 1024, 1));
+        std::vector<size_t> counts(threads, 0);
+        auto work = [&](size_t t) {
+            size_t kept = 0;
+            for (size_t w = words * t / threads; w < words * (t + 1) / threads;
+                 w++) {
+                if (bitmap[w] == 0)
+                    continue;
+                size_t first = w * 64;
+                size_t n = std::min<size_t>(64, slots - first);
+                // compared apart from being packed into bits, so that the
+                // comparisons get vectorized
+                Y now[64] = {}, before[64] = {};
+                Load(current, first, n, now);
+                Load(previous, first, n, before);
+                unsigned char hits[64];
+                for (size_t b = 0; b < 64; b++)
+                    hits[b] = match(now[b], before[b]);
+                uint64_t bits = 0;
+                for (size_t b = 0; b < 64; b++)
+                    bits |= (uint64_t)hits[b] << b;
+                bitmap[w] &= bits;
+                kept += std::bitset<64>(bitmap[w]).count();
+            }
+            counts[t] = kept;
+        };
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; t++)
+            pool.emplace_back(work, t);
+        work(0);
+        for (auto &thread : pool)
+            thread.join();
+        count = 0;
+        for (size_t kept : counts)
+            count += kept;
+        snapshot.swap(current);
     }
 
     /**
-     * Retrieves the game ID. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX @n
-     * Legend: XX = IPC Tag. @n
-     * Return: YY YY YY YY (ZZ*??) @n
-     * Legend: YY = string size, ZZ = ID string.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise the version
-     * string. @n
-     * /!\ If not in batch mode this function passes ownership of a
-     * datastream to you, do not forget to free it!
+     * Narrows the array down to the values matching.
+     * @param match Whether a value, along with its previous one, matches.
      */
-    template <bool T = false>
-    auto GetGameID() {
-        constexpr IPCCommand tag = MsgID;
-        return StringCommands<tag, T>();
+    template <typename F> auto NarrowSparse(F match) -> void {
+        fetched.resize(candidates.size());
+        ipc.ReadGather(candidates.data(), candidates.size(), fetched.data());
+        size_t kept = 0;
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (match(fetched[i], values[i])) {
+                candidates[kept] = candidates[i];
+                values[kept] = fetched[i];
+                kept++;
+            }
+        }
+        candidates.resize(kept);
+        values.resize(kept);
+        count = kept;
     }
 
     /**
-     * Retrieves the game UUID. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX @n
-     * Legend: XX = IPC Tag. @n
-     * Return: YY YY YY YY (ZZ*??) @n
-     * Legend: YY = string size, ZZ = UUID string.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise the version
-     * string. @n
-     * /!\ If not in batch mode this function passes ownership of a
-     * datastream to you, do not forget to free it!
+     * Narrows the candidates down to the values matching.
+     * @param match Whether a value, along with its previous one, matches.
+     * @return The number of candidates left.
      */
-    template <bool T = false>
-    auto GetGameUUID() {
-        constexpr IPCCommand tag = MsgUUID;
-        return StringCommands<tag, T>();
+    template <typename F> auto Narrow(F match) -> size_t {
+        if (!dense) {
+            NarrowSparse(match);
+            return count;
+        }
+        current.resize(size);
+        ipc.ReadRange(address, size, current.data());
+        if (!started) {
+            // every value is a candidate, compared to itself
+            bitmap.assign((slots + 63) / 64, ~0ull);
+            if (slots % 64)
+                bitmap.back() = (1ull << (slots % 64)) - 1;
+            started = true;
+            NarrowDense(match, current);
+        } else {
+            NarrowDense(match, snapshot);
+        }
+
+        // an address and a value per candidate now take less than the
+        // snapshot
+        if (count * (4 + sizeof(Y)) < size) {
+            for (const auto &[candidate, value] : Results()) {
+                candidates.push_back(candidate);
+                values.push_back(value);
+            }
+            std::vector<uint64_t>().swap(bitmap);
+            std::vector<char>().swap(snapshot);
+            std::vector<char>().swap(current);
+            dense = false;
+        }
+        return count;
     }
 
+  public:
     /**
-     * Retrieves the game version. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX @n
-     * Legend: XX = IPC Tag. @n
-     * Return: YY YY YY YY (ZZ*??) @n
-     * Legend: YY = string size, ZZ = game version string.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise the game version
-     * string. @n
-     * /!\ If not in batch mode this function passes ownership of a
-     * datastream to you, do not forget to free it!
+     * Scanner Initializer. @n
+     * Nothing gets read until the first scan.
+     * @param ipc The IPC session to scan, outliving the scanner.
+     * @param address Start of the region to scan.
+     * @param size Size of the region to scan.
+     * @param alignment Distance between two values, their width by default.
      */
-    template <bool T = false>
-    auto GetGameVersion() {
-        constexpr IPCCommand tag = MsgGameVersion;
-        return StringCommands<tag, T>();
+    Scanner(Shared &ipc, uint32_t address, uint32_t size,
+            uint32_t alignment = sizeof(Y))
+        : ipc(ipc), address(address), size(size),
+          alignment(std::max(alignment, 1u)) {
+        slots = size < sizeof(Y) ? 0 : (size - sizeof(Y)) / this->alignment + 1;
     }
 
     /**
-     * Asks the emulator to save a savestate. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX YY @n
-     * Legend: XX = IPC Tag, YY = Slot.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param slot The savestate slot to use.
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise void.
+     * Keeps the candidates matching a comparison. @n
+     * On the first scan every value of the region is a candidate, its
+     * previous value being itself: scanning for Unchanged values then starts
+     * from an unknown value.
+     * @param comparison How values get compared.
+     * @param a First argument of the comparison, if any.
+     * @param b Second argument of the comparison, if any.
+     * @return The number of candidates left.
+     * @see Comparison
      */
-    template <bool T = false>
-    auto SaveState(uint8_t slot) {
-        constexpr IPCCommand tag = MsgSaveState;
-        return EmuState<tag, T>(slot);
+    auto Scan(Comparison comparison, Y a = Y(), Y b = Y()) -> size_t {
+        switch (comparison) {
+            case Exact:
+                return Narrow([a](Y v, Y) { return v == a; });
+            case Between:
+                return Narrow([a, b](Y v, Y) { return v >= a && v <= b; });
+            case Changed:
+                return Narrow([](Y v, Y p) { return v != p; });
+            case Unchanged:
+                return Narrow([](Y v, Y p) { return v == p; });
+            case Increased:
+                return Narrow([](Y v, Y p) { return v > p; });
+            default:
+                return Narrow([](Y v, Y p) { return v < p; });
+        }
     }
 
     /**
-     * Asks the emulator to load a savestate. @n
-     * On error throws an IPCStatus. @n
-     * Format: XX YY @n
-     * Legend: XX = IPC Tag, YY = Slot.
-     * @see IPCCommand
-     * @see IPCStatus
-     * @param slot The savestate slot to use.
-     * @param T Flag to enable batch processing or not.
-     * @return If in batch mode the IPC message otherwise void.
+     * Gets the number of candidates left.
+     * @return The number of candidates.
      */
-    template <bool T = false>
-    auto LoadState(uint8_t slot) {
-        constexpr IPCCommand tag = MsgLoadState;
-        return EmuState<tag, T>(slot);
-    }
+    auto Count() const -> size_t { return count; }
 
     /**
-     * Shared Initializer.
-     * @param slot Slot to use for this IPC session.
-     * @param emulator_name Emulator name to use for this IPC session.
-     * @param default_slot Whether this is the default slot for the emulator
-     * or not.
-     * @see slot
+     * Gets the candidates left, in order of their addresses.
+     * @param max Number of candidates to get at most.
+     * @return The addresses of the candidates along with their value as of
+     * the last scan.
      */
-    Shared(const unsigned int slot, const std::string emulator_name,
-           const bool default_slot) {
-        // some basic input sanitization
-        if (slot > 65536) {
-            SetError(NoConnection);
-            return;
-        }
-        this->slot = slot;
-#ifdef _WIN32
-        // We initialize winsock.
-        WSADATA wsa;
-        WSAStartup(MAKEWORD(2, 2), &wsa);
-#else
-        char *runtime_dir = nullptr;
-#ifdef __APPLE__
-        runtime_dir = std::getenv("TMPDIR");
-#else
-        runtime_dir = std::getenv("XDG_RUNTIME_DIR");
-#endif
-        // fallback in case macOS or other OSes don't implement the XDG base
-        // spec
-        if (runtime_dir == nullptr)
-            SOCKET_NAME = "/tmp/" + emulator_name + ".sock";
-        else {
-            SOCKET_NAME = runtime_dir;
-            SOCKET_NAME += "/" + emulator_name + ".sock";
-        }
-
-        if (!default_slot) {
-            SOCKET_NAME += "." + std::to_string(slot);
+    auto Results(size_t max = SIZE_MAX) const
+        -> std::vector<std::pair<uint32_t, Y>> {
+        std::vector<std::pair<uint32_t, Y>> results;
+        if (!dense) {
+            for (size_t i = 0; i < candidates.size() && i < max; i++)
+                results.emplace_back(candidates[i], values[i]);
+            return results;
         }
-#endif
-        // we allocate once buffers to not have to do mallocs for each IPC
-        // request, as malloc is expansive when we optimize for µs.
-        ret_buffer = new char[MAX_IPC_RETURN_SIZE];
-        ipc_buffer = new char[MAX_IPC_SIZE];
-        batch_arg_place = new unsigned int[MAX_BATCH_REPLY_COUNT];
-        InitSocket();
+        for (size_t w = 0; w < bitmap.size() && results.size() < max; w++)
+            for (size_t b = 0; b < 64 && results.size() < max; b++)
+                if ((bitmap[w] >> b) & 1)
+                    results.emplace_back(
+                        address + (w * 64 + b) * alignment,
+                        At(snapshot, w * 64 + b));
+        return results;
     }
 
     /**
-     * Shared Destructor.
+     * Starts over, the next scan snapshotting the whole region again.
      */
-    virtual ~Shared() {
-        // We clean up winsock.
-#ifdef _WIN32
-        WSACleanup();
-#endif
-        delete[] ret_buffer;
-        delete[] ipc_buffer;
-        delete[] batch_arg_place;
+    auto Reset() -> void {
+        started = false;
+        dense = true;
+        count = 0;
+        bitmap.clear();
+        snapshot.clear();
+        candidates.clear();
+        values.clear();
     }
 };
 
@@ -1130,10 +7704,13 @@ class PCSX2 : public Shared {
     /**
      * PCSX2 session Initializer with a specified slot.
      * @param slot Slot to use for this IPC session.
+     * @param type Transport to use for this IPC session.
      * @see slot
+     * @see TransportType
      */
-    PCSX2(const unsigned int slot = 0)
-        : Shared((slot == 0) ? 28011 : slot, "pcsx2", (slot == 0)){};
+    PCSX2(const unsigned int slot = 0,
+          const TransportType type = DefaultTransport)
+        : Shared((slot == 0) ? 28011 : slot, "pcsx2", (slot == 0), type){};
 };
 
 class RPCS3 : public Shared {
@@ -1141,10 +7718,13 @@ class RPCS3 : public Shared {
     /**
      * RPCS3 session Initializer with a specified slot.
      * @param slot Slot to use for this IPC session.
+     * @param type Transport to use for this IPC session.
      * @see slot
+     * @see TransportType
      */
-    RPCS3(const unsigned int slot = 0)
-        : Shared((slot == 0) ? 28012 : slot, "rpcs3", (slot == 0)){};
+    RPCS3(const unsigned int slot = 0,
+          const TransportType type = DefaultTransport)
+        : Shared((slot == 0) ? 28012 : slot, "rpcs3", (slot == 0), type){};
 };
 
 }; // namespace PINE
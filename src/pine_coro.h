@@ -0,0 +1,502 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "pine_coro.h needs C++20 coroutines, use pine.h on older standards"
+#endif
+
+#include "pine.h"
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <map>
+#include <utility>
+
+/**
+ * Coroutine flavor of the PINE API. @n
+ * Optional companion of pine.h for C++20 users: co_await IPC commands from
+ * coroutines instead of blocking a thread or nesting callbacks, so a single
+ * thread can run hundreds of scripts, each one a plain sequence of dependent
+ * reads. @n
+ *
+ * @code
+ * PINE::Task<> script(PINE::Awaitable &ipc) {
+ *     uint32_t ptr = co_await ipc.Read<uint32_t>(0x00347D34);
+ *     while (co_await ipc.Read<uint32_t>(ptr) != 5)
+ *         co_await ipc.Sleep(std::chrono::milliseconds(16));
+ * }
+ *
+ * PINE::PCSX2 pcsx2;
+ * PINE::Scheduler scheduler;
+ * PINE::Awaitable ipc(pcsx2, scheduler);
+ * scheduler.Spawn(script(ipc));
+ * scheduler.Run();
+ * @endcode
+ */
+namespace PINE {
+
+template <typename T>
+class TaskPromise;
+
+/**
+ * Coroutine returning a T. @n
+ * Tasks are lazy: they start when awaited by another task, or when spawned
+ * on a Scheduler, and resume their awaiter once done. Exceptions thrown by
+ * the task are rethrown to its awaiter.
+ * @see Scheduler::Spawn
+ */
+template <typename T = void>
+class Task {
+  public:
+    using promise_type = TaskPromise<T>;
+
+  protected:
+    /**
+     * The coroutine, owned by the task.
+     */
+    std::coroutine_handle<promise_type> handle;
+
+  public:
+    auto await_ready() -> bool { return false; }
+
+    auto await_suspend(std::coroutine_handle<> awaiter)
+        -> std::coroutine_handle<> {
+        handle.promise().continuation = awaiter;
+        return handle;
+    }
+
+    auto await_resume() -> T { return handle.promise().Result(); }
+
+    /**
+     * Task Initializer.
+     * @param handle The coroutine.
+     */
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : handle(handle) {}
+
+    Task(Task &&other) : handle(std::exchange(other.handle, nullptr)) {}
+    Task(const Task &) = delete;
+
+    /**
+     * Task Destructor.
+     */
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+};
+
+/**
+ * Promise of a Task, common to every return type.
+ */
+class TaskPromiseBase {
+  public:
+    /**
+     * Coroutine to resume once done.
+     */
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+    /**
+     * Exception thrown by the task, if any.
+     */
+    std::exception_ptr exception;
+
+    /**
+     * Resumes the awaiter of a finished task.
+     */
+    struct FinalAwaiter {
+        auto await_ready() noexcept -> bool { return false; }
+
+        template <typename P>
+        auto await_suspend(std::coroutine_handle<P> h) noexcept
+            -> std::coroutine_handle<> {
+            return h.promise().continuation;
+        }
+
+        auto await_resume() noexcept -> void {}
+    };
+
+    auto initial_suspend() noexcept -> std::suspend_always { return {}; }
+    auto final_suspend() noexcept -> FinalAwaiter { return {}; }
+    auto unhandled_exception() -> void {
+        exception = std::current_exception();
+    }
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+  protected:
+    /**
+     * Value returned by the task.
+     */
+    T value{};
+
+  public:
+    auto get_return_object() -> Task<T> {
+        return Task<T>(std::coroutine_handle<TaskPromise>::from_promise(*this));
+    }
+
+    auto return_value(T v) -> void { value = std::move(v); }
+
+    /**
+     * Gets the value returned by the task.
+     * @return The value, or the exception thrown by the task.
+     */
+    auto Result() -> T {
+        if (exception)
+            std::rethrow_exception(exception);
+        return std::move(value);
+    }
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+  public:
+    auto get_return_object() -> Task<void> {
+        return Task<void>(
+            std::coroutine_handle<TaskPromise>::from_promise(*this));
+    }
+
+    auto return_void() -> void {}
+
+    /**
+     * Rethrows the exception thrown by the task, if any.
+     */
+    auto Result() -> void {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+/**
+ * Single threaded coroutine scheduler. @n
+ * Runs spawned tasks on the thread calling Run, resuming them as the replies
+ * of their IPC commands arrive. Replies are collected by the reactor of the
+ * IPC sessions, which hands over their coroutine to the scheduler; a
+ * coroutine is never resumed on any other thread.
+ * @see Awaitable
+ */
+class Scheduler {
+  public:
+    using clock = std::chrono::steady_clock;
+
+  protected:
+    /**
+     * Coroutine owning a spawned task, destroyed once it is done.
+     */
+    struct Root {
+        struct promise_type {
+            auto get_return_object() -> Root { return {}; }
+            auto initial_suspend() noexcept -> std::suspend_never {
+                return {};
+            }
+            auto final_suspend() noexcept -> std::suspend_never { return {}; }
+            auto return_void() -> void {}
+            auto unhandled_exception() -> void { std::terminate(); }
+        };
+    };
+
+  public:
+    /**
+     * Resumes a coroutine once ready.
+     * @see Yield
+     * @see Sleep
+     */
+    struct Awaiter {
+        Scheduler *scheduler;
+        clock::time_point until;
+        auto await_ready() -> bool { return false; }
+        auto await_suspend(std::coroutine_handle<> h) -> void {
+            if (until == clock::time_point())
+                scheduler->Post(h);
+            else
+                scheduler->sleeping.emplace(until, h);
+        }
+        auto await_resume() -> void {}
+    };
+
+  protected:
+    /**
+     * Protects ready.
+     */
+    std::mutex blocking;
+
+    /**
+     * Signaled when a coroutine is ready to be resumed.
+     */
+    std::condition_variable posted;
+
+    /**
+     * Coroutines ready to be resumed, in order.
+     */
+    std::deque<std::coroutine_handle<>> ready;
+
+    /**
+     * Sleeping coroutines, by wake up time. Only touched by the scheduler
+     * thread.
+     */
+    std::multimap<clock::time_point, std::coroutine_handle<>> sleeping;
+
+    /**
+     * Number of spawned tasks not done yet.
+     */
+    unsigned int remaining = 0;
+
+    /**
+     * First exception thrown by a spawned task.
+     */
+    std::exception_ptr error;
+
+    /**
+     * Awaits a task, then accounts for it.
+     * @param task The spawned task.
+     */
+    auto Own(Task<> task) -> Root {
+        // waits for Run to start the task
+        co_await Yield();
+        try {
+            co_await task;
+        } catch (...) {
+            if (!error)
+                error = std::current_exception();
+        }
+        remaining -= 1;
+    }
+
+  public:
+    /**
+     * Hands a coroutine over to the scheduler, from any thread.
+     * @param h The coroutine to resume.
+     */
+    auto Post(std::coroutine_handle<> h) -> void {
+        {
+            std::lock_guard<std::mutex> lock(blocking);
+            ready.push_back(h);
+        }
+        posted.notify_one();
+    }
+
+    /**
+     * Suspends the current coroutine, letting the other ready ones run
+     * first.
+     */
+    auto Yield() -> Awaiter { return Awaiter{ this, clock::time_point() }; }
+
+    /**
+     * Suspends the current coroutine for some time, eg between two polls of
+     * a value.
+     * @param duration How long to sleep.
+     */
+    auto Sleep(clock::duration duration) -> Awaiter {
+        return Awaiter{ this, clock::now() + duration };
+    }
+
+    /**
+     * Adds a task to the scheduler. @n
+     * The task gets started by Run, and destroyed once done.
+     * @param task The task.
+     */
+    auto Spawn(Task<> task) -> void {
+        remaining += 1;
+        Own(std::move(task));
+    }
+
+    /**
+     * Runs the spawned tasks until they are all done. @n
+     * Rethrows the first exception thrown by one of them, once they are
+     * all done.
+     */
+    auto Run() -> void {
+        while (remaining > 0) {
+            std::coroutine_handle<> h;
+            {
+                std::unique_lock<std::mutex> lock(blocking);
+                while (true) {
+                    auto now = clock::now();
+                    while (!sleeping.empty() &&
+                           sleeping.begin()->first <= now) {
+                        ready.push_back(sleeping.begin()->second);
+                        sleeping.erase(sleeping.begin());
+                    }
+                    if (!ready.empty())
+                        break;
+                    if (sleeping.empty())
+                        posted.wait(lock);
+                    else
+                        posted.wait_until(lock, sleeping.begin()->first);
+                }
+                h = ready.front();
+                ready.pop_front();
+            }
+            h.resume();
+        }
+        if (error)
+            std::rethrow_exception(std::exchange(error, nullptr));
+    }
+};
+
+/**
+ * IPC command awaited by a coroutine. @n
+ * Sends its IPC message when awaited and resumes the coroutine through the
+ * scheduler once the reply arrives. Throws an IPCStatus on failure.
+ * @param Y The type of the reply.
+ * @see Awaitable
+ */
+template <typename Y>
+class Operation {
+  public:
+    /**
+     * Sends the IPC message, calling its argument on completion.
+     */
+    using Start =
+        std::function<void(std::function<void(Shared::IPCStatus, Y)>)>;
+
+  protected:
+    Scheduler &scheduler;
+    Start start;
+    Shared::IPCStatus status = Shared::Success;
+    Y value{};
+
+  public:
+    auto await_ready() -> bool { return false; }
+
+    auto await_suspend(std::coroutine_handle<> h) -> void {
+        start([this, h](Shared::IPCStatus s, Y v) {
+            status = s;
+            value = v;
+            scheduler.Post(h);
+        });
+    }
+
+    auto await_resume() -> Y {
+        if (status != Shared::Success)
+            throw status;
+        return value;
+    }
+
+    /**
+     * Operation Initializer.
+     * @param scheduler The scheduler resuming the awaiting coroutine.
+     * @param start Sends the IPC message.
+     */
+    Operation(Scheduler &scheduler, Start start)
+        : scheduler(scheduler), start(std::move(start)) {}
+};
+
+template <>
+class Operation<void> {
+  public:
+    using Start = std::function<void(std::function<void(Shared::IPCStatus)>)>;
+
+  protected:
+    Scheduler &scheduler;
+    Start start;
+    Shared::IPCStatus status = Shared::Success;
+
+  public:
+    auto await_ready() -> bool { return false; }
+
+    auto await_suspend(std::coroutine_handle<> h) -> void {
+        start([this, h](Shared::IPCStatus s) {
+            status = s;
+            scheduler.Post(h);
+        });
+    }
+
+    auto await_resume() -> void {
+        if (status != Shared::Success)
+            throw status;
+    }
+
+    Operation(Scheduler &scheduler, Start start)
+        : scheduler(scheduler), start(std::move(start)) {}
+};
+
+/**
+ * Awaitable view of an IPC session. @n
+ * Mirrors the blocking API, each command returning an Operation to
+ * co_await instead. Built on top of the asynchronous API, so the same
+ * pipeline limits apply.
+ * @see Shared::ReadAsync
+ */
+class Awaitable {
+  protected:
+    /**
+     * The IPC session.
+     */
+    Shared &ipc;
+
+    /**
+     * Scheduler running the coroutines awaiting IPC commands.
+     */
+    Scheduler &scheduler;
+
+  public:
+    /**
+     * Reads a value from the emulator's memory.
+     * @see Shared::Read
+     * @param address The address to read.
+     * @param Y The type of the variable to read (eg uint8_t).
+     * @return The value read, once awaited.
+     */
+    template <typename Y>
+    auto Read(uint32_t address) -> Operation<Y> {
+        return Operation<Y>(scheduler, [this, address](auto done) {
+            ipc.ReadAsync<Y>(address, done);
+        });
+    }
+
+    /**
+     * Writes a value to the emulator's memory.
+     * @see Shared::Write
+     * @param address The address to write to.
+     * @param value The value to write.
+     * @param Y The type of the variable to write (eg uint8_t).
+     */
+    template <typename Y>
+    auto Write(uint32_t address, Y value) -> Operation<void> {
+        return Operation<void>(scheduler, [this, address, value](auto done) {
+            ipc.WriteAsync<Y>(address, value, done);
+        });
+    }
+
+    /**
+     * Retrieves the emulator status.
+     * @see Shared::Status
+     * @return The emulator status, once awaited.
+     */
+    auto Status() -> Operation<Shared::EmuStatus> {
+        return Operation<Shared::EmuStatus>(
+            scheduler, [this](auto done) { ipc.StatusAsync(done); });
+    }
+
+    /**
+     * Sends a batch command, its replies read with GetReply.
+     * @see Shared::SendCommand
+     * @param cmd The batch command, alive until awaited.
+     */
+    auto Send(Shared::BatchCommand &cmd) -> Operation<void> {
+        return Operation<void>(scheduler, [this, &cmd](auto done) {
+            ipc.SendAsync(cmd, done);
+        });
+    }
+
+    /**
+     * Suspends the current coroutine for some time.
+     * @see Scheduler::Sleep
+     * @param duration How long to sleep.
+     */
+    auto Sleep(Scheduler::clock::duration duration) -> Scheduler::Awaiter {
+        return scheduler.Sleep(duration);
+    }
+
+    /**
+     * Awaitable Initializer.
+     * @param ipc The IPC session.
+     * @param scheduler Scheduler running the coroutines using it.
+     */
+    Awaitable(Shared &ipc, Scheduler &scheduler)
+        : ipc(ipc), scheduler(scheduler) {}
+};
+
+}; // namespace PINE
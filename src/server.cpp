@@ -0,0 +1,22 @@
+#include "server.h"
+#include <iostream>
+#include <stdio.h>
+
+// a standalone PINE stand-in server impersonating PCSX2, useful to hack on
+// the client example or your own tool without having to boot an emulator.
+//
+// usage: server [slot]
+auto main(int argc, char *argv[]) -> int {
+    unsigned int slot = (argc > 1) ? atoi(argv[1]) : 0;
+
+    PINE::PCSX2Server server(slot);
+    if (!server.Start()) {
+        printf("Could not open the server socket!\n");
+        return 1;
+    }
+    printf("PINE stand-in server listening, press enter to quit.\n");
+    getchar();
+    server.Stop();
+
+    return 0;
+}
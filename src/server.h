@@ -0,0 +1,792 @@
+#pragma once
+
+#include "pine.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The PINE stand-in server. @n
+ * This is a minimal server side implementation of the PINE protocol, backed by
+ * a simulated EE RAM instead of an actual emulator. @n
+ * It listens on the exact same socket as the target it impersonates, so an
+ * unmodified client can talk to it, and is used by the benchmark and the test
+ * suite to measure and exercise the API without having to boot PCSX2. @n
+ * It is by no means a replacement for a real PINE server: memory is just a
+ * flat buffer, strings are static and savestates are plain copies of it.
+ */
+namespace PINE {
+
+class Server {
+  public:
+    /**
+     * Size of the simulated EE RAM. @n
+     * 32 MiB, the size of the PS2 main memory.
+     */
+#define EE_RAM_SIZE 0x2000000
+
+    /**
+     * Simulated emulator memory. @n
+     * All memory IPC messages are served from this buffer, addresses are
+     * offsets into it.
+     * @see EE_RAM_SIZE
+     */
+    char *memory;
+
+    /**
+     * Strings replied to MsgVersion, MsgTitle, MsgID, MsgUUID and
+     * MsgGameVersion.
+     */
+    std::string version = "PCSX2 PINE stand-in server";
+    std::string title = "PINE STAND-IN";   /**< @see version */
+    std::string id = "SLUS_000.00";        /**< @see version */
+    std::string uuid = "00000000";         /**< @see version */
+    std::string game_version = "1.00";     /**< @see version */
+
+    /**
+     * Status replied to MsgStatus.
+     */
+    Shared::EmuStatus status = Shared::Running;
+
+    /**
+     * Number of IPC messages served, batches counting as one.
+     */
+    std::atomic<uint64_t> messages{ 0 };
+
+    /**
+     * Shared by every IPC message while it gets executed, so that locking it
+     * holds the server back, eg to let clients queue commands up. Messages
+     * get counted before.
+     * @see messages
+     */
+    std::shared_mutex hold;
+
+    /**
+     * Whether MsgReadRange and MsgWriteRange are served, to stand in for
+     * servers not knowing about them when unset.
+     */
+    bool ranges = true;
+
+    /**
+     * Whether MsgReadStrided and MsgReadGather are served, like ranges.
+     */
+    bool gathers = true;
+
+    /**
+     * Whether MsgReadPointer is served, like ranges.
+     */
+    bool pointers = true;
+
+  protected:
+    /**
+     * IPC Slot identifier. @n
+     * @see Shared::slot
+     */
+    uint16_t slot;
+
+#if defined(_WIN32) || defined(DOXYGEN)
+    /**
+     * Listening socket handler. @n
+     * On windows it uses the type SOCKET, on linux int.
+     */
+    SOCKET sock;
+#else
+    int sock;
+#endif
+
+#if !defined(_WIN32) || defined(DOXYGEN)
+    /**
+     * Unix socket name. @n
+     * @see Shared::SOCKET_NAME
+     */
+    std::string SOCKET_NAME;
+#endif
+
+    /**
+     * Transport clients have to use to reach the server. @n
+     * @see Shared::TransportType
+     */
+    Shared::TransportType type;
+
+    /**
+     * Whether the server is accepting connections or not.
+     */
+    std::atomic<bool> running{ false };
+
+    /**
+     * Thread accepting new connections.
+     */
+    std::thread listener;
+
+    /**
+     * Sockets of all connected clients, one thread per client. @n
+     * Kept around to be able to shut them down when stopping the server.
+     */
+    std::vector<decltype(sock)> clients;
+
+    /**
+     * Threads serving each connected client.
+     * @see clients
+     */
+    std::vector<std::thread> client_threads;
+
+    /**
+     * Protects clients and client_threads.
+     */
+    std::mutex clients_blocking;
+
+    /**
+     * Savestates, saved as a full copy of the simulated memory.
+     */
+    std::map<uint8_t, std::vector<char>> savestates;
+
+    /**
+     * Protects savestates.
+     */
+    std::mutex savestates_blocking;
+
+    /**
+     * Checks a memory IPC message does not go out of the simulated memory.
+     * @param address Address targeted by the message.
+     * @param size Size of the memory access.
+     */
+    static auto ValidAddress(uint32_t address, uint32_t size) -> bool {
+        return (uint64_t)address + size <= EE_RAM_SIZE;
+    }
+
+    /**
+     * Appends a VLE string reply to a reply buffer.
+     * @param reply The reply buffer.
+     * @param reply_len Current length of the reply, updated.
+     * @param str The string to append, including its NUL terminator.
+     * @return false if the reply would not fit.
+     */
+    static auto AppendString(char *reply, uint32_t &reply_len,
+                             const std::string &str) -> bool {
+        uint32_t size = str.size() + 1;
+        if (reply_len + 4 + size > MAX_IPC_RETURN_SIZE)
+            return false;
+        memcpy(&reply[reply_len], &size, 4);
+        memcpy(&reply[reply_len + 4], str.c_str(), size);
+        reply_len += 4 + size;
+        return true;
+    }
+
+    /**
+     * Serves a client connection until it gets closed. @n
+     * Requests are processed in the order they are received, multiple
+     * requests may be read in one go, in which case their replies are sent
+     * in one go too.
+     * @param client The client socket.
+     */
+    auto ServeClient(decltype(sock) client) -> void {
+        char *req = new char[MAX_IPC_SIZE];
+        char *reply = new char[2 * MAX_IPC_RETURN_SIZE];
+        uint32_t filled = 0;
+        // replies not sent yet
+        uint32_t reply_filled = 0;
+        // file descriptor of a shared memory sent by the client, if any
+        int fd = -1;
+        // every reply has to be its own datagram on sequenced packets
+        bool coalesce = (type != Shared::SeqPacketTransport);
+        auto flush = [&]() -> bool {
+            bool ok = SendAll(client, reply, reply_filled);
+            reply_filled = 0;
+            return ok;
+        };
+
+        while (true) {
+#ifdef __linux__
+            auto len = ReceiveFd(client, &req[filled], MAX_IPC_SIZE - filled,
+                                 fd);
+#else
+            auto len = read_portable(client, &req[filled],
+                                     MAX_IPC_SIZE - filled);
+#endif
+            if (len <= 0)
+                break;
+            filled += len;
+
+            // we process every complete message we received
+            uint32_t start = 0;
+            bool error = false;
+            while (filled - start >= 4) {
+                uint32_t size;
+                memcpy(&size, &req[start], 4);
+                if (size < 5 || size > MAX_IPC_SIZE) {
+                    error = true;
+                    break;
+                }
+                if (filled - start < size)
+                    break;
+#ifdef __linux__
+                // from now on the client talks to us through the shared
+                // memory, the socket is only there to notice it going away
+                if ((unsigned char)req[start + 4] == Shared::MsgSharedMemory &&
+                    fd >= 0) {
+                    if (!flush()) {
+                        error = true;
+                        break;
+                    }
+                    int shm_fd = fd;
+                    fd = -1;
+                    start += size;
+                    if (ServeSharedMemory(client, shm_fd)) {
+                        error = true;
+                        break;
+                    }
+                    continue;
+                }
+#endif
+                if ((reply_filled + MAX_IPC_RETURN_SIZE > 2 * MAX_IPC_RETURN_SIZE
+                     || !coalesce) &&
+                    !flush()) {
+                    error = true;
+                    break;
+                }
+                reply_filled += Dispatch(&req[start], &reply[reply_filled]);
+                start += size;
+            }
+            if (error || !flush())
+                break;
+            memmove(req, &req[start], filled - start);
+            filled -= start;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(clients_blocking);
+            clients.erase(std::find(clients.begin(), clients.end(), client));
+        }
+#ifdef __linux__
+        if (fd >= 0)
+            close(fd);
+#endif
+        close_portable(client);
+        delete[] req;
+        delete[] reply;
+    }
+
+#if defined(__linux__) || defined(DOXYGEN)
+    /**
+     * Reads from a socket, keeping any file descriptor sent along. @n
+     * Linux only.
+     * @param client The client socket.
+     * @param buf Buffer to read into.
+     * @param size The size of buf.
+     * @param fd Set to the file descriptor received, if any. Older ones get
+     * closed.
+     * @return The number of bytes read, 0 or less on error.
+     */
+    auto ReceiveFd(int client, char *buf, uint32_t size, int &fd) -> int {
+        struct iovec iov = { buf, size };
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr hdr = {};
+        hdr.msg_iov = &iov;
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        auto len = recvmsg(client, &hdr, MSG_CMSG_CLOEXEC);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        if (len > 0 && cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_RIGHTS) {
+            if (fd >= 0)
+                close(fd);
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+        return len;
+    }
+
+    /**
+     * Serves a client over the shared memory it sent until it goes away. @n
+     * Messages and replies are executed in place in the ring buffers. Linux
+     * only.
+     * @param client The client socket.
+     * @param fd The shared memory.
+     * @return true once done with the client, false if the shared memory
+     * could not be mapped and the client got told so, in which case it keeps
+     * talking to us through the socket.
+     * @see SharedMemory
+     */
+    auto ServeSharedMemory(int client, int fd) -> bool {
+        void *mem =
+            mmap(nullptr, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        char ack[5] = { 5, 0, 0, 0, 0 };
+        if (mem == MAP_FAILED) {
+            ack[4] = (char)0xFF;
+            return !SendAll(client, ack, 5);
+        }
+        if (!SendAll(client, ack, 5)) {
+            munmap(mem, SHM_SIZE);
+            return true;
+        }
+
+        SharedMemoryRing requests((char *)mem, 0, client);
+        SharedMemoryRing replies((char *)mem, 1, client);
+        while (running) {
+            char *req = requests.Peek();
+            if (!req)
+                break;
+            char *reply = replies.Reserve(MAX_IPC_RETURN_SIZE);
+            if (!reply)
+                break;
+            uint32_t reply_len = Dispatch(req, reply);
+            requests.Release();
+            replies.Commit(reply_len);
+        }
+        replies.Close();
+        munmap(mem, SHM_SIZE);
+        return true;
+    }
+#endif
+
+    /**
+     * Writes an entire buffer to a socket.
+     * @param client The client socket.
+     * @param buf The buffer to write.
+     * @param size The size of the buffer.
+     * @return false if the socket errored out.
+     */
+    auto SendAll(decltype(sock) client, const char *buf, uint32_t size)
+        -> bool {
+        uint32_t sent = 0;
+        while (sent < size) {
+#ifdef _WIN32
+            auto len = send(client, &buf[sent], size - sent, 0);
+#else
+            auto len = send(client, &buf[sent], size - sent, MSG_NOSIGNAL);
+#endif
+            if (len <= 0)
+                return false;
+            sent += len;
+        }
+        return true;
+    }
+
+    /**
+     * Accepts connections until the server is stopped.
+     */
+    auto Listen() -> void {
+        while (running) {
+            auto client = accept(sock, nullptr, nullptr);
+            if (client == (decltype(sock))-1)
+                break;
+#ifndef _WIN32
+            // replies to the biggest messages have to fit in one datagram;
+            // unix sockets do not inherit those from the listening socket
+            if (type == Shared::SeqPacketTransport) {
+                int size = MAX_IPC_SIZE * 2;
+                setsockopt(client, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+                setsockopt(client, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            }
+#endif
+            // we always write whole replies, no need to wait for more. Fails
+            // harmlessly on unix sockets.
+            int nodelay = 1;
+            setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (char *)&nodelay,
+                       sizeof(nodelay));
+            std::lock_guard<std::mutex> lock(clients_blocking);
+            if (!running) {
+                close_portable(client);
+                break;
+            }
+            clients.push_back(client);
+            client_threads.emplace_back(&Server::ServeClient, this, client);
+        }
+    }
+
+  public:
+    /**
+     * Executes an IPC message. @n
+     * Handles both single and batch messages: all commands of the message are
+     * executed in order and their replies concatenated. If any command fails
+     * the whole reply is an IPC_FAIL.
+     * @param req A full IPC message, size header included.
+     * @param reply A buffer of at least MAX_IPC_RETURN_SIZE bytes to store the
+     * reply into.
+     * @return The size of the reply, size header included.
+     * @see Shared::IPCCommand
+     */
+    auto Dispatch(const char *req, char *reply) -> uint32_t {
+        messages++;
+        std::shared_lock<std::shared_mutex> held(hold);
+        uint32_t size;
+        memcpy(&size, req, 4);
+        uint32_t pos = 4;
+        uint32_t reply_len = 5;
+        bool ok = true;
+
+        while (ok && pos < size) {
+            auto op = (unsigned char)req[pos];
+            pos += 1;
+            uint32_t address = 0;
+            // every memory operation takes an address as first argument
+            if (op <= Shared::MsgWrite64) {
+                if (pos + 4 > size) {
+                    ok = false;
+                    break;
+                }
+                memcpy(&address, &req[pos], 4);
+                pos += 4;
+            }
+            switch (op) {
+                case Shared::MsgRead8:
+                case Shared::MsgRead16:
+                case Shared::MsgRead32:
+                case Shared::MsgRead64: {
+                    uint32_t width = 1 << (op - Shared::MsgRead8);
+                    if (!ValidAddress(address, width) ||
+                        reply_len + width > MAX_IPC_RETURN_SIZE) {
+                        ok = false;
+                        break;
+                    }
+                    memcpy(&reply[reply_len], &memory[address], width);
+                    reply_len += width;
+                    break;
+                }
+                case Shared::MsgWrite8:
+                case Shared::MsgWrite16:
+                case Shared::MsgWrite32:
+                case Shared::MsgWrite64: {
+                    uint32_t width = 1 << (op - Shared::MsgWrite8);
+                    if (!ValidAddress(address, width) || pos + width > size) {
+                        ok = false;
+                        break;
+                    }
+                    memcpy(&memory[address], &req[pos], width);
+                    pos += width;
+                    break;
+                }
+                case Shared::MsgVersion:
+                    ok = AppendString(reply, reply_len, version);
+                    break;
+                case Shared::MsgTitle:
+                    ok = AppendString(reply, reply_len, title);
+                    break;
+                case Shared::MsgID:
+                    ok = AppendString(reply, reply_len, id);
+                    break;
+                case Shared::MsgUUID:
+                    ok = AppendString(reply, reply_len, uuid);
+                    break;
+                case Shared::MsgGameVersion:
+                    ok = AppendString(reply, reply_len, game_version);
+                    break;
+                case Shared::MsgSaveState:
+                case Shared::MsgLoadState: {
+                    if (pos + 1 > size) {
+                        ok = false;
+                        break;
+                    }
+                    uint8_t state = req[pos];
+                    pos += 1;
+                    std::lock_guard<std::mutex> lock(savestates_blocking);
+                    if (op == Shared::MsgSaveState) {
+                        savestates[state].assign(memory, memory + EE_RAM_SIZE);
+                    } else {
+                        auto saved = savestates.find(state);
+                        if (saved == savestates.end()) {
+                            ok = false;
+                            break;
+                        }
+                        memcpy(memory, saved->second.data(), EE_RAM_SIZE);
+                    }
+                    break;
+                }
+                case Shared::MsgReadRange:
+                case Shared::MsgWriteRange: {
+                    uint32_t length;
+                    if (!ranges || pos + 8 > size) {
+                        ok = false;
+                        break;
+                    }
+                    memcpy(&address, &req[pos], 4);
+                    memcpy(&length, &req[pos + 4], 4);
+                    pos += 8;
+                    // an empty range is valid wherever it is
+                    if (length == 0)
+                        break;
+                    if (!ValidAddress(address, length)) {
+                        ok = false;
+                        break;
+                    }
+                    if (op == Shared::MsgReadRange) {
+                        if (reply_len + length > MAX_IPC_RETURN_SIZE) {
+                            ok = false;
+                            break;
+                        }
+                        memcpy(&reply[reply_len], &memory[address], length);
+                        reply_len += length;
+                    } else {
+                        if (pos + length > size) {
+                            ok = false;
+                            break;
+                        }
+                        memcpy(&memory[address], &req[pos], length);
+                        pos += length;
+                    }
+                    break;
+                }
+                case Shared::MsgReadStrided:
+                case Shared::MsgReadGather: {
+                    uint32_t stride = 0, count, width;
+                    if (op == Shared::MsgReadStrided) {
+                        if (!gathers || pos + 13 > size) {
+                            ok = false;
+                            break;
+                        }
+                        memcpy(&address, &req[pos], 4);
+                        memcpy(&stride, &req[pos + 4], 4);
+                        memcpy(&count, &req[pos + 8], 4);
+                        width = (unsigned char)req[pos + 12];
+                        pos += 13;
+                    } else {
+                        if (!gathers || pos + 5 > size) {
+                            ok = false;
+                            break;
+                        }
+                        width = (unsigned char)req[pos];
+                        memcpy(&count, &req[pos + 1], 4);
+                        pos += 5;
+                        if ((uint64_t)count * 4 > size - pos) {
+                            ok = false;
+                            break;
+                        }
+                    }
+                    // an empty gather is valid whatever its arguments
+                    if (count == 0)
+                        break;
+                    if ((width != 1 && width != 2 && width != 4 &&
+                         width != 8) ||
+                        reply_len + (uint64_t)count * width >
+                            MAX_IPC_RETURN_SIZE) {
+                        ok = false;
+                        break;
+                    }
+                    for (uint32_t i = 0; ok && i < count; i++) {
+                        uint64_t at = address + (uint64_t)stride * i;
+                        if (op == Shared::MsgReadGather) {
+                            memcpy(&address, &req[pos + 4 * i], 4);
+                            at = address;
+                        }
+                        ok = at <= UINT32_MAX && ValidAddress(at, width);
+                        if (ok)
+                            memcpy(&reply[reply_len], &memory[at], width);
+                        reply_len += width;
+                    }
+                    if (op == Shared::MsgReadGather)
+                        pos += 4 * count;
+                    break;
+                }
+                case Shared::MsgReadPointer: {
+                    if (!pointers || pos + 6 > size) {
+                        ok = false;
+                        break;
+                    }
+                    memcpy(&address, &req[pos], 4);
+                    uint32_t width = (unsigned char)req[pos + 4];
+                    uint32_t count = (unsigned char)req[pos + 5];
+                    pos += 6;
+                    if (pos + 4 * count > size ||
+                        (width != 0 && width != 1 && width != 2 &&
+                         width != 4 && width != 8) ||
+                        reply_len + 8 > MAX_IPC_RETURN_SIZE) {
+                        ok = false;
+                        break;
+                    }
+                    // every pointer has to be readable, not only the value
+                    for (uint32_t i = 0; ok && i < count; i++) {
+                        uint32_t offset;
+                        memcpy(&offset, &req[pos + 4 * i], 4);
+                        ok = ValidAddress(address, 4);
+                        if (ok) {
+                            memcpy(&address, &memory[address], 4);
+                            address += offset;
+                        }
+                    }
+                    pos += 4 * count;
+                    if (!ok)
+                        break;
+                    if (width == 0) {
+                        memcpy(&reply[reply_len], &address, 4);
+                        reply_len += 4;
+                    } else if (ValidAddress(address, width)) {
+                        memcpy(&reply[reply_len], &memory[address], width);
+                        reply_len += width;
+                    } else {
+                        ok = false;
+                    }
+                    break;
+                }
+                case Shared::MsgStatus:
+                    if (reply_len + 4 > MAX_IPC_RETURN_SIZE) {
+                        ok = false;
+                        break;
+                    }
+                    memcpy(&reply[reply_len], &status, 4);
+                    reply_len += 4;
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+        }
+
+        if (!ok)
+            reply_len = 5;
+        memcpy(reply, &reply_len, 4);
+        reply[4] = ok ? 0 : (char)0xFF;
+        return reply_len;
+    }
+
+    /**
+     * Creates an in-process transport to this server. @n
+     * Messages sent through it are executed on the calling thread, without
+     * going through any socket, the server does not even need to be started.
+     * @return The transport, to be handed over to Shared::SetTransport.
+     * @see Loopback
+     */
+    auto MakeLoopback() -> Loopback * {
+        return new Loopback([this](const char *req, char *reply) {
+            return Dispatch(req, reply);
+        });
+    }
+
+    /**
+     * Starts listening for clients. @n
+     * Each client gets served on its own thread.
+     * @return false if the socket could not be opened.
+     */
+    auto Start() -> bool {
+        struct sockaddr_in tcp_server;
+        tcp_server.sin_family = AF_INET;
+        // localhost only
+        tcp_server.sin_addr.s_addr = inet_addr("127.0.0.1");
+        tcp_server.sin_port = htons(slot);
+        struct sockaddr *server = (struct sockaddr *)&tcp_server;
+        int server_size = sizeof(tcp_server);
+
+#ifdef _WIN32
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+#else
+        struct sockaddr_un unix_server;
+        if (type == Shared::TCPTransport) {
+            sock = socket(AF_INET, SOCK_STREAM, 0);
+            int reuse = 1;
+            setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        } else {
+            sock = socket(AF_UNIX,
+                          (type == Shared::SeqPacketTransport) ? SOCK_SEQPACKET
+                                                               : SOCK_STREAM,
+                          0);
+            unix_server.sun_family = AF_UNIX;
+            strcpy(unix_server.sun_path, SOCKET_NAME.c_str());
+            server = (struct sockaddr *)&unix_server;
+            server_size = sizeof(unix_server);
+            // a previous instance might have left its socket behind
+            unlink(SOCKET_NAME.c_str());
+        }
+#endif
+        if (bind(sock, server, server_size) < 0 ||
+            listen(sock, SOMAXCONN) < 0) {
+            close_portable(sock);
+            return false;
+        }
+        running = true;
+        listener = std::thread(&Server::Listen, this);
+        return true;
+    }
+
+    /**
+     * Stops the server and disconnects all clients.
+     */
+    auto Stop() -> void {
+        if (!running)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(clients_blocking);
+            running = false;
+            for (auto client : clients)
+                shutdown(client, 2);
+        }
+        // unblocks accept
+        shutdown(sock, 2);
+        close_portable(sock);
+        listener.join();
+        for (auto &t : client_threads)
+            t.join();
+        clients.clear();
+        client_threads.clear();
+#ifndef _WIN32
+        if (type != Shared::TCPTransport)
+            unlink(SOCKET_NAME.c_str());
+#endif
+    }
+
+    /**
+     * Server Initializer.
+     * @param slot Slot to listen to.
+     * @param emulator_name Target name to impersonate, eg "pcsx2".
+     * @param default_slot Whether this is the default slot for the target
+     * or not.
+     * @param type Transport clients have to use to reach the server.
+     * @see Shared::Shared
+     */
+    Server(const unsigned int slot, const std::string emulator_name,
+           const bool default_slot,
+           const Shared::TransportType type = Shared::DefaultTransport) {
+        this->slot = slot;
+        this->type = type;
+#ifdef _WIN32
+        WSADATA wsa;
+        WSAStartup(MAKEWORD(2, 2), &wsa);
+#else
+        char *runtime_dir = nullptr;
+#ifdef __APPLE__
+        runtime_dir = std::getenv("TMPDIR");
+#else
+        runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+#endif
+        if (runtime_dir == nullptr)
+            SOCKET_NAME = "/tmp/" + emulator_name + ".sock";
+        else {
+            SOCKET_NAME = runtime_dir;
+            SOCKET_NAME += "/" + emulator_name + ".sock";
+        }
+
+        if (!default_slot) {
+            SOCKET_NAME += "." + std::to_string(slot);
+        }
+#endif
+        memory = new char[EE_RAM_SIZE]();
+    }
+
+    /**
+     * Server Destructor.
+     */
+    virtual ~Server() {
+        Stop();
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        delete[] memory;
+    }
+};
+
+class PCSX2Server : public Server {
+  public:
+    /**
+     * PCSX2 stand-in server Initializer with a specified slot.
+     * @param slot Slot to listen to.
+     * @param type Transport clients have to use to reach the server.
+     * @see PCSX2
+     */
+    PCSX2Server(const unsigned int slot = 0,
+                const Shared::TransportType type = Shared::DefaultTransport)
+        : Server((slot == 0) ? 28011 : slot, "pcsx2", (slot == 0), type){};
+};
+
+}; // namespace PINE
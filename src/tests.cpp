@@ -1,4 +1,5 @@
 #include "pine.h"
+#include "server.h"
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 #include <climits>
@@ -15,6 +16,10 @@
  * utils/default.nix for an example on how to do that.
  */
 
+// slot of the stand-in server used by the test suite, far enough from the
+// default ones to not collide with a running emulator.
+#define TEST_SLOT 28101
+
 // a portable sleep function
 auto msleep(int sleepMs) -> void {
 #ifdef _WIN32
@@ -43,6 +48,30 @@ auto kill_pcsx2() -> int { return system("pkill PCSX2"); }
 
 #endif
 
+// a structure of the game, its fields in another order than in memory
+struct Actor {
+    u32 health;
+    float speed;
+    u8 level;
+    u16 flags;
+    u64 score;
+};
+PINE_STRUCT(Actor, 0x20, PINE::Field<&Actor::health, 0x10>,
+            PINE::Field<&Actor::speed, 0x04>, PINE::Field<&Actor::level, 0x00>,
+            PINE::Field<&Actor::flags, 0x02>, PINE::Field<&Actor::score, 0x18>);
+
+auto operator==(const Actor &a, const Actor &b) -> bool {
+    return a.health == b.health && a.speed == b.speed && a.level == b.level &&
+           a.flags == b.flags && a.score == b.score;
+}
+
+// exposes the read cache, to replay reads completing out of order
+struct CacheProbe : PINE::PCSX2 {
+    using PINE::PCSX2::PCSX2;
+    using PINE::Shared::CacheLookup;
+    using PINE::Shared::CacheStore;
+};
+
 SCENARIO("PCSX2 can be interacted with remotely through IPC", "[pine]") {
 
     // ensure we have a clean environment
@@ -217,3 +246,1077 @@ SCENARIO("PCSX2 can be interacted with remotely through IPC", "[pine]") {
         kill_pcsx2();
     }
 }
+
+SCENARIO("The stand-in server can be interacted with through IPC",
+         "[pine][server]") {
+
+    GIVEN("A stand-in server") {
+        PINE::PCSX2Server server(TEST_SLOT);
+        REQUIRE(server.Start());
+        PINE::PCSX2 *ipc = new PINE::PCSX2(TEST_SLOT);
+
+        WHEN("We want to read/write to the memory") {
+            THEN("The read/writes are consistent with the simulated RAM") {
+                ipc->Write<u64>(0x00347D34, 5);
+                ipc->Write<u32>(0x00347D44, 6);
+                ipc->Write<u16>(0x00347D54, 7);
+                ipc->Write<u8>(0x00347D64, 8);
+                REQUIRE(ipc->Read<u64>(0x00347D34) == 5);
+                REQUIRE(ipc->Read<u32>(0x00347D44) == 6);
+                REQUIRE(ipc->Read<u16>(0x00347D54) == 7);
+                REQUIRE(ipc->Read<u8>(0x00347D64) == 8);
+                REQUIRE(server.memory[0x00347D64] == 8);
+            }
+
+            THEN("Accesses out of the simulated RAM fail") {
+                REQUIRE_THROWS(ipc->Read<u32>(EE_RAM_SIZE - 2));
+                REQUIRE_THROWS(ipc->Write<u8>(EE_RAM_SIZE, 1));
+            }
+        }
+
+        WHEN("We send invalid commands") {
+            THEN("The server replies with IPC_FAIL") {
+                char c_cmd[5] = { 5, 0, 0, 0 };
+                c_cmd[4] = PINE::PCSX2::MsgUnimplemented;
+                char c_ret[5];
+                REQUIRE_THROWS(
+                    ipc->SendCommand(PINE::PCSX2::IPCBuffer{ 5, c_cmd },
+                                     PINE::PCSX2::IPCBuffer{ 5, c_ret }));
+                // the connection is still usable afterwards
+                REQUIRE_NOTHROW(ipc->Read<u8>(0));
+            }
+        }
+
+        WHEN("We want to retrieve strings and statuses") {
+            THEN("They match the server ones") {
+                char *version = ipc->Version();
+                REQUIRE(strcmp(version, server.version.c_str()) == 0);
+                delete[] version;
+                char *title = ipc->GetGameTitle();
+                REQUIRE(strcmp(title, server.title.c_str()) == 0);
+                delete[] title;
+                REQUIRE(ipc->Status() == PINE::PCSX2::Running);
+                server.status = PINE::PCSX2::Paused;
+                REQUIRE(ipc->Status() == PINE::PCSX2::Paused);
+            }
+        }
+
+        WHEN("We use savestates") {
+            THEN("Loading a state restores the memory") {
+                ipc->Write<u32>(0x1000, 0xDEADBEEF);
+                ipc->SaveState(1);
+                ipc->Write<u32>(0x1000, 0);
+                ipc->LoadState(1);
+                REQUIRE(ipc->Read<u32>(0x1000) == 0xDEADBEEF);
+                REQUIRE_THROWS(ipc->LoadState(2));
+            }
+        }
+
+        WHEN("We execute a batch mixing memory and string commands") {
+            THEN("The replies get relocated correctly") {
+                ipc->InitializeBatch();
+                ipc->Write<u64, true>(0x00347E34, 5);
+                ipc->Write<u8, true>(0x00347E64, 8);
+                ipc->SendCommand(ipc->FinalizeBatch());
+
+                ipc->InitializeBatch();
+                ipc->Read<u64, true>(0x00347E34);
+                ipc->Version<true>();
+                ipc->Read<u8, true>(0x00347E64);
+                ipc->GetGameID<true>();
+                ipc->Status<true>();
+                auto resr = ipc->FinalizeBatch();
+                ipc->SendCommand(resr);
+
+                REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead64>(resr, 0) == 5);
+                char *version =
+                    ipc->GetReply<PINE::PCSX2::MsgVersion>(resr, 1);
+                REQUIRE(strcmp(version, server.version.c_str()) == 0);
+                delete[] version;
+                REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead8>(resr, 2) == 8);
+                char *id = ipc->GetReply<PINE::PCSX2::MsgID>(resr, 3);
+                REQUIRE(strcmp(id, server.id.c_str()) == 0);
+                delete[] id;
+                REQUIRE(ipc->GetReply<PINE::PCSX2::MsgStatus>(resr, 4) ==
+                        PINE::PCSX2::Running);
+
+                // the batch is left as is, so it can be sent again
+                ipc->Write<u64>(0x00347E34, 6);
+                ipc->Write<u8>(0x00347E64, 9);
+                for (int i = 0; i < 3; i++) {
+                    ipc->SendCommand(resr);
+                    REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead64>(resr, 0) ==
+                            6);
+                    REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead8>(resr, 2) ==
+                            9);
+                    id = ipc->GetReply<PINE::PCSX2::MsgID>(resr, 3);
+                    REQUIRE(strcmp(id, server.id.c_str()) == 0);
+                    delete[] id;
+                    REQUIRE(ipc->GetReply<PINE::PCSX2::MsgStatus>(resr, 4) ==
+                            PINE::PCSX2::Running);
+                }
+            }
+
+            THEN("Batches typed at compile time decode into a tuple") {
+                ipc->Write<u32>(0x00347E34, 0xCAFE);
+                PINE::Batch<PINE::Command::Read<u32>, PINE::Command::ID,
+                            PINE::Command::Write<u16>,
+                            PINE::Command::Read<u8>, PINE::Command::Status>
+                    batch({ 0x00347E34 }, {}, { 0x00347E64, 0x1234 },
+                          { 0x00347E64 }, {});
+                auto [value, id, low, status] = ipc->Send(batch);
+                REQUIRE(value == 0xCAFE);
+                REQUIRE(id == server.id);
+                REQUIRE(low == 0x34);
+                REQUIRE(status == PINE::PCSX2::Running);
+
+                batch.Set<3>({ 0x00347E65 });
+                REQUIRE(std::get<2>(ipc->Send(batch)) == 0x12);
+
+                // commands without replies may follow a string
+                PINE::Batch<PINE::Command::Version, PINE::Command::Write<u8>>
+                    last({}, { 0x00347E66, 0x56 });
+                REQUIRE(std::get<0>(ipc->Send(last)) == server.version);
+                REQUIRE(ipc->Read<u8>(0x00347E66) == 0x56);
+                PINE::Batch<PINE::Command::ID, PINE::Command::SaveState>
+                    save({}, { 1 });
+                REQUIRE(std::get<0>(ipc->Send(save)) == server.id);
+
+                PINE::Batch<PINE::Command::Read<u16>, PINE::Command::Read<u64>,
+                            PINE::Command::Read<u8>>
+                    fixed;
+                static_assert(decltype(fixed)::fixed);
+                static_assert(decltype(fixed)::reply_offsets[2] == 15);
+                fixed.Set<0>({ 0x00347E34 });
+                REQUIRE(ipc->Send(fixed) ==
+                        std::make_tuple(u16(0xCAFE), u64(0), u8(0)));
+            }
+
+            THEN("Batches can be rebuilt into the same BatchCommand") {
+                static_assert(!std::is_copy_constructible<
+                              PINE::Shared::BatchCommand>::value);
+                PINE::Shared::BatchCommand batch;
+                for (u32 size : { 50u, 3u, 200u, 3u }) {
+                    ipc->InitializeBatch();
+                    for (u32 i = 0; i < size; i++)
+                        ipc->Write<u32, true>(0x00347F00 + i * 4, size + i);
+                    ipc->FinalizeBatch(batch);
+                    ipc->SendCommand(batch);
+
+                    ipc->InitializeBatch();
+                    ipc->GetGameTitle<true>();
+                    for (u32 i = 0; i < size; i++)
+                        ipc->Read<u32, true>(0x00347F00 + i * 4);
+                    ipc->FinalizeBatch(batch);
+                    ipc->SendCommand(batch);
+                    for (u32 i = 0; i < size; i++)
+                        REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(
+                                    batch, i + 1) == size + i);
+                }
+
+                // and moved around
+                auto moved = std::move(batch);
+                ipc->SendCommand(moved);
+                REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(moved, 1) == 3);
+            }
+
+            THEN("Optimized batches read and write the same values") {
+                // random accesses to 40 bytes, the same batch being sent
+                // as is then optimized
+                struct Op {
+                    int kind; // 0-3 = read, 4-7 = write, 8 = barrier
+                    u32 address;
+                    u64 value;
+                };
+                for (bool split : { false, true }) {
+                    u32 seed = 12345;
+                    auto random = [&seed]() {
+                        seed = seed * 1103515245 + 12345;
+                        return seed >> 8;
+                    };
+                    std::vector<Op> ops(split ? 120000 : 400);
+                    for (auto &op : ops) {
+                        op.kind = random() % 9;
+                        u32 width = 1 << (op.kind & 3);
+                        op.address = 0x00348000 + random() % (41 - width);
+                        op.value = ((u64)random() << 32) | random();
+                    }
+                    auto build = [&]() {
+                        ipc->InitializeBatch(split);
+                        for (auto &op : ops) {
+                            switch (op.kind) {
+                            case 0: ipc->Read<u8, true>(op.address); break;
+                            case 1: ipc->Read<u16, true>(op.address); break;
+                            case 2: ipc->Read<u32, true>(op.address); break;
+                            case 3: ipc->Read<u64, true>(op.address); break;
+                            case 4:
+                                ipc->Write<u8, true>(op.address, op.value);
+                                break;
+                            case 5:
+                                ipc->Write<u16, true>(op.address, op.value);
+                                break;
+                            case 6:
+                                ipc->Write<u32, true>(op.address, op.value);
+                                break;
+                            case 7:
+                                ipc->Write<u64, true>(op.address, op.value);
+                                break;
+                            default:
+                                if (op.address & 1)
+                                    ipc->Version<true>();
+                                else
+                                    ipc->Status<true>();
+                            }
+                        }
+                    };
+                    auto run = [&](PINE::Shared::BatchCommand &batch) {
+                        for (u32 i = 0; i < 5; i++)
+                            ipc->Write<u64>(0x00348000 + i * 8, 0);
+                        ipc->SendCommand(batch);
+                        std::vector<u64> values;
+                        for (u32 i = 0; i < ops.size(); i++) {
+                            switch (ops[i].kind) {
+                            case 0:
+                                values.push_back(ipc->GetReply<
+                                                 PINE::PCSX2::MsgRead8>(batch,
+                                                                        i));
+                                break;
+                            case 1:
+                                values.push_back(ipc->GetReply<
+                                                 PINE::PCSX2::MsgRead16>(batch,
+                                                                         i));
+                                break;
+                            case 2:
+                                values.push_back(ipc->GetReply<
+                                                 PINE::PCSX2::MsgRead32>(batch,
+                                                                         i));
+                                break;
+                            case 3:
+                                values.push_back(ipc->GetReply<
+                                                 PINE::PCSX2::MsgRead64>(batch,
+                                                                         i));
+                                break;
+                            case 8:
+                                if (ops[i].address & 1) {
+                                    char *version = ipc->GetReply<
+                                        PINE::PCSX2::MsgVersion>(batch, i);
+                                    values.push_back(strlen(version));
+                                    delete[] version;
+                                } else {
+                                    values.push_back(ipc->GetReply<
+                                                     PINE::PCSX2::MsgStatus>(
+                                        batch, i));
+                                }
+                            }
+                        }
+                        for (u32 i = 0; i < 5; i++)
+                            values.push_back(
+                                ipc->Read<u64>(0x00348000 + i * 8));
+                        return values;
+                    };
+
+                    build();
+                    auto plain = ipc->FinalizeBatch();
+                    build();
+                    auto optimized = ipc->FinalizeBatch(true);
+                    REQUIRE(optimized.ipc_message.size <
+                            plain.ipc_message.size);
+                    REQUIRE(optimized.parts.size() == plain.parts.size());
+                    REQUIRE(run(optimized) == run(plain));
+                }
+            }
+
+            THEN("Prepared batches can be bound again") {
+                // a structure moving around, written then read back
+                ipc->InitializeBatch();
+                char *write = ipc->Write<u32, true>(0, 0);
+                auto field = ipc->AddressSlot(write);
+                auto value = ipc->ValueSlot<u32>(write);
+                auto check = ipc->AddressSlot(ipc->Read<u32, true>(0));
+                auto prepared = ipc->FinalizeBatch(true);
+                for (u32 base : { 0x00348200u, 0x00348300u, 0x00348200u }) {
+                    prepared.Bind(field, base + 0x10);
+                    prepared.Bind(value, base ^ 0xFF);
+                    prepared.Bind(check, base + 0x10);
+                    ipc->SendCommand(prepared);
+                    REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(
+                                prepared, 1) == (base ^ 0xFF));
+                }
+                REQUIRE(ipc->Read<u32>(0x00348310) == (0x00348300u ^ 0xFF));
+
+                // placeholders keep working once the batch gets split
+                ipc->InitializeBatch(true);
+                for (u32 i = 0; i < 60000; i++)
+                    ipc->Read<u8, true>(0x00348000);
+                auto last = ipc->ValueSlot<u64>(
+                    ipc->Write<u64, true>(0x00348400, 0));
+                auto split = ipc->FinalizeBatch();
+                REQUIRE(split.parts.size() == 2);
+                split.Bind(last, 0x0123456789ABCDEF);
+                ipc->SendCommand(split);
+                REQUIRE(ipc->Read<u64>(0x00348400) == 0x0123456789ABCDEF);
+            }
+        }
+
+        delete ipc;
+        server.Stop();
+    }
+}
+
+SCENARIO("The API works the same over every transport",
+         "[pine][server][transport]") {
+
+    GIVEN("A stand-in server reachable over a transport") {
+        auto type = GENERATE(PINE::Shared::DefaultTransport,
+#ifndef _WIN32
+                             PINE::Shared::SeqPacketTransport,
+#endif
+#ifdef __linux__
+                             PINE::Shared::SharedMemoryTransport,
+                             PINE::Shared::UringTransport,
+#endif
+                             PINE::Shared::TCPTransport);
+        bool loopback = GENERATE(false, true);
+        PINE::PCSX2Server server(TEST_SLOT, type);
+        PINE::PCSX2 *ipc = new PINE::PCSX2(TEST_SLOT, type);
+        if (loopback)
+            ipc->SetTransport(server.MakeLoopback());
+        else
+            REQUIRE(server.Start());
+
+        THEN("Single commands and batches are consistent") {
+            ipc->Write<u32>(0x00347D44, 6);
+            REQUIRE(ipc->Read<u32>(0x00347D44) == 6);
+
+            // big enough to not fit in a single socket read
+            ipc->InitializeBatch();
+            for (int i = 0; i < 40000; i++)
+                ipc->Write<u64, true>(0x00100000 + i * 8, i);
+            ipc->SendCommand(ipc->FinalizeBatch());
+
+            ipc->InitializeBatch();
+            for (int i = 0; i < 40000; i++)
+                ipc->Read<u64, true>(0x00100000 + i * 8);
+            ipc->Version<true>();
+            auto resr = ipc->FinalizeBatch();
+            ipc->SendCommand(resr);
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead64>(resr, 39999) ==
+                    39999);
+            char *version =
+                ipc->GetReply<PINE::PCSX2::MsgVersion>(resr, 40000);
+            REQUIRE(strcmp(version, server.version.c_str()) == 0);
+            delete[] version;
+        }
+
+        THEN("Pipelined commands get their replies in order") {
+            // one read per batch, so every reply lands in its own buffer
+            std::vector<PINE::Shared::BatchCommand *> reads;
+            for (int i = 0; i < 100; i++) {
+                ipc->Write<u32>(0x00200000 + i * 4, i * 3);
+                ipc->InitializeBatch();
+                ipc->Read<u32, true>(0x00200000 + i * 4);
+                reads.push_back(new PINE::Shared::BatchCommand(
+                    ipc->FinalizeBatch()));
+            }
+            ipc->SetPipelineDepth(8);
+            for (int i = 0; i < 100; i++)
+                REQUIRE(ipc->Submit(*reads[i]) == (uint64_t)i);
+            REQUIRE(ipc->Pending() <= 8);
+            ipc->Flush();
+            REQUIRE(ipc->Pending() == 0);
+            for (int i = 0; i < 100; i++)
+                REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(*reads[i], 0) ==
+                        (u32)i * 3);
+
+            // a batch bigger than the pipeline window is alone in flight
+            ipc->InitializeBatch();
+            for (int i = 0; i < 40000; i++)
+                ipc->Read<u64, true>(0x00100000 + i * 8);
+            auto big = ipc->FinalizeBatch();
+            ipc->Submit(*reads[0]);
+            ipc->Submit(big);
+            REQUIRE(ipc->Pending() == 1);
+            ipc->Submit(*reads[1]);
+            REQUIRE(ipc->Pending() == 1);
+            REQUIRE(ipc->Collect() == 102);
+            REQUIRE_THROWS(ipc->Collect());
+
+            // failures are reported when collected and do not break the
+            // commands following them
+            ipc->InitializeBatch();
+            ipc->Read<u32, true>(EE_RAM_SIZE);
+            auto fail = ipc->FinalizeBatch();
+            ipc->Submit(fail);
+            ipc->Submit(*reads[2]);
+            REQUIRE_THROWS(ipc->Collect());
+            ipc->Collect();
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(*reads[2], 0) == 6);
+
+            // regular commands wait for the ones in flight
+            ipc->Submit(*reads[3]);
+            REQUIRE(ipc->Read<u32>(0x00200000 + 4 * 4) == 12);
+            REQUIRE(ipc->Pending() == 0);
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(*reads[3], 0) == 9);
+
+            for (auto read : reads)
+                delete read;
+        }
+
+        THEN("Oversized batches get split") {
+            ipc->InitializeBatch(true);
+            for (u32 i = 0; i < 120000; i++)
+                ipc->Write<u32, true>(0x00100000 + i * 4, i ^ 0x5A5A);
+            auto writes = ipc->FinalizeBatch();
+            REQUIRE(writes.parts.size() > 1);
+            ipc->SendCommand(writes);
+
+            // replies keep being counted from the start of the batch, strings
+            // included
+            ipc->InitializeBatch(true);
+            for (u32 i = 0; i < 120000; i++) {
+                ipc->Read<u32, true>(0x00100000 + i * 4);
+                if (i % 50000 == 49999)
+                    ipc->Version<true>();
+            }
+            auto reads = ipc->FinalizeBatch();
+            REQUIRE(reads.parts.size() > 1);
+            for (int pass = 0; pass < 2; pass++) {
+                if (pass == 0)
+                    ipc->SendCommand(reads);
+                else
+                    ipc->SendAsync(reads).get();
+                u32 place = 0, wrong = 0;
+                for (u32 i = 0; i < 120000; i++) {
+                    if (ipc->GetReply<PINE::PCSX2::MsgRead32>(
+                            reads, place++) != (i ^ 0x5A5A))
+                        wrong++;
+                    if (i % 50000 == 49999) {
+                        char *version =
+                            ipc->GetReply<PINE::PCSX2::MsgVersion>(reads,
+                                                                   place++);
+                        REQUIRE(strcmp(version, server.version.c_str()) == 0);
+                        delete[] version;
+                    }
+                }
+                REQUIRE(wrong == 0);
+            }
+
+            // and fail as a whole if any part fails
+            ipc->InitializeBatch(true);
+            for (u32 i = 0; i < 60000; i++)
+                ipc->Read<u32, true>((i == 59999) ? EE_RAM_SIZE : 0x00100000);
+            auto fail = ipc->FinalizeBatch();
+            REQUIRE_THROWS(ipc->SendCommand(fail));
+            REQUIRE_THROWS(ipc->SendAsync(fail).get());
+            REQUIRE(ipc->Read<u32>(0x00100004) == (1 ^ 0x5A5A));
+        }
+
+        THEN("Memory ranges move in bulk") {
+            // past MAX_RANGE_SIZE and unaligned on both ends
+            std::vector<char> data(MAX_RANGE_SIZE * 4 + 3);
+            for (size_t i = 0; i < data.size(); i++)
+                data[i] = (char)(i * 7 + i / 251);
+            std::vector<char> back(data.size());
+            ipc->WriteRange(0x00400003, data.data(), data.size());
+            ipc->ReadRange(0x00400003, back.size(), back.data());
+            REQUIRE(back == data);
+            REQUIRE(ipc->Read<u8>(0x00400003 + 8) == (u8)data[8]);
+            REQUIRE_THROWS(ipc->ReadRange(EE_RAM_SIZE - 4, 8, back.data()));
+            // empty ranges move nothing
+            ipc->WriteRange(0x00400003, data.data(), 0);
+            ipc->ReadRange(0x00400003, 0, back.data());
+            REQUIRE(back == data);
+            PINE::Scanner<u32> empty(*ipc, 0x00400000, 0);
+            REQUIRE(empty.Scan(PINE::Scanner<u32>::Unchanged) == 0);
+
+            // and in batches
+            ipc->InitializeBatch();
+            ipc->Read<u8, true>(0x00400003);
+            ipc->ReadRange<true>(0x00400004, 100);
+            ipc->Version<true>();
+            ipc->ReadRange<true>(0x00400003, 16);
+            auto batch = ipc->FinalizeBatch(true);
+            ipc->SendCommand(batch);
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead8>(batch, 0) ==
+                    (u8)data[0]);
+            REQUIRE(memcmp(ipc->GetReply<PINE::PCSX2::MsgReadRange>(batch, 1),
+                           &data[1], 100) == 0);
+            REQUIRE(memcmp(ipc->GetReply<PINE::PCSX2::MsgReadRange>(batch, 3),
+                           &data[0], 16) == 0);
+
+            // servers not knowing about them get batches of 64 bit commands
+            server.ranges = false;
+            PINE::PCSX2 fallback(TEST_SLOT, type);
+            if (loopback)
+                fallback.SetTransport(server.MakeLoopback());
+            for (auto &c : data)
+                c = ~c;
+            fallback.WriteRange(0x00400003, data.data(), data.size());
+            fallback.ReadRange(0x00400003, back.size(), back.data());
+            REQUIRE(back == data);
+        }
+
+        THEN("Values get gathered in one command") {
+            // one field of an array of structures, past MAX_RANGE_SIZE
+            u32 count = MAX_RANGE_SIZE / 4 + 10;
+            std::vector<u32> fields(count);
+            ipc->InitializeBatch(true);
+            for (u32 i = 0; i < count; i++) {
+                fields[i] = i * 3;
+                ipc->Write<u32, true>(0x00400000 + i * 0x14, fields[i]);
+            }
+            ipc->SendCommand(ipc->FinalizeBatch());
+            REQUIRE(ipc->ReadStrided<u32>(0x00400000, 0x14, count) == fields);
+
+            std::vector<u32> addresses;
+            std::vector<u16> halves;
+            for (u32 i = 0; i < 300; i++) {
+                addresses.push_back(0x00400000 + ((i * 7919) % count) * 0x14);
+                halves.push_back((u16)(((i * 7919) % count) * 3));
+            }
+            REQUIRE(ipc->ReadGather<u16>(addresses) == halves);
+            REQUIRE_THROWS(ipc->ReadStrided<u32>(EE_RAM_SIZE - 8, 4, 3));
+            // 0x100 + 0xFFFFFFF0 is past the top of memory, not 0xF0
+            REQUIRE_THROWS(ipc->ReadStrided<u32>(0x100, 0xFFFFFFF0, 2));
+            REQUIRE(ipc->ReadGather<u64>(std::vector<u32>()).empty());
+
+            // and in batches
+            ipc->InitializeBatch();
+            ipc->Write<u32, true>(0x00400000, 42);
+            ipc->ReadStrided<u8, true>(0x00400000, 0x14, 4);
+            ipc->ReadGather<u32, true>(addresses.data(), 2);
+            ipc->Read<u32, true>(0x00400000);
+            auto batch = ipc->FinalizeBatch(true);
+            ipc->SendCommand(batch);
+            const char *bytes =
+                ipc->GetReply<PINE::PCSX2::MsgReadStrided>(batch, 1);
+            REQUIRE(((u8)bytes[0] == 42 && (u8)bytes[3] == 9));
+            u32 gathered[2];
+            memcpy(gathered,
+                   ipc->GetReply<PINE::PCSX2::MsgReadGather>(batch, 2), 8);
+            REQUIRE(gathered[1] == ((7919 % count) * 3));
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(batch, 3) == 42);
+            ipc->Write<u32>(0x00400000, 0);
+
+            // servers not knowing about them get batches of reads
+            server.gathers = false;
+            PINE::PCSX2 fallback(TEST_SLOT, type);
+            if (loopback)
+                fallback.SetTransport(server.MakeLoopback());
+            REQUIRE(fallback.ReadStrided<u32>(0x00400000, 0x14, count) ==
+                    fields);
+            REQUIRE(fallback.ReadGather<u16>(addresses) == halves);
+            REQUIRE_THROWS(fallback.ReadStrided<u32>(0x100, 0xFFFFFFF0, 2));
+        }
+
+        THEN("Pointer paths get followed by the server") {
+            // [[[0x00500000]+0x10]+0x24]+0x8
+            ipc->Write<u32>(0x00500000, 0x00510000);
+            ipc->Write<u32>(0x00510010, 0x00520000);
+            ipc->Write<u32>(0x00520024, 0x00530000);
+            ipc->Write<u64>(0x00530008, 0x1122334455667788);
+            REQUIRE(ipc->ReadPointerPath<u64>(0x00500000, 0x10, 0x24, 0x8) ==
+                    0x1122334455667788);
+            REQUIRE(ipc->ReadPointerPath<u16>(0x00500000, 0x10, 0x24, 0xA) ==
+                    0x5566);
+            REQUIRE(ipc->ReadPointerPath<void>(0x00500000, 0x10, 0x24, -8) ==
+                    0x00530000 - 8);
+            REQUIRE(ipc->ReadPointerPath<u32>(0x00500000) == 0x00510000);
+            // a pointer out of memory fails the whole path
+            REQUIRE_THROWS(ipc->ReadPointerPath<u32>(0x00500000, 0x10, 0x24,
+                                                     0x8, 0));
+
+            // long paths do not fit in a single command buffer
+            u32 node = 0x00540000;
+            ipc->Write<u32>(node, node + 0x1000);
+            for (u32 i = 1; i <= 8; i++)
+                ipc->Write<u32>(node + i * 0x1000 + 4, node + (i + 1) * 0x1000);
+            REQUIRE(ipc->ReadPointerPath<void>(node, 4, 4, 4, 4, 4, 4) ==
+                    node + 0x6004);
+            REQUIRE(ipc->ReadPointerPath<u32>(node, 4, 4, 4, 4, 4, 4, 4, 4) ==
+                    node + 0x9000);
+
+            // and in batches
+            ipc->InitializeBatch();
+            ipc->ReadPointerPath<u32, true>(0x00500000, 0x10);
+            ipc->Read<u8, true>(0x00530008);
+            ipc->ReadPointerPath<void, true>(0x00500000, 0x10, 0x24);
+            auto batch = ipc->FinalizeBatch(true);
+            ipc->SendCommand(batch);
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(batch, 0) ==
+                    0x00520000);
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead8>(batch, 1) == 0x88);
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(batch, 2) ==
+                    0x00520024);
+
+            // servers not knowing about them get one read per pointer
+            server.pointers = false;
+            PINE::PCSX2 fallback(TEST_SLOT, type);
+            if (loopback)
+                fallback.SetTransport(server.MakeLoopback());
+            REQUIRE(fallback.ReadPointerPath<u64>(0x00500000, 0x10, 0x24,
+                                                  0x8) == 0x1122334455667788);
+            REQUIRE(fallback.ReadPointerPath<void>(0x00500000, 0x10) ==
+                    0x00510010);
+        }
+
+        THEN("Structures get read and written whole") {
+            u32 base = 0x00600000;
+            Actor hero{ 100, 1.5f, 7, 0x8001, 1ull << 40 };
+            ipc->Write<u64>(base + 0x08, 0x1122334455667788);
+            ipc->WriteStruct(base, hero);
+            REQUIRE(ipc->Read<u8>(base) == 7);
+            REQUIRE(ipc->Read<u16>(base + 0x02) == 0x8001);
+            REQUIRE(ipc->Read<u32>(base + 0x10) == 100);
+            REQUIRE(ipc->Read<u64>(base + 0x18) == 1ull << 40);
+            // what is not described is left alone
+            REQUIRE(ipc->Read<u64>(base + 0x08) == 0x1122334455667788);
+            REQUIRE(ipc->ReadStruct<Actor>(base) == hero);
+
+            // arrays too big for one message get split
+            std::vector<Actor> actors(20000);
+            for (u32 i = 0; i < actors.size(); i++)
+                actors[i] = Actor{ i, i * 0.5f, (u8)i, (u16)(i * 3),
+                                   (u64)i << 33 };
+            ipc->WriteStructs(base, actors);
+            REQUIRE(ipc->Read<u32>(base + 19999 * 0x20 + 0x10) == 19999);
+            REQUIRE(ipc->ReadStructs<Actor>(base, 20000) == actors);
+
+            REQUIRE_THROWS_AS(ipc->ReadStruct<Actor>(EE_RAM_SIZE - 0x10),
+                              PINE::Shared::IPCStatus);
+            REQUIRE_THROWS_AS(ipc->WriteStruct(EE_RAM_SIZE - 0x10, hero),
+                              PINE::Shared::IPCStatus);
+        }
+
+        THEN("Reads get cached until the next tick") {
+            ipc->Write<u32>(0x00600000, 1);
+            ipc->SetReadCache(true);
+            REQUIRE(ipc->Read<u32>(0x00600000) == 1);
+            uint64_t messages = server.messages;
+            REQUIRE(ipc->Read<u32>(0x00600000) == 1);
+            REQUIRE(server.messages == messages);
+
+            // what the emulator writes only shows up on the next tick
+            server.memory[0x00600000] = 2;
+            REQUIRE(ipc->Read<u32>(0x00600000) == 1);
+            ipc->Tick();
+            REQUIRE(ipc->Read<u32>(0x00600000) == 2);
+
+            // writes go through, dropping the values they overlap
+            REQUIRE(ipc->Read<u8>(0x00600001) == 0);
+            ipc->Write<u16>(0x00600000, 0x0304);
+            REQUIRE(ipc->Read<u8>(0x00600001) == 3);
+            REQUIRE(ipc->Read<u16>(0x00600000) == 0x0304);
+            REQUIRE(ipc->Read<u32>(0x00600000) == 0x0304);
+            auto stats = ipc->GetCacheStats();
+            REQUIRE(stats.hits == 3);
+            REQUIRE(stats.misses == 5);
+
+            // loading a savestate replaces every value cached
+            ipc->SaveState(3);
+            ipc->Write<u32>(0x00600000, 7);
+            REQUIRE(ipc->Read<u32>(0x00600000) == 7);
+            ipc->LoadState(3);
+            REQUIRE(ipc->Read<u32>(0x00600000) == 0x0304);
+
+            // reads sent before a write but completing after it are stale
+            CacheProbe probe(TEST_SLOT, type);
+            if (loopback)
+                probe.SetTransport(server.MakeLoopback());
+            probe.SetReadCache(true);
+            u32 stale = 0x0304;
+            uint64_t epoch;
+            char value[4];
+            REQUIRE_FALSE(probe.CacheLookup(0x00600000, 4, value, epoch));
+            probe.Write<u32>(0x00600000, 8);
+            probe.CacheStore(0x00600000, 4, (char *)&stale, epoch);
+            REQUIRE(probe.Read<u32>(0x00600000) == 8);
+            REQUIRE_FALSE(probe.CacheLookup(0x00600004, 4, value, epoch));
+            probe.WriteAsync<u32>(0x00600004, 9).get();
+            probe.CacheStore(0x00600004, 4, (char *)&stale, epoch);
+            REQUIRE(probe.Read<u32>(0x00600004) == 9);
+            probe.Write<u32>(0x00600000, 0x0304);
+
+            ipc->SetReadCache(false);
+            server.memory[0x00600000] = 5;
+            REQUIRE(ipc->Read<u32>(0x00600000) == 0x0305);
+            REQUIRE(ipc->GetCacheStats().misses == 0);
+        }
+
+        THEN("Watchers call back when values change") {
+            PINE::Watcher watcher(*ipc, std::chrono::milliseconds(1));
+            std::vector<u32> words;
+            std::vector<u8> bytes;
+            ipc->Write<u32>(0x00700000, 1);
+            watcher.Watch<u32>(0x00700000, [&](u32 v) { words.push_back(v); });
+            auto id = watcher.Watch<u8>(0x00700004,
+                                        [&](u8 v) { bytes.push_back(v); });
+            watcher.Poll();
+            watcher.Poll();
+            REQUIRE(words == std::vector<u32>{ 1 });
+            REQUIRE(bytes == std::vector<u8>{ 0 });
+            ipc->Write<u32>(0x00700000, 2);
+            watcher.Poll();
+            REQUIRE(words == std::vector<u32>{ 1, 2 });
+
+            watcher.Unwatch(id);
+            ipc->Write<u8>(0x00700004, 9);
+            watcher.Poll();
+            REQUIRE(bytes == std::vector<u8>{ 0 });
+
+            // on a thread of its own
+            std::atomic<u32> last(0);
+            watcher.Watch<u32>(0x00700008, [&](u32 v) { last = v; });
+            watcher.Start();
+            ipc->Write<u32>(0x00700008, 7);
+            for (int i = 0; i < 2000 && last != 7; i++)
+                msleep(1);
+            watcher.Stop();
+            REQUIRE(last == 7);
+            REQUIRE(words == std::vector<u32>{ 1, 2 });
+
+            // errors get reported without stopping the polling
+            std::atomic<int> errors(0);
+            watcher.OnError([&](PINE::Shared::IPCStatus) { errors++; });
+            watcher.Watch<u32>(EE_RAM_SIZE, [](u32) {});
+            REQUIRE_THROWS_AS(watcher.Poll(), PINE::Shared::IPCStatus);
+            watcher.Start();
+            for (int i = 0; i < 2000 && errors < 2; i++)
+                msleep(1);
+            watcher.Stop();
+            REQUIRE(errors >= 2);
+        }
+
+#ifdef __linux__
+        THEN("Memory gets mirrored into a shared file") {
+            std::string path =
+                "/tmp/pine-mirror-" + std::to_string(getpid());
+            ipc->Write<u32>(0x00300010, 42);
+            PINE::MemoryMirror mirror(
+                *ipc, path,
+                { { 0x00300000, 0x10000 }, { 0x00400000, 0x100000, false } });
+            REQUIRE(mirror.Valid());
+            PINE::MemoryMirror::Reader reader(path);
+            REQUIRE(reader.Valid());
+
+            // only the pages which changed get copied
+            u32 value = 0;
+            REQUIRE(mirror.Refresh() == 1);
+            REQUIRE(reader.Refreshes() == 1);
+            REQUIRE(reader.Read(0x00300010, value));
+            REQUIRE(value == 42);
+            ipc->Write<u32>(0x00300010, 43);
+            ipc->Write<u32>(0x0030F000, 1);
+            REQUIRE(mirror.Refresh() == 2);
+            REQUIRE(reader.Read(0x00300010, value));
+            REQUIRE(value == 43);
+
+            // regions not watched wait for their pages to be invalidated
+            mirror.SetSweep(0);
+            ipc->Write<u32>(0x00480000, 7);
+            REQUIRE(mirror.Refresh() == 0);
+            REQUIRE(reader.Read(0x00480000, value));
+            REQUIRE(value == 0);
+            mirror.Invalidate(0x00480000, 4);
+            REQUIRE(mirror.Refresh() == 1);
+            REQUIRE(reader.Read(0x00480000, value));
+            REQUIRE(value == 7);
+
+            REQUIRE_FALSE(reader.Read(0x00500000, value));
+            REQUIRE_FALSE(reader.Read(0x0030FFFE, value));
+            REQUIRE_FALSE(PINE::MemoryMirror::Reader(path + ".none").Valid());
+
+            mirror.SetInterval(std::chrono::milliseconds(1));
+            mirror.Start();
+            ipc->Write<u32>(0x00300020, 9);
+            for (int i = 0; i < 1000 && value != 9; i++) {
+                msleep(1);
+                reader.Read(0x00300020, value);
+            }
+            mirror.Stop();
+            REQUIRE(value == 9);
+            unlink(path.c_str());
+        }
+#endif
+
+        THEN("Scanners narrow candidates down") {
+            // one health value among others that look the same
+            u32 base = 0x00800000, size = 0x100000;
+            std::vector<u32> memory(size / 4);
+            size_t hundreds = 0;
+            for (u32 i = 0; i < memory.size(); i++) {
+                memory[i] = i % 7 == 0 ? 100 : i;
+                hundreds += memory[i] == 100;
+            }
+            ipc->WriteRange(base, memory.data(), size);
+            PINE::Scanner<u32> scanner(*ipc, base, size);
+            REQUIRE(scanner.Scan(PINE::Scanner<u32>::Exact, 100) == hundreds);
+            ipc->Write<u32>(base + 70 * 4, 90);
+            REQUIRE(scanner.Scan(PINE::Scanner<u32>::Decreased) == 1);
+            auto found = scanner.Results();
+            REQUIRE(found[0] == std::make_pair(base + 70 * 4, (u32)90));
+            REQUIRE(scanner.Scan(PINE::Scanner<u32>::Unchanged) == 1);
+            ipc->Write<u32>(base + 70 * 4, 95);
+            REQUIRE(scanner.Scan(PINE::Scanner<u32>::Unchanged) == 0);
+
+            // starting from an unknown value, every byte being a candidate
+            PINE::Scanner<u8> bytes(*ipc, base, 4096);
+            REQUIRE(bytes.Scan(PINE::Scanner<u8>::Unchanged) == 4096);
+            ipc->Write<u8>(base + 10, 200);
+            ipc->Write<u8>(base + 8, 1);
+            REQUIRE(bytes.Scan(PINE::Scanner<u8>::Increased) == 1);
+            REQUIRE(bytes.Results()[0].first == base + 10);
+            bytes.Reset();
+            REQUIRE(bytes.Scan(PINE::Scanner<u8>::Changed) == 0);
+
+            // floats, not aligned
+            float speed = 1.5f;
+            ipc->WriteRange(base + 3, &speed, sizeof(speed));
+            PINE::Scanner<float> floats(*ipc, base, 64, 1);
+            floats.Scan(PINE::Scanner<float>::Between, 1.0f, 2.0f);
+            auto speeds = floats.Results();
+            REQUIRE(std::find(speeds.begin(), speeds.end(),
+                              std::make_pair(base + 3, speed)) !=
+                    speeds.end());
+        }
+
+        THEN("Byte patterns get found in memory") {
+            // one of them straddling two chunks
+            u32 base = 0x00800000, size = 3 * PATTERN_CHUNK_SIZE;
+            u32 at[] = { base + 0x100, base + PATTERN_CHUNK_SIZE - 3,
+                         base + size - 6 };
+            const char code[] = "\x8F\xA2\x12\x34\x24\x03";
+            for (u32 address : at)
+                ipc->WriteRange(address, code, 6);
+            ipc->Write<u32>(base + 0x200, 0xEFBEADDE);
+            ipc->Write<u32>(base + 0x300, 0xEF00ADDE);
+
+            auto found = ipc->FindPattern(base, size, "8F A2 ?? ?? 24 03");
+            REQUIRE(found == std::vector<u32>(std::begin(at), std::end(at)));
+            REQUIRE(ipc->FindPattern(base, size - 1, "8F a2 12 34 ? 03")
+                        .size() == 2);
+
+            // searched at once
+            auto hits = ipc->FindPatterns(
+                base, size,
+                { "DE AD ?? EF", "8F A2 56", "8F ?? ?? ?? 24 03" });
+            REQUIRE(hits[0] == std::vector<u32>{ base + 0x200, base + 0x300 });
+            REQUIRE(hits[1].empty());
+            REQUIRE(hits[2] == found);
+
+            REQUIRE_THROWS_AS(ipc->FindPattern(base, size, "8F G2"),
+                              PINE::Shared::IPCStatus);
+            REQUIRE_THROWS_AS(ipc->FindPattern(base, size, " "),
+                              PINE::Shared::IPCStatus);
+            // the top of the address space is out of memory, so searching it
+            // fails rather than finding nothing, and regions cannot wrap
+            REQUIRE_THROWS_AS(ipc->FindPattern(0xFFFFFF00, 0x100, "8F"),
+                              PINE::Shared::IPCStatus);
+            REQUIRE_THROWS_AS(ipc->FindPattern(0xFFFFFF00, 0x200, "8F"),
+                              PINE::Shared::IPCStatus);
+        }
+
+        THEN("Asynchronous commands complete") {
+            std::vector<std::future<u32>> reads;
+            for (int i = 0; i < 100; i++) {
+                ipc->WriteAsync<u32>(0x00200000 + i * 4, i * 5);
+                reads.push_back(ipc->ReadAsync<u32>(0x00200000 + i * 4));
+            }
+            for (int i = 0; i < 100; i++)
+                REQUIRE(reads[i].get() == (u32)i * 5);
+
+            // failures end up in the future, not in the following commands
+            auto fail = ipc->ReadAsync<u32>(EE_RAM_SIZE);
+            auto status = ipc->StatusAsync();
+            REQUIRE_THROWS_AS(fail.get(), PINE::Shared::IPCStatus);
+            REQUIRE(status.get() == PINE::Shared::Running);
+
+            ipc->InitializeBatch();
+            ipc->Read<u32, true>(0x00200000 + 4);
+            ipc->Version<true>();
+            auto batch = ipc->FinalizeBatch();
+            ipc->SendAsync(batch).get();
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(batch, 0) == 5);
+            char *version = ipc->GetReply<PINE::PCSX2::MsgVersion>(batch, 1);
+            REQUIRE(strcmp(version, server.version.c_str()) == 0);
+            delete[] version;
+
+            // callbacks, collected by a blocking command if need be
+            std::atomic<int> done(0);
+            for (int i = 0; i < 50; i++)
+                ipc->ReadAsync<u32>(0x00200000 + i * 4,
+                                    [&, i](PINE::Shared::IPCStatus s, u32 v) {
+                                        if (s == PINE::Shared::Success &&
+                                            v == (u32)i * 5)
+                                            done++;
+                                    });
+            REQUIRE(ipc->Read<u32>(0x00200000 + 8) == 10);
+            REQUIRE(done == 50);
+        }
+
+        THEN("Threads can share the IPC session") {
+            ipc->SetPoolSize(4);
+            std::vector<std::thread> threads;
+            std::atomic<int> errors(0);
+            for (int t = 0; t < 4; t++) {
+                threads.emplace_back([&, t]() {
+                    for (int i = 0; i < 200; i++) {
+                        u32 address = 0x00300000 + (t * 200 + i) * 4;
+                        try {
+                            ipc->Write<u32>(address, t * 1000 + i);
+                            if (ipc->Read<u32>(address) != (u32)(t * 1000 + i))
+                                errors++;
+                        } catch (...) {
+                            errors++;
+                        }
+                    }
+                });
+            }
+            for (auto &t : threads)
+                t.join();
+            REQUIRE(errors == 0);
+
+            // building a batch does not keep other threads from sending
+            // commands
+            ipc->Write<u32>(0x00347D44, 6);
+            ipc->InitializeBatch();
+            ipc->Read<u32, true>(0x00347D44);
+            u32 value = 0;
+            std::thread([&]() { value = ipc->Read<u32>(0x00347D44); }).join();
+            REQUIRE(value == 6);
+            auto resr = ipc->FinalizeBatch();
+            ipc->SendCommand(resr);
+            REQUIRE(ipc->GetReply<PINE::PCSX2::MsgRead32>(resr, 0) == 6);
+        }
+
+        THEN("Threads build batches of their own") {
+            ipc->SetPoolSize(4);
+            // a batch being built the shared way holds up no builder
+            ipc->InitializeBatch();
+            std::vector<std::thread> threads;
+            std::atomic<int> errors(0);
+            for (int t = 0; t < 4; t++) {
+                threads.emplace_back([&, t]() {
+                    thread_local PINE::Shared::BatchBuilder builder;
+                    PINE::Shared::BatchCommand batch;
+                    for (int pass = 0; pass < 10; pass++) {
+                        u32 base = 0x00300000 + t * 0x1000;
+                        builder.Initialize();
+                        for (u32 i = 0; i < 100; i++)
+                            builder.Write<u32>(base + i * 4, pass * 100 + i);
+                        builder.Version();
+                        for (u32 i = 0; i < 100; i++)
+                            builder.Read<u32>(base + i * 4);
+                        builder.Finalize(batch);
+                        try {
+                            ipc->SendCommand(batch);
+                            for (u32 i = 0; i < 100; i++)
+                                if (ipc->GetReply<PINE::PCSX2::MsgRead32>(
+                                        batch, 101 + i) != pass * 100 + i)
+                                    errors++;
+                        } catch (...) {
+                            errors++;
+                        }
+                    }
+                });
+            }
+            for (auto &t : threads)
+                t.join();
+            REQUIRE(errors == 0);
+            ipc->FinalizeBatch();
+
+            // and fail the same way once full
+            PINE::Shared::BatchBuilder builder;
+            REQUIRE_THROWS_AS(
+                [&]() {
+                    for (int i = 0; i < 60000; i++)
+                        builder.Read<u8>(0x00300000);
+                }(),
+                PINE::Shared::IPCStatus);
+        }
+
+        THEN("Concurrent single reads get coalesced") {
+            for (u32 i = 0; i < 12; i++)
+                ipc->Write<u32>(0x00300000 + i * 4, i * 7);
+            // batches only leave once full, the server holding the first one
+            // back while the others queue up behind it
+            ipc->SetCoalescing(std::chrono::seconds(10), 4);
+            std::vector<std::thread> threads;
+            std::atomic<int> errors(0);
+            uint64_t before = server.messages;
+            {
+                std::unique_lock<std::shared_mutex> held(server.hold);
+                for (u32 t = 0; t < 12; t++) {
+                    threads.emplace_back([&, t]() {
+                        try {
+                            if (ipc->Read<u32>(0x00300000 + t * 4) != t * 7)
+                                errors++;
+                        } catch (...) {
+                            errors++;
+                        }
+                    });
+                }
+                while (server.messages == before)
+                    std::this_thread::yield();
+            }
+            for (auto &t : threads)
+                t.join();
+            REQUIRE(errors == 0);
+            REQUIRE(server.messages - before == 3);
+
+            // writes are sent on their own, a failed batch not telling which
+            // of its commands got executed
+            before = server.messages;
+            ipc->Write<u32>(0x00300000, 1);
+            REQUIRE(server.messages - before == 1);
+
+            // a failing read does not fail the ones merged with it
+            ipc->SetCoalescing(std::chrono::milliseconds(2), 8);
+            std::vector<std::thread> failing;
+            std::atomic<int> failed(0);
+            for (int t = 0; t < 4; t++) {
+                failing.emplace_back([&, t]() {
+                    try {
+                        ipc->Read<u32>(t == 0 ? EE_RAM_SIZE : 0x00300000);
+                    } catch (PINE::Shared::IPCStatus) {
+                        failed++;
+                    }
+                });
+            }
+            for (auto &t : failing)
+                t.join();
+            REQUIRE(failed == 1);
+            ipc->SetCoalescing(std::chrono::microseconds(0));
+        }
+
+        THEN("Failures are reported") {
+            REQUIRE_THROWS(ipc->Read<u32>(EE_RAM_SIZE));
+            // and do not break the following commands
+            ipc->Write<u32>(0x00347D44, 6);
+            REQUIRE(ipc->Read<u32>(0x00347D44) == 6);
+
+            // replies bigger than the buffer given fail the receive
+            std::unique_ptr<PINE::Loopback> direct(server.MakeLoopback());
+            char version[4 + 1] = { 5, 0, 0, 0, PINE::PCSX2::MsgVersion };
+            char small[8];
+            REQUIRE(direct->Send(version, sizeof(version)));
+            REQUIRE(direct->Receive(small, sizeof(small)) == 0);
+            std::vector<char> big(MAX_IPC_RETURN_SIZE);
+            REQUIRE(direct->Send(version, sizeof(version)));
+            REQUIRE(direct->Receive(big.data(), big.size()) ==
+                    (int)(5 + 4 + server.version.size() + 1));
+        }
+
+        delete ipc;
+        server.Stop();
+    }
+
+    GIVEN("No server") {
+        PINE::PCSX2 *ipc =
+            new PINE::PCSX2(TEST_SLOT, PINE::Shared::TCPTransport);
+        THEN("Errors should happen") {
+            REQUIRE_THROWS(ipc->Read<u32>(0x00347D44));
+        }
+        delete ipc;
+    }
+}